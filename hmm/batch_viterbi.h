@@ -0,0 +1,80 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Decodes many independent observation sequences in parallel.
+ *
+ * <p>Each sequence is given as a list of ViterbiSteps. The first step starts
+ * the HMM with its emission probabilities (see
+ * ViterbiAlgorithm::StartWithInitialObservation) and ignores transitions; all
+ * further steps are passed to ViterbiAlgorithm::NextStep. Sequences are
+ * decoded on a work-stealing ThreadPool, longest first, and results are
+ * returned in input order.
+ *
+ * @param <S> the state type
+ * @param <O> the observation type
+ * @param <D> the transition descriptor type
+ */
+
+#ifndef BATCH_VITERBI_H_
+#define BATCH_VITERBI_H_
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "sequence_state.h"
+#include "thread_pool.h"
+#include "transition.h"
+#include "viterbi_algorithm.h"
+#include "viterbi_step.h"
+
+namespace hmm {
+
+template <typename S, typename O, typename D>
+class BatchResult {
+ public:
+  // See ViterbiAlgorithm::ComputeMostLikelySequence().
+  std::vector<SequenceState<S, O, D>> sequence;
+  // See ViterbiAlgorithm::IsBroken().
+  bool isBroken = false;
+};
+
+template <typename S, typename O, typename D>
+class BatchViterbi {
+ private:
+  std::unique_ptr<ThreadPool> own_pool;
+  ThreadPool *pool;
+
+ public:
+  // Uses a new pool with one thread per hardware thread if numThreads <= 0.
+  explicit BatchViterbi(int numThreads = 0);
+  // Uses the given pool, which must outlive this instance.
+  explicit BatchViterbi(ThreadPool *threadPool);
+  ~BatchViterbi() {}
+
+  // Decodes all sequences. result[i] belongs to sequences[i].
+  std::vector<BatchResult<S, O, D>> Decode(
+      std::vector<std::vector<ViterbiStep<S, O, D>>> &sequences);
+
+ private:
+  void DecodeSequence(std::vector<ViterbiStep<S, O, D>> &steps,
+                      BatchResult<S, O, D> *result);
+};
+
+}  // namespace hmm
+
+#include "batch_viterbi_def.h"
+#endif  // BATCH_VITERBI_H_
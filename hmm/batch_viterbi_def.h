@@ -0,0 +1,74 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef batch_viterbi_def_hpp
+#define batch_viterbi_def_hpp
+
+#include "batch_viterbi.h"
+
+#include <algorithm>
+
+namespace hmm {
+
+template <typename S, typename O, typename D>
+BatchViterbi<S, O, D>::BatchViterbi(int numThreads)
+    : own_pool(new ThreadPool(numThreads)), pool(own_pool.get()) {}
+template <typename S, typename O, typename D>
+BatchViterbi<S, O, D>::BatchViterbi(ThreadPool* threadPool)
+    : pool(threadPool) {}
+template <typename S, typename O, typename D>
+std::vector<BatchResult<S, O, D>> BatchViterbi<S, O, D>::Decode(
+    std::vector<std::vector<ViterbiStep<S, O, D>>>& sequences) {
+  std::vector<BatchResult<S, O, D>> results(sequences.size());
+  // Longest sequences first, so that short ones fill the gaps at the end.
+  std::vector<size_t> order(sequences.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&sequences](size_t lhs, size_t rhs) {
+                     return sequences[lhs].size() > sequences[rhs].size();
+                   });
+  pool->ParallelFor(order.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      DecodeSequence(sequences[order[i]], &results[order[i]]);
+    }
+  });
+  return results;
+}
+template <typename S, typename O, typename D>
+void BatchViterbi<S, O, D>::DecodeSequence(
+    std::vector<ViterbiStep<S, O, D>>& steps, BatchResult<S, O, D>* result) {
+  if (steps.empty()) {
+    return;
+  }
+  ViterbiAlgorithm<S, O, D> viterbi;
+  viterbi.StartWithInitialObservation(steps[0].observation,
+                                      steps[0].candidates,
+                                      steps[0].emissionLogProbabilities);
+  for (size_t t = 1; t < steps.size() && !viterbi.IsBroken(); ++t) {
+    viterbi.NextStep(steps[t].observation, steps[t].candidates,
+                     steps[t].emissionLogProbabilities,
+                     steps[t].transitionLogProbabilities,
+                     steps[t].transitionDescriptors);
+  }
+  result->sequence = viterbi.ComputeMostLikelySequence();
+  result->isBroken = viterbi.IsBroken();
+}
+
+}  // namespace hmm
+
+#endif /* batch_viterbi_def_hpp */
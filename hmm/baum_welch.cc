@@ -0,0 +1,294 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "baum_welch.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace hmm {
+
+namespace {
+
+// Writes the probabilities of logProbabilities to probabilities.
+void Exp(const std::vector<double> &logProbabilities, double *probabilities) {
+  for (size_t i = 0; i < logProbabilities.size(); ++i) {
+    probabilities[i] = std::exp(logProbabilities[i]);
+  }
+}
+
+// Returns sum_i a[i] * b[i]. Four independent partial sums let the compiler
+// vectorize the loop, which a single chain of additions would prevent.
+double Dot(const double *a, const double *b, size_t n) {
+  double sums[4] = {0.0, 0.0, 0.0, 0.0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    sums[0] += a[i] * b[i];
+    sums[1] += a[i + 1] * b[i + 1];
+    sums[2] += a[i + 2] * b[i + 2];
+    sums[3] += a[i + 3] * b[i + 3];
+  }
+  for (; i < n; ++i) {
+    sums[0] += a[i] * b[i];
+  }
+  return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+}  // namespace
+
+bool DiscreteHmm::IsValid() const {
+  if (numStates <= 0 || numSymbols <= 0 ||
+      initialLogProbabilities.size() != (size_t)numStates ||
+      transitionLogProbabilities.size() != (size_t)numStates * numStates ||
+      emissionLogProbabilities.size() != (size_t)numSymbols) {
+    return false;
+  }
+  for (auto &symbolEmissions : emissionLogProbabilities) {
+    if (symbolEmissions.size() != (size_t)numStates) {
+      return false;
+    }
+  }
+  return true;
+}
+
+BaumWelch::BaumWelch(int numThreads)
+    : own_pool(new ThreadPool(numThreads)), pool(own_pool.get()) {}
+
+BaumWelch::BaumWelch(ThreadPool *threadPool) : pool(threadPool) {}
+
+BaumWelchResult BaumWelch::Iterate(
+    const std::vector<std::vector<int>> &sequences, DiscreteHmm &model) {
+  BaumWelchResult result;
+  if (!model.IsValid()) {
+    return result;
+  }
+  for (auto &sequence : sequences) {
+    for (int symbol : sequence) {
+      if (symbol < 0 || symbol >= model.numSymbols) {
+        return result;
+      }
+    }
+  }
+  const size_t n = model.numStates;
+  num_states = model.numStates;
+  initial.resize(n);
+  Exp(model.initialLogProbabilities, initial.data());
+  transitions.resize(n * n);
+  Exp(model.transitionLogProbabilities, transitions.data());
+  emissions.resize(model.numSymbols * n);
+  for (int o = 0; o < model.numSymbols; ++o) {
+    Exp(model.emissionLogProbabilities[o], &emissions[o * n]);
+  }
+
+  // E-step, one set of counts per range of sequences.
+  const size_t count = sequences.size();
+  const size_t grainSize = pool->GrainSize(count, 16);
+  const size_t numRanges =
+      std::max<size_t>((count + grainSize - 1) / grainSize, 1);
+  range_counts.resize(numRanges);
+  range_scratch.resize(numRanges);
+  for (auto &counts : range_counts) {
+    counts.initial.assign(n, 0.0);
+    counts.transitions.assign(n * n, 0.0);
+    counts.emissions.assign(emissions.size(), 0.0);
+    counts.logLikelihood = 0.0;
+    counts.numSequences = 0;
+  }
+  pool->ParallelFor(count, grainSize, [&](size_t begin, size_t end) {
+    const size_t range = begin / grainSize;
+    for (size_t s = begin; s < end; ++s) {
+      AccumulateSequence(sequences[s], range_counts[range],
+                         range_scratch[range]);
+    }
+  });
+  Counts &total = range_counts[0];
+  for (size_t range = 1; range < numRanges; ++range) {
+    const Counts &counts = range_counts[range];
+    for (size_t i = 0; i < n; ++i) {
+      total.initial[i] += counts.initial[i];
+    }
+    for (size_t k = 0; k < total.transitions.size(); ++k) {
+      total.transitions[k] += counts.transitions[k];
+    }
+    for (size_t k = 0; k < total.emissions.size(); ++k) {
+      total.emissions[k] += counts.emissions[k];
+    }
+    total.logLikelihood += counts.logLikelihood;
+    total.numSequences += counts.numSequences;
+  }
+
+  // M-step
+  if (total.numSequences > 0) {
+    Maximize(total, model);
+  }
+  result.logLikelihood = total.logLikelihood;
+  result.numSequences = total.numSequences;
+  return result;
+}
+
+BaumWelchResult BaumWelch::Train(
+    const std::vector<std::vector<int>> &sequences, DiscreteHmm &model,
+    int maxIterations, double tolerance) {
+  BaumWelchResult result;
+  for (int iteration = 0; iteration < maxIterations; ++iteration) {
+    const BaumWelchResult next = Iterate(sequences, model);
+    const bool converged =
+        next.numSequences == 0 ||
+        (iteration > 0 &&
+         next.logLikelihood - result.logLikelihood < tolerance);
+    result = next;
+    if (converged) {
+      break;
+    }
+  }
+  return result;
+}
+
+void BaumWelch::AccumulateSequence(const std::vector<int> &sequence,
+                                   Counts &counts, Scratch &scratch) const {
+  const size_t numTimeSteps = sequence.size();
+  const size_t n = num_states;
+  if (numTimeSteps == 0) {
+    return;
+  }
+  std::vector<double> &alpha = scratch.alpha;
+  std::vector<double> &scale = scratch.scale;
+  alpha.resize(numTimeSteps * n);
+  scale.resize(numTimeSteps);
+
+  // Forward pass. alpha_t is normalized to sum 1, scale[t] is the factor,
+  // so that the likelihood is the product of all factors.
+  for (size_t t = 0; t < numTimeSteps; ++t) {
+    double *current = &alpha[t * n];
+    const double *emission = &emissions[sequence[t] * n];
+    if (t == 0) {
+      for (size_t j = 0; j < n; ++j) {
+        current[j] = initial[j];
+      }
+    } else {
+      const double *previous = &alpha[(t - 1) * n];
+      std::fill(current, current + n, 0.0);
+      for (size_t i = 0; i < n; ++i) {
+        const double weight = previous[i];
+        if (weight == 0.0) {
+          continue;
+        }
+        const double *row = &transitions[i * n];
+        for (size_t j = 0; j < n; ++j) {
+          current[j] += weight * row[j];
+        }
+      }
+    }
+    double sum = 0.0;
+    for (size_t j = 0; j < n; ++j) {
+      current[j] *= emission[j];
+      sum += current[j];
+    }
+    if (!(sum > 0.0)) {
+      // Zero probability, nothing has been added to counts yet.
+      return;
+    }
+    scale[t] = sum;
+    const double inverse = 1.0 / sum;
+    for (size_t j = 0; j < n; ++j) {
+      current[j] *= inverse;
+    }
+  }
+
+  // Backward pass with beta_t scaled by the same factors, so that
+  // alpha_t(i) * beta_t(i) is the posterior probability of state i at t.
+  std::vector<double> &beta = scratch.beta;
+  std::vector<double> &nextBeta = scratch.nextBeta;
+  std::vector<double> &weights = scratch.weights;
+  beta.assign(n, 1.0);
+  nextBeta.resize(n);
+  weights.resize(n);
+  for (size_t t = numTimeSteps - 1; t > 0; --t) {
+    const double *current = &alpha[t * n];
+    const double *previous = &alpha[(t - 1) * n];
+    const double *emission = &emissions[sequence[t] * n];
+    double *emissionCounts = &counts.emissions[sequence[t] * n];
+    const double inverse = 1.0 / scale[t];
+    for (size_t j = 0; j < n; ++j) {
+      emissionCounts[j] += current[j] * beta[j];
+      weights[j] = emission[j] * beta[j] * inverse;
+    }
+    // The expected count of transition i -> j is previous[i] * a_ij *
+    // weights[j]; a_ij is applied in Maximize().
+    for (size_t i = 0; i < n; ++i) {
+      const double weight = previous[i];
+      const double *row = &transitions[i * n];
+      double *transitionCounts = &counts.transitions[i * n];
+      for (size_t j = 0; j < n; ++j) {
+        transitionCounts[j] += weight * weights[j];
+      }
+      nextBeta[i] = Dot(row, weights.data(), n);
+    }
+    beta.swap(nextBeta);
+  }
+  double *emissionCounts = &counts.emissions[sequence[0] * n];
+  for (size_t i = 0; i < n; ++i) {
+    const double posterior = alpha[i] * beta[i];
+    emissionCounts[i] += posterior;
+    counts.initial[i] += posterior;
+  }
+  double logLikelihood = 0.0;
+  for (size_t t = 0; t < numTimeSteps; ++t) {
+    logLikelihood += std::log(scale[t]);
+  }
+  counts.logLikelihood += logLikelihood;
+  counts.numSequences++;
+}
+
+void BaumWelch::Maximize(const Counts &counts, DiscreteHmm &model) const {
+  const size_t n = num_states;
+  double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += counts.initial[i];
+  }
+  if (sum > 0.0) {
+    for (size_t i = 0; i < n; ++i) {
+      model.initialLogProbabilities[i] = std::log(counts.initial[i] / sum);
+    }
+  }
+  std::vector<double> row(n);
+  for (size_t i = 0; i < n; ++i) {
+    sum = 0.0;
+    for (size_t j = 0; j < n; ++j) {
+      row[j] = counts.transitions[i * n + j] * transitions[i * n + j];
+      sum += row[j];
+    }
+    if (sum > 0.0) {
+      for (size_t j = 0; j < n; ++j) {
+        model.transitionLogProbabilities[i * n + j] = std::log(row[j] / sum);
+      }
+    }
+  }
+  for (size_t j = 0; j < n; ++j) {
+    sum = 0.0;
+    for (int o = 0; o < model.numSymbols; ++o) {
+      sum += counts.emissions[o * n + j];
+    }
+    if (sum > 0.0) {
+      for (int o = 0; o < model.numSymbols; ++o) {
+        model.emissionLogProbabilities[o][j] =
+            std::log(counts.emissions[o * n + j] / sum);
+      }
+    }
+  }
+}
+
+}  // namespace hmm
@@ -0,0 +1,141 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Baum-Welch (EM) training of discrete, time-homogeneous HMMs.
+ *
+ * <p>DiscreteHmm uses the index based layout of DenseViterbiAlgorithm and
+ * MappedModel, so a trained model is decoded or written without conversion:
+ * states are 0, ..., numStates - 1, observations are symbols 0, ...,
+ * numSymbols - 1, emissionLogProbabilities[o] holds one log probability per
+ * state and transitionLogProbabilities is the row-major matrix with one row
+ * per previous state.
+ *
+ * <p>Each Iterate() runs one EM iteration over all training sequences:
+ * - E-step: a scaled forward-backward pass per sequence computes the expected
+ *   number of initial states, transitions and emissions. Sequences are split
+ *   into ranges on a work-stealing ThreadPool; each range accumulates into
+ *   its own counts, which are summed up in range order afterwards, so the
+ *   threads never share counts. Results may differ in the last bits between
+ *   pools with different numbers of threads, since the ranges differ.
+ * - M-step: the counts are normalized into new log probabilities.
+ * Transitions and emissions with zero probability keep zero probability, so
+ * the structure of a sparse model is preserved. Rows without any expected
+ * count, e.g. of states that are never visited, are left unchanged.
+ *
+ * <p>The forward-backward pass works on probabilities instead of log
+ * probabilities and rescales the forward message of each time step to sum 1,
+ * which avoids exp() and log() in the inner loops. A time step costs
+ * O(numStates²). Sequences with zero probability under the current model are
+ * skipped.
+ */
+
+#ifndef BAUM_WELCH_H_
+#define BAUM_WELCH_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "thread_pool.h"
+
+namespace hmm {
+
+class DiscreteHmm {
+ public:
+  int numStates = 0;
+  int numSymbols = 0;
+  // numStates entries.
+  std::vector<double> initialLogProbabilities;
+  // numStates x numStates, row-major, -infinity for missing transitions.
+  std::vector<double> transitionLogProbabilities;
+  // numSymbols x numStates.
+  std::vector<std::vector<double>> emissionLogProbabilities;
+
+  // Whether all sizes match numStates and numSymbols.
+  bool IsValid() const;
+};
+
+class BaumWelchResult {
+ public:
+  // Sum of the log likelihoods of all sequences with non-zero probability
+  // under the model before the iteration.
+  double logLikelihood = 0.0;
+  // Sequences with non-zero probability, i.e. all others were skipped.
+  size_t numSequences = 0;
+};
+
+class BaumWelch {
+ private:
+  // Expected counts of one range of sequences.
+  struct Counts {
+    std::vector<double> initial;
+    // Sum of alpha_t(i) * b_j(o_t+1) * beta_t+1(j), multiplied by a_ij only
+    // once in the M-step.
+    std::vector<double> transitions;
+    std::vector<double> emissions;
+    double logLikelihood;
+    size_t numSequences;
+  };
+  // Scratch of one range of sequences.
+  struct Scratch {
+    // Scaled forward messages of all time steps of a sequence.
+    std::vector<double> alpha;
+    std::vector<double> scale;
+    std::vector<double> beta;
+    std::vector<double> nextBeta;
+    std::vector<double> weights;
+  };
+
+  std::unique_ptr<ThreadPool> own_pool;
+  ThreadPool *pool;
+  // Probabilities of the model of the current iteration.
+  int num_states = 0;
+  std::vector<double> initial;
+  std::vector<double> transitions;
+  // numSymbols x numStates.
+  std::vector<double> emissions;
+  std::vector<Counts> range_counts;
+  std::vector<Scratch> range_scratch;
+
+ public:
+  // Uses a new pool with one thread per hardware thread if numThreads <= 0.
+  explicit BaumWelch(int numThreads = 0);
+  // Uses the given pool, which must outlive this instance.
+  explicit BaumWelch(ThreadPool *threadPool);
+  ~BaumWelch() {}
+
+  // Runs one EM iteration and replaces the parameters of model. Sequences are
+  // symbol indices. Leaves model unchanged and returns an empty result if
+  // model is invalid or a symbol is out of range.
+  BaumWelchResult Iterate(const std::vector<std::vector<int>> &sequences,
+                          DiscreteHmm &model);
+  // Runs Iterate() until the log likelihood improves by less than tolerance
+  // or maxIterations are done. Returns the result of the last iteration.
+  BaumWelchResult Train(const std::vector<std::vector<int>> &sequences,
+                        DiscreteHmm &model, int maxIterations,
+                        double tolerance);
+
+ private:
+  // Adds the expected counts of one sequence to counts.
+  void AccumulateSequence(const std::vector<int> &sequence, Counts &counts,
+                          Scratch &scratch) const;
+  // Writes the normalized counts to model.
+  void Maximize(const Counts &counts, DiscreteHmm &model) const;
+};
+
+}  // namespace hmm
+
+#endif  // BAUM_WELCH_H_
@@ -0,0 +1,108 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Offline Viterbi decoder with memory bounded by checkpoints.
+ *
+ * <p>ViterbiAlgorithm keeps back pointers for all time steps that may still
+ * be part of the most likely sequence, in the worst case t*n of them. This
+ * decoder keeps only the forward message of every k-th time step
+ * (checkpoint) during the forward pass. The backtrace then walks the
+ * segments between checkpoints from last to first; each segment is computed
+ * forward again from its checkpoint, this time keeping its back pointers.
+ * With k = √t, memory is O(√t * n) and every time step is computed at most
+ * twice.
+ *
+ * <p>Time steps are requested from a StepProvider by index, in the format of
+ * BatchViterbi (see ViterbiStep), and must be the same each time a time step
+ * is requested. The forward step and tie breaking are those of
+ * ViterbiAlgorithm, so the result is exactly the sequence ViterbiAlgorithm
+ * computes for the same time steps.
+ *
+ * @param <S> the state type
+ * @param <O> the observation type
+ * @param <D> the transition descriptor type
+ */
+
+#ifndef CHECKPOINTED_VITERBI_H_
+#define CHECKPOINTED_VITERBI_H_
+
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+#include "sequence_state.h"
+#include "transition.h"
+#include "viterbi_step.h"
+
+namespace hmm {
+
+template <typename S, typename O, typename D>
+class CheckpointedViterbi {
+ public:
+  // Fills *step with the inputs of the given time step, overwriting all
+  // fields. Time step 0 is the initial time step.
+  typedef std::function<void(size_t, ViterbiStep<S, O, D> *)> StepProvider;
+
+ private:
+  size_t checkpoint_interval;
+  // Forward message, candidates and observation of every checkpoint.
+  std::vector<std::vector<double>> checkpoint_messages;
+  std::vector<std::vector<S>> checkpoint_candidates;
+  std::vector<O> checkpoint_observations;
+  // Back pointers, candidates, observations and back pointer descriptors of
+  // the segment being traced back, one entry per time step after the
+  // checkpoint.
+  std::vector<std::vector<int>> segment_back_pointers;
+  std::vector<std::vector<S>> segment_candidates;
+  std::vector<O> segment_observations;
+  std::vector<std::vector<D>> segment_descriptors;
+  ViterbiStep<S, O, D> step;
+  std::vector<double> message;
+  std::vector<double> new_message;
+  std::vector<S> prev_candidates;
+  bool is_broken = false;
+
+ public:
+  // Keeps every checkpointInterval-th forward message, or about √t of them if
+  // checkpointInterval is 0.
+  explicit CheckpointedViterbi(size_t checkpointInterval = 0);
+  ~CheckpointedViterbi() {}
+
+  // Returns the most likely sequence of states for time steps
+  // [0, numTimeSteps). Calls provider about twice per time step. Like
+  // ViterbiAlgorithm::ComputeMostLikelySequence(), the sequence ends before
+  // the time step that caused an HMM break.
+  std::vector<SequenceState<S, O, D>> ComputeMostLikelySequence(
+      size_t numTimeSteps, const StepProvider &provider);
+  // Returns whether an HMM break occurred in the last decoded sequence.
+  bool IsBroken();
+
+ private:
+  // Computes new_message from message and prev_candidates. If backPointers is
+  // not nullptr, also stores the back pointer of each candidate (-1 if none)
+  // and the descriptor of its transition.
+  void ForwardStep(std::vector<int> *backPointers, std::vector<D> *descriptors);
+  bool HMMBreak(const std::vector<double> &message);
+  int MostLikelyStateIndex(const std::vector<S> &candidates);
+};
+
+}  // namespace hmm
+
+#include "checkpointed_viterbi_def.h"
+#endif  // CHECKPOINTED_VITERBI_H_
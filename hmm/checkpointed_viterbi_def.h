@@ -0,0 +1,197 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef checkpointed_viterbi_def_hpp
+#define checkpointed_viterbi_def_hpp
+
+#include "checkpointed_viterbi.h"
+
+namespace hmm {
+
+template <typename S, typename O, typename D>
+CheckpointedViterbi<S, O, D>::CheckpointedViterbi(size_t checkpointInterval)
+    : checkpoint_interval(checkpointInterval) {}
+template <typename S, typename O, typename D>
+std::vector<SequenceState<S, O, D>>
+CheckpointedViterbi<S, O, D>::ComputeMostLikelySequence(
+    size_t numTimeSteps, const StepProvider& provider) {
+  std::vector<SequenceState<S, O, D>> result;
+  checkpoint_messages.clear();
+  checkpoint_candidates.clear();
+  checkpoint_observations.clear();
+  is_broken = false;
+  if (numTimeSteps == 0) {
+    return result;
+  }
+  size_t interval = checkpoint_interval;
+  if (interval == 0) {
+    interval = (size_t)std::ceil(std::sqrt((double)numTimeSteps));
+  }
+
+  // Forward pass, keeping only the checkpoints.
+  provider(0, &step);
+  message.clear();
+  for (auto& candidate : step.candidates) {
+    auto search = step.emissionLogProbabilities.find(candidate);
+    if (search == step.emissionLogProbabilities.end()) {
+      printf("ERR: No initial probability for a candidate\n");
+      return result;
+    }
+    message.push_back(search->second);
+  }
+  is_broken = HMMBreak(message);
+  if (is_broken) {
+    printf("ERR: HMM Break\n");
+    return result;
+  }
+  prev_candidates = step.candidates;
+  checkpoint_messages.push_back(message);
+  checkpoint_candidates.push_back(prev_candidates);
+  checkpoint_observations.push_back(step.observation);
+  size_t numDecoded = 1;
+  for (size_t t = 1; t < numTimeSteps; ++t) {
+    provider(t, &step);
+    ForwardStep(nullptr, nullptr);
+    is_broken = HMMBreak(new_message);
+    if (is_broken) {
+      break;
+    }
+    message.swap(new_message);
+    prev_candidates = step.candidates;
+    numDecoded = t + 1;
+    if (t % interval == 0) {
+      checkpoint_messages.push_back(message);
+      checkpoint_candidates.push_back(prev_candidates);
+      checkpoint_observations.push_back(step.observation);
+    }
+  }
+
+  // Backtrace, one segment between checkpoints at a time in reverse order.
+  int index = MostLikelyStateIndex(prev_candidates);
+  size_t end = numDecoded - 1;
+  while (end > 0) {
+    const size_t checkpoint = (end - 1) / interval;
+    const size_t begin = checkpoint * interval;
+    message = checkpoint_messages[checkpoint];
+    prev_candidates = checkpoint_candidates[checkpoint];
+    const size_t numSegmentSteps = end - begin;
+    segment_back_pointers.resize(numSegmentSteps);
+    segment_candidates.resize(numSegmentSteps);
+    segment_observations.resize(numSegmentSteps);
+    segment_descriptors.resize(numSegmentSteps);
+    for (size_t i = 0; i < numSegmentSteps; ++i) {
+      provider(begin + 1 + i, &step);
+      ForwardStep(&segment_back_pointers[i], &segment_descriptors[i]);
+      message.swap(new_message);
+      prev_candidates = step.candidates;
+      segment_candidates[i] = step.candidates;
+      segment_observations[i] = step.observation;
+    }
+    for (size_t i = numSegmentSteps; i-- > 0;) {
+      result.push_back(SequenceState<S, O, D>(segment_candidates[i][index],
+                                              segment_observations[i],
+                                              segment_descriptors[i][index]));
+      index = segment_back_pointers[i][index];
+    }
+    end = begin;
+  }
+  result.push_back(SequenceState<S, O, D>(checkpoint_candidates[0][index],
+                                          checkpoint_observations[0], D()));
+
+  std::vector<SequenceState<S, O, D>> real_result;
+  for (auto i = result.rbegin(); i < result.rend(); ++i) {
+    real_result.push_back(*i);
+  }
+  return real_result;
+}
+template <typename S, typename O, typename D>
+bool CheckpointedViterbi<S, O, D>::IsBroken() {
+  return is_broken;
+}
+template <typename S, typename O, typename D>
+void CheckpointedViterbi<S, O, D>::ForwardStep(std::vector<int>* backPointers,
+                                               std::vector<D>* descriptors) {
+  const std::vector<S>& curCandidates = step.candidates;
+  new_message.resize(curCandidates.size());
+  if (backPointers != nullptr) {
+    backPointers->resize(curCandidates.size());
+    descriptors->resize(curCandidates.size());
+  }
+  for (size_t c = 0; c < curCandidates.size(); ++c) {
+    // Same loop as ViterbiAlgorithm::ForwardStep(), so that the first
+    // previous candidate with the strictly larger log probability wins.
+    double maxLogProbability = -std::numeric_limits<double>::infinity();
+    int maxPrevIndex = -1;
+    for (size_t p = 0; p < prev_candidates.size(); ++p) {
+      auto found = step.transitionLogProbabilities.find(
+          Transition<S>(prev_candidates[p], curCandidates[c]));
+      const double logProbability =
+          message[p] + (found == step.transitionLogProbabilities.end()
+                            ? -std::numeric_limits<double>::infinity()
+                            : found->second);
+      if (logProbability > maxLogProbability) {
+        maxLogProbability = logProbability;
+        maxPrevIndex = (int)p;
+      }
+    }
+    auto emission = step.emissionLogProbabilities.find(curCandidates[c]);
+    new_message[c] =
+        emission == step.emissionLogProbabilities.end()
+            ? maxLogProbability
+            : maxLogProbability + emission->second;
+    if (backPointers == nullptr) {
+      continue;
+    }
+    (*backPointers)[c] = maxPrevIndex;
+    (*descriptors)[c] = D();
+    if (maxPrevIndex >= 0) {
+      auto found = step.transitionDescriptors.find(
+          Transition<S>(prev_candidates[maxPrevIndex], curCandidates[c]));
+      if (found != step.transitionDescriptors.end()) {
+        (*descriptors)[c] = found->second;
+      }
+    }
+  }
+}
+template <typename S, typename O, typename D>
+bool CheckpointedViterbi<S, O, D>::HMMBreak(const std::vector<double>& message) {
+  for (auto logProbability : message) {
+    if (logProbability != -std::numeric_limits<double>::infinity()) {
+      return false;
+    }
+  }
+  return true;
+}
+template <typename S, typename O, typename D>
+int CheckpointedViterbi<S, O, D>::MostLikelyStateIndex(
+    const std::vector<S>& candidates) {
+  double maxLogProbability = -std::numeric_limits<double>::infinity();
+  int result = -1;
+  for (size_t i = 0; i < message.size(); ++i) {
+    // Ties are broken by state order like ViterbiAlgorithm::MostLikelyState().
+    if (message[i] > maxLogProbability ||
+        (result >= 0 && message[i] == maxLogProbability &&
+         candidates[i] < candidates[result])) {
+      result = static_cast<int>(i);
+      maxLogProbability = message[i];
+    }
+  }
+  return result;
+}
+
+}  // namespace hmm
+
+#endif /* checkpointed_viterbi_def_hpp */
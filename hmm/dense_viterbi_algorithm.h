@@ -0,0 +1,224 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef DENSE_VITERBI_ALGORITHM_H_
+#define DENSE_VITERBI_ALGORITHM_H_
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "max_plus.h"
+#include "sequence_state.h"
+#include "sparse_transitions.h"
+#include "thread_pool.h"
+
+/**
+ * Index based variant of ViterbiAlgorithm.
+ *
+ * <p>Instead of maps keyed by states and transitions, each time step is given
+ * as contiguous arrays indexed by candidate position:
+ * - emissionLogProbabilities[i] belongs to candidates[i],
+ * - transitionLogProbabilities is a row-major matrix with one row per previous
+ *   candidate, i.e. the transition from prevCandidates[p] to candidates[c] is
+ *   stored at transitionLogProbabilities[p * candidates.size() + c],
+ * - transitionDescriptors uses the same layout and may be empty.
+ *
+ * <p>Missing transitions must be passed as -infinity. Alternatively, transitions
+ * can be given as SparseTransitions, which makes a time step cost O(number of
+ * transitions) instead of O(n²). Candidates of one time step must be
+ * distinct.
+ *
+ * <p>The results of ComputeMostLikelySequence() are identical to
+ * ViterbiAlgorithm fed with the same probabilities, including the tie
+ * breaking: in the forward step the first previous candidate with the strictly
+ * larger log probability wins, and among final states with equal log
+ * probability the smallest state (w.r.t. operator<) wins.
+ *
+ * <p>The forward step runs on the SIMD max-plus kernel of max_plus.h.
+ *
+ * <p>Back pointers are kept as one int per candidate and time step in flat
+ * arrays, so memory grows with t*n but without per node heap allocations.
+ *
+ * <p>With SetThreadPool(), time steps with many candidates are split into
+ * ranges of current candidates that are processed in parallel. Each candidate
+ * still folds its previous candidates in the same order, so the results are
+ * bit-identical to the serial forward step.
+ *
+ * <p>P is the type of all probabilities, messages and kernels, double or
+ * float. float halves the memory of messages and transition matrices and
+ * doubles the SIMD width of the max-plus kernel, at the cost of precision
+ * that can change argmax decisions:
+ * - Inputs are rounded to 24 bits of mantissa, so transitions or emissions
+ *   whose log probabilities differ by less than about 1e-7 relative become
+ *   equal and the decision falls to the tie breaking rule.
+ * - Each addition rounds relative to the magnitude of the sum. Log
+ *   probabilities of a path grow linearly with the number of time steps; at
+ *   a magnitude of 1e4 paths closer than about 1e-3 are indistinguishable.
+ *   To keep the magnitude bounded, float messages are shifted by their
+ *   maximum after each time step, which does not change the ranking of
+ *   candidates. Precision is then limited by the differences within a single
+ *   time step.
+ * - Paths whose scores are nearly equal can therefore flip relative to
+ *   double. Results are identical to ViterbiAlgorithm only for double.
+ * Other types, e.g. fixed-point, would need their own kernels and a zero
+ * probability value and are not supported.
+ *
+ * @param <S> the state type
+ * @param <O> the observation type
+ * @param <D> the transition descriptor type
+ * @param <P> the probability type, double or float
+ */
+
+namespace hmm {
+
+template <typename S, typename O, typename D, typename P = double>
+class DenseViterbiAlgorithm {
+  static_assert(std::is_same<P, double>::value || std::is_same<P, float>::value,
+                "DenseViterbiAlgorithm supports double and float");
+
+ private:
+  // Candidates of all time steps, concatenated. The candidates of time step t
+  // are stored in [step_offsets[t], step_offsets[t + 1]).
+  std::vector<S> candidate_history;
+  // For each entry of candidate_history the index of the previous candidate in
+  // the most likely sequence, or -1 for the first time step and for candidates
+  // without any transition with non-zero probability.
+  std::vector<int> back_pointer_history;
+  // Transition descriptor of the back pointer, same layout as
+  // candidate_history.
+  std::vector<D> descriptor_history;
+  std::vector<size_t> step_offsets;
+  std::vector<O> observation_history;
+
+  // message[i] contains the log probability of the most likely sequence ending
+  // in the i-th candidate of the last time step. See ViterbiAlgorithm.
+  std::vector<P> message;
+  std::vector<P> new_message;
+  std::vector<int> back_pointers;
+  // Index of the transition of back_pointers[c] in the descriptor array.
+  std::vector<size_t> back_pointer_transitions;
+  bool is_broken = false;
+  ThreadPool *thread_pool = nullptr;
+  size_t min_parallel_candidates = 0;
+
+  /// Need to construct a new instance for each sequence of observations.
+ public:
+  DenseViterbiAlgorithm() {}
+  ~DenseViterbiAlgorithm() {}
+  bool processingStarted();
+  // Runs forward steps with at least minParallelCandidates current candidates
+  // on the given pool, which must outlive this instance. Smaller steps stay
+  // serial. nullptr turns parallel forward steps off. Must not be a pool that
+  // runs this instance itself, e.g. the pool of a BatchViterbi.
+  void SetThreadPool(ThreadPool *threadPool,
+                     size_t minParallelCandidates = 1024);
+  // Lets the HMM computation start with the given initial state probabilities.
+  void StartWithInitialStateProbabilities(
+      std::vector<S> &initialStates,
+      std::vector<P> &initialLogProbabilities);
+  // Lets the HMM computation start at the given first observation and uses the
+  // given emission probabilities as the initial state probability for each
+  // starting state s.
+  void StartWithInitialObservation(
+      O observation, std::vector<S> &candidates,
+      std::vector<P> &emissionLogProbabilities);
+  // Same as above with candidates.size() emission log probabilities read in
+  // place, e.g. from a MappedModel.
+  void StartWithInitialObservation(O observation, std::vector<S> &candidates,
+                                   const P *emissionLogProbabilities);
+  // Processes the next time step. Must not be called if the HMM is broken.
+  void NextStep(O observation, std::vector<S> &candidates,
+                std::vector<P> &emissionLogProbabilities,
+                std::vector<P> &transitionLogProbabilities,
+                std::vector<D> &transitionDescriptors);
+  // See NextStep(O, std::vector, std::vector, std::vector, std::vector)
+  void NextStep(O observation, std::vector<S> &candidates,
+                std::vector<P> &emissionLogProbabilities,
+                std::vector<P> &transitionLogProbabilities);
+  // Processes the next time step with sparse transitions. Only stored
+  // transitions are evaluated. Gives the same result as the dense NextStep
+  // with -infinity for all transitions not stored, regardless of the order of
+  // the predecessors within a column.
+  void NextStep(O observation, std::vector<S> &candidates,
+                std::vector<P> &emissionLogProbabilities,
+                SparseTransitions<D, P> &transitions);
+  // Same as the dense NextStep with all arrays read in place, e.g. from a
+  // MappedModel: candidates.size() emission log probabilities and a
+  // row-major matrix of (number of previous candidates) x candidates.size()
+  // transition log probabilities.
+  void NextStep(O observation, std::vector<S> &candidates,
+                const P *emissionLogProbabilities,
+                const P *transitionLogProbabilities);
+  // Same as the sparse NextStep with the columns of SparseTransitions read in
+  // place. Unlike SparseTransitions, the arrays are not checked, they must
+  // have candidates.size() + 1 offsets and previous indices in range.
+  void NextStep(O observation, std::vector<S> &candidates,
+                const P *emissionLogProbabilities, const int *offsets,
+                const int *prevIndices, const P *transitionLogProbabilities);
+  // Returns the most likely sequence of states for all time steps. See
+  // ViterbiAlgorithm::ComputeMostLikelySequence().
+  std::vector<SequenceState<S, O, D>> ComputeMostLikelySequence();
+  // Returns whether an HMM occurred in the last time step.
+  bool IsBroken();
+
+ private:
+  bool HMMBreak(const std::vector<P> &message);
+  // Reads candidates.size() initial log probabilities.
+  void InitializeStateProbabilities(O observation, std::vector<S> &candidates,
+                                    const P *initialLogProbabilities);
+  // Computes new_message, back_pointers and back_pointer_transitions from
+  // message. See max_plus.h.
+  void ForwardStep(size_t numPrevCandidates, size_t numCurCandidates,
+                   const P *emissionLogProbabilities,
+                   const P *transitionLogProbabilities);
+  // ForwardStep() for the current candidates [begin, end).
+  void ForwardColumns(size_t numPrevCandidates, size_t numCurCandidates,
+                      size_t begin, size_t end,
+                      const P *emissionLogProbabilities,
+                      const P *transitionLogProbabilities);
+  // Same as ForwardStep() for transitions in compressed sparse column form.
+  void SparseForwardStep(size_t numCurCandidates,
+                         const P *emissionLogProbabilities,
+                         const int *offsets, const int *prevIndices,
+                         const P *transitionLogProbabilities);
+  // SparseForwardStep() for the current candidates [begin, end).
+  void SparseForwardColumns(size_t begin, size_t end,
+                            const P *emissionLogProbabilities,
+                            const int *offsets, const int *prevIndices,
+                            const P *transitionLogProbabilities);
+  // Calls columns(begin, end) for ranges covering [0, numCurCandidates), in
+  // parallel if the step is large enough.
+  void ForEachColumnRange(size_t numCurCandidates,
+                          const std::function<void(size_t, size_t)> &columns);
+  // Checks for an HMM break and appends the result of the forward step to
+  // the history. transitionDescriptors may be nullptr.
+  void AppendStep(O observation, const std::vector<S> &candidates,
+                  const D *transitionDescriptors);
+  // Shifts message by its maximum if P is narrower than double.
+  void NormalizeMessage();
+  // Index of the last time step candidate with maximum probability.
+  int MostLikelyStateIndex();
+  std::vector<SequenceState<S, O, D>> RetrieveMostLikelySequence();
+};
+
+}  // namespace hmm
+
+#include "dense_viterbi_algorithm_def.h"
+#endif  // DENSE_VITERBI_ALGORITHM_H_
@@ -0,0 +1,381 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef dense_viterbi_algorithm_def_hpp
+#define dense_viterbi_algorithm_def_hpp
+
+#include "dense_viterbi_algorithm.h"
+
+namespace hmm {
+
+template <typename S, typename O, typename D, typename P>
+bool DenseViterbiAlgorithm<S, O, D, P>::processingStarted() {
+  return message.size() > 0;
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::SetThreadPool(
+    ThreadPool* threadPool, size_t minParallelCandidates) {
+  thread_pool = threadPool;
+  min_parallel_candidates = minParallelCandidates;
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::StartWithInitialStateProbabilities(
+    std::vector<S>& initialStates,
+    std::vector<P>& initialLogProbabilities) {
+  if (initialLogProbabilities.size() != initialStates.size()) {
+    printf("ERR: No initial probability for a candidate\n");
+    return;
+  }
+  InitializeStateProbabilities(O(), initialStates,
+                               initialLogProbabilities.data());
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::StartWithInitialObservation(
+    O observation, std::vector<S>& candidates,
+    std::vector<P>& emissionLogProbabilities) {
+  if (emissionLogProbabilities.size() != candidates.size()) {
+    printf("ERR: No initial probability for a candidate\n");
+    return;
+  }
+  InitializeStateProbabilities(observation, candidates,
+                               emissionLogProbabilities.data());
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::StartWithInitialObservation(
+    O observation, std::vector<S>& candidates,
+    const P* emissionLogProbabilities) {
+  InitializeStateProbabilities(observation, candidates,
+                               emissionLogProbabilities);
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::NextStep(
+    O observation, std::vector<S>& candidates,
+    std::vector<P>& emissionLogProbabilities,
+    std::vector<P>& transitionLogProbabilities,
+    std::vector<D>& transitionDescriptors) {
+  if (is_broken) {
+    return;
+  }
+  const size_t numPrevCandidates = message.size();
+  const size_t numCurCandidates = candidates.size();
+  if (emissionLogProbabilities.size() != numCurCandidates ||
+      transitionLogProbabilities.size() !=
+          numPrevCandidates * numCurCandidates ||
+      (!transitionDescriptors.empty() &&
+       transitionDescriptors.size() != transitionLogProbabilities.size())) {
+    printf("ERR: DenseViterbiAlgorithm NextStep input size mismatch\n");
+    return;
+  }
+  // Forward step
+  ForwardStep(numPrevCandidates, numCurCandidates,
+              emissionLogProbabilities.data(),
+              transitionLogProbabilities.data());
+  AppendStep(observation, candidates,
+             transitionDescriptors.empty() ? nullptr
+                                           : transitionDescriptors.data());
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::NextStep(
+    O observation, std::vector<S>& candidates,
+    std::vector<P>& emissionLogProbabilities,
+    std::vector<P>& transitionLogProbabilities) {
+  std::vector<D> tempVar;
+  NextStep(observation, candidates, emissionLogProbabilities,
+           transitionLogProbabilities, tempVar);
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::NextStep(
+    O observation, std::vector<S>& candidates,
+    std::vector<P>& emissionLogProbabilities,
+    SparseTransitions<D, P>& transitions) {
+  if (is_broken) {
+    return;
+  }
+  const size_t numCurCandidates = candidates.size();
+  bool valid = emissionLogProbabilities.size() == numCurCandidates &&
+               transitions.offsets.size() == numCurCandidates + 1 &&
+               transitions.offsets[0] == 0 &&
+               transitions.logProbabilities.size() ==
+                   transitions.prevIndices.size() &&
+               (transitions.descriptors.empty() ||
+                transitions.descriptors.size() ==
+                    transitions.prevIndices.size());
+  for (size_t c = 0; valid && c < numCurCandidates; ++c) {
+    valid = transitions.offsets[c] <= transitions.offsets[c + 1];
+  }
+  valid = valid && (size_t)transitions.offsets[numCurCandidates] ==
+                       transitions.prevIndices.size();
+  for (size_t k = 0; valid && k < transitions.prevIndices.size(); ++k) {
+    valid = transitions.prevIndices[k] >= 0 &&
+            (size_t)transitions.prevIndices[k] < message.size();
+  }
+  if (!valid) {
+    printf("ERR: DenseViterbiAlgorithm NextStep invalid sparse transitions\n");
+    return;
+  }
+  // Forward step
+  SparseForwardStep(numCurCandidates, emissionLogProbabilities.data(),
+                    transitions.offsets.data(), transitions.prevIndices.data(),
+                    transitions.logProbabilities.data());
+  AppendStep(observation, candidates,
+             transitions.descriptors.empty() ? nullptr
+                                             : transitions.descriptors.data());
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::NextStep(
+    O observation, std::vector<S>& candidates,
+    const P* emissionLogProbabilities, const P* transitionLogProbabilities) {
+  if (is_broken) {
+    return;
+  }
+  ForwardStep(message.size(), candidates.size(), emissionLogProbabilities,
+              transitionLogProbabilities);
+  AppendStep(observation, candidates, nullptr);
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::NextStep(
+    O observation, std::vector<S>& candidates,
+    const P* emissionLogProbabilities, const int* offsets,
+    const int* prevIndices, const P* transitionLogProbabilities) {
+  if (is_broken) {
+    return;
+  }
+  SparseForwardStep(candidates.size(), emissionLogProbabilities, offsets,
+                    prevIndices, transitionLogProbabilities);
+  AppendStep(observation, candidates, nullptr);
+}
+template <typename S, typename O, typename D, typename P>
+std::vector<SequenceState<S, O, D>>
+DenseViterbiAlgorithm<S, O, D, P>::ComputeMostLikelySequence() {
+  if (message.empty()) {
+    // Return empty most likely sequence if there are no time steps or if
+    // initial observations caused an HMM break.
+    return std::vector<SequenceState<S, O, D>>();
+  } else {
+    return RetrieveMostLikelySequence();
+  }
+}
+template <typename S, typename O, typename D, typename P>
+bool DenseViterbiAlgorithm<S, O, D, P>::IsBroken() {
+  return is_broken;
+}
+template <typename S, typename O, typename D, typename P>
+bool DenseViterbiAlgorithm<S, O, D, P>::HMMBreak(
+    const std::vector<P>& message) {
+  for (auto logProbability : message) {
+    if (logProbability != -std::numeric_limits<P>::infinity()) {
+      return false;
+    }
+  }
+  return true;
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::InitializeStateProbabilities(
+    O observation, std::vector<S>& candidates,
+    const P* initialLogProbabilities) {
+  if (!message.empty()) {
+    return;
+  }
+  new_message.assign(initialLogProbabilities,
+                     initialLogProbabilities + candidates.size());
+  is_broken = HMMBreak(new_message);
+  if (is_broken) {
+    printf("ERR: HMM Break\n");
+    return;
+  }
+  message.swap(new_message);
+  NormalizeMessage();
+  step_offsets.push_back(0);
+  for (auto candidate : candidates) {
+    candidate_history.push_back(candidate);
+    back_pointer_history.push_back(-1);
+    descriptor_history.push_back(D());
+  }
+  step_offsets.push_back(candidate_history.size());
+  observation_history.push_back(observation);
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::ForwardStep(
+    size_t numPrevCandidates, size_t numCurCandidates,
+    const P* emissionLogProbabilities,
+    const P* transitionLogProbabilities) {
+  new_message.assign(numCurCandidates,
+                     -std::numeric_limits<P>::infinity());
+  // back_pointers stays -1 if there is no transition with non-zero
+  // probability. Such a candidate cannot be part of the most likely sequence.
+  back_pointers.assign(numCurCandidates, -1);
+  back_pointer_transitions.resize(numCurCandidates);
+  ForEachColumnRange(numCurCandidates, [&](size_t begin, size_t end) {
+    ForwardColumns(numPrevCandidates, numCurCandidates, begin, end,
+                   emissionLogProbabilities, transitionLogProbabilities);
+  });
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::ForwardColumns(
+    size_t numPrevCandidates, size_t numCurCandidates, size_t begin,
+    size_t end, const P* emissionLogProbabilities,
+    const P* transitionLogProbabilities) {
+  // Rows are folded in ascending order so that the first previous candidate
+  // with the strictly larger log probability wins.
+  for (size_t p = 0; p < numPrevCandidates; ++p) {
+    if (message[p] == -std::numeric_limits<P>::infinity()) {
+      continue;
+    }
+    MaxPlusRowUpdate(message[p],
+                     transitionLogProbabilities + p * numCurCandidates + begin,
+                     end - begin, static_cast<int>(p),
+                     new_message.data() + begin, back_pointers.data() + begin);
+  }
+  for (size_t c = begin; c < end; ++c) {
+    new_message[c] += emissionLogProbabilities[c];
+    back_pointer_transitions[c] =
+        back_pointers[c] >= 0 ? back_pointers[c] * numCurCandidates + c : 0;
+  }
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::SparseForwardStep(
+    size_t numCurCandidates, const P* emissionLogProbabilities,
+    const int* offsets, const int* prevIndices,
+    const P* transitionLogProbabilities) {
+  new_message.resize(numCurCandidates);
+  back_pointers.resize(numCurCandidates);
+  back_pointer_transitions.resize(numCurCandidates);
+  ForEachColumnRange(numCurCandidates, [&](size_t begin, size_t end) {
+    SparseForwardColumns(begin, end, emissionLogProbabilities, offsets,
+                         prevIndices, transitionLogProbabilities);
+  });
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::SparseForwardColumns(
+    size_t begin, size_t end, const P* emissionLogProbabilities,
+    const int* offsets, const int* prevIndices,
+    const P* transitionLogProbabilities) {
+  for (size_t c = begin; c < end; ++c) {
+    P maxLogProbability = -std::numeric_limits<P>::infinity();
+    int maxPrevIndex = -1;
+    int maxTransition = -1;
+    for (int k = offsets[c]; k < offsets[c + 1]; ++k) {
+      const int p = prevIndices[k];
+      const P logProbability =
+          message[p] + transitionLogProbabilities[k];
+      // Predecessors may come in any order, so ties are resolved explicitly
+      // in favor of the smallest previous candidate index, as in ForwardStep.
+      if (logProbability > maxLogProbability ||
+          (logProbability == maxLogProbability && maxPrevIndex >= 0 &&
+           p < maxPrevIndex)) {
+        maxLogProbability = logProbability;
+        maxPrevIndex = p;
+        maxTransition = k;
+      }
+    }
+    new_message[c] = maxLogProbability + emissionLogProbabilities[c];
+    back_pointers[c] = maxPrevIndex;
+    back_pointer_transitions[c] = maxTransition;
+  }
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::ForEachColumnRange(
+    size_t numCurCandidates,
+    const std::function<void(size_t, size_t)>& columns) {
+  if (thread_pool == nullptr || numCurCandidates < min_parallel_candidates) {
+    columns(0, numCurCandidates);
+    return;
+  }
+  // Ranges of at least 64 candidates keep the max-plus kernel busy.
+  thread_pool->ParallelFor(numCurCandidates,
+                           thread_pool->GrainSize(numCurCandidates, 64),
+                           columns);
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::AppendStep(
+    O observation, const std::vector<S>& candidates,
+    const D* transitionDescriptors) {
+  is_broken = HMMBreak(new_message);
+  if (is_broken) {
+    return;
+  }
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    candidate_history.push_back(candidates[c]);
+    back_pointer_history.push_back(back_pointers[c]);
+    if (back_pointers[c] >= 0 && transitionDescriptors != nullptr) {
+      descriptor_history.push_back(
+          transitionDescriptors[back_pointer_transitions[c]]);
+    } else {
+      descriptor_history.push_back(D());
+    }
+  }
+  step_offsets.push_back(candidate_history.size());
+  observation_history.push_back(observation);
+  message.swap(new_message);
+  NormalizeMessage();
+}
+template <typename S, typename O, typename D, typename P>
+void DenseViterbiAlgorithm<S, O, D, P>::NormalizeMessage() {
+  if (std::numeric_limits<P>::digits >= std::numeric_limits<double>::digits) {
+    return;
+  }
+  const P maxLogProbability = *std::max_element(message.begin(), message.end());
+  for (auto& logProbability : message) {
+    logProbability -= maxLogProbability;
+  }
+}
+template <typename S, typename O, typename D, typename P>
+int DenseViterbiAlgorithm<S, O, D, P>::MostLikelyStateIndex() {
+  const size_t offset = step_offsets[step_offsets.size() - 2];
+  const P kErrorValue = -std::numeric_limits<P>::infinity();
+  P maxLogProbability = kErrorValue;
+  int result = -1;
+  for (size_t i = 0; i < message.size(); ++i) {
+    // Ties are broken by state order to match the std::map iteration order of
+    // ViterbiAlgorithm::MostLikelyState().
+    if (message[i] > maxLogProbability ||
+        (result >= 0 && message[i] == maxLogProbability &&
+         candidate_history[offset + i] < candidate_history[offset + result])) {
+      result = static_cast<int>(i);
+      maxLogProbability = message[i];
+    }
+  }
+  // Otherwise an HMM break would have occurred.
+  if (result < 0) {
+    printf("ERR: result is empty. MostLikelyStateIndex()\n");
+  }
+  return result;
+}
+template <typename S, typename O, typename D, typename P>
+std::vector<SequenceState<S, O, D>>
+DenseViterbiAlgorithm<S, O, D, P>::RetrieveMostLikelySequence() {
+  std::vector<SequenceState<S, O, D>> result;
+  int index = MostLikelyStateIndex();
+  if (index < 0) {
+    return result;
+  }
+  // Retrieve most likely state sequence in reverse order
+  for (size_t t = observation_history.size(); t-- > 0 && index >= 0;) {
+    const size_t i = step_offsets[t] + index;
+    result.push_back(SequenceState<S, O, D>(
+        candidate_history[i], observation_history[t], descriptor_history[i]));
+    index = back_pointer_history[i];
+  }
+  std::vector<SequenceState<S, O, D>> real_result;
+  for (auto i = result.rbegin(); i < result.rend(); ++i) {
+    real_result.push_back(*i);
+  }
+  return real_result;
+}
+
+}  // namespace hmm
+
+#endif /* dense_viterbi_algorithm_def_hpp */
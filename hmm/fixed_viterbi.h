@@ -0,0 +1,110 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Viterbi decoder for small models with a compile-time number of states.
+ *
+ * <p>States are the indices 0 ... N-1; mapping them to the caller's state
+ * objects is up to the caller. Emissions are given as a Vector with one log
+ * probability per state and transitions as a row-major Matrix,
+ * transitions[from][to], with -infinity for missing transitions. Messages and
+ * back pointers live in std::arrays inside the instance, so the decoder never
+ * allocates heap memory and can be placed on the stack or in large arrays of
+ * classifiers.
+ *
+ * <p>The forward step folds one row of the transition matrix at a time into
+ * the new message, as the kernel of max_plus.h does. All loop bounds are
+ * compile-time constants, so the compiler fully unrolls the loops for small
+ * N. For more than about 16 states, DenseViterbiAlgorithm with its SIMD
+ * kernel is the better choice. Tie breaking is that of ViterbiAlgorithm: in
+ * the forward step the first previous state with the strictly larger log
+ * probability wins, and among final states with equal log probability the
+ * smallest index wins.
+ *
+ * <p>Back pointers of up to kMaxSteps time steps are kept, as the smallest
+ * unsigned type that can hold a state index. Further time steps are rejected.
+ *
+ * @param <N> the number of states
+ * @param <kMaxSteps> the maximum number of time steps, including the initial
+ * one
+ * @param <P> the probability type
+ */
+
+#ifndef FIXED_VITERBI_H_
+#define FIXED_VITERBI_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <type_traits>
+
+namespace hmm {
+
+template <size_t N, size_t kMaxSteps, typename P = double>
+class FixedViterbi {
+  static_assert(N > 0, "FixedViterbi needs at least one state");
+  static_assert(kMaxSteps > 0, "FixedViterbi needs at least one time step");
+
+ public:
+  typedef std::array<P, N> Vector;
+  typedef std::array<Vector, N> Matrix;
+  typedef std::array<int, kMaxSteps> Sequence;
+
+ private:
+  typedef typename std::conditional<
+      (N <= 0x100), uint8_t,
+      typename std::conditional<(N <= 0x10000), uint16_t, uint32_t>::type>::type
+      BackPointer;
+
+  // message[s] contains the log probability of the most likely sequence
+  // ending in state s in the last time step. See ViterbiAlgorithm.
+  Vector message;
+  // back_pointers[t][s] is the previous state of state s in time step t > 0.
+  std::array<std::array<BackPointer, N>, kMaxSteps> back_pointers;
+  size_t num_time_steps = 0;
+  bool is_broken = false;
+
+ public:
+  FixedViterbi() {}
+  ~FixedViterbi() {}
+  // Discards all time steps.
+  void Reset();
+  // Lets the HMM computation start with the given initial log probabilities,
+  // e.g. the emission probabilities of the first observation.
+  void StartWithInitialObservation(const Vector &emissionLogProbabilities);
+  // Processes the next time step. Must not be called if the HMM is broken.
+  // Returns false if the time step was not processed.
+  bool NextStep(const Vector &emissionLogProbabilities,
+                const Matrix &transitionLogProbabilities);
+  // Writes the most likely state of each time step to sequence and returns
+  // the number of time steps. As in ViterbiAlgorithm, the sequence ends
+  // before the time step that caused an HMM break.
+  size_t ComputeMostLikelySequence(Sequence &sequence) const;
+  // Returns the most likely state of the last time step, -1 if none.
+  int MostLikelyState() const;
+  // Returns the log probability of MostLikelyState().
+  P MostLikelyLogProbability() const;
+  size_t NumTimeSteps() const { return num_time_steps; }
+  // Returns whether an HMM break occurred in the last time step.
+  bool IsBroken() const { return is_broken; }
+};
+
+}  // namespace hmm
+
+#include "fixed_viterbi_def.h"
+#endif  // FIXED_VITERBI_H_
@@ -0,0 +1,127 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef fixed_viterbi_def_hpp
+#define fixed_viterbi_def_hpp
+
+#include "fixed_viterbi.h"
+
+namespace hmm {
+
+template <size_t N, size_t kMaxSteps, typename P>
+void FixedViterbi<N, kMaxSteps, P>::Reset() {
+  num_time_steps = 0;
+  is_broken = false;
+}
+template <size_t N, size_t kMaxSteps, typename P>
+void FixedViterbi<N, kMaxSteps, P>::StartWithInitialObservation(
+    const Vector& emissionLogProbabilities) {
+  if (num_time_steps > 0) {
+    return;
+  }
+  is_broken = true;
+  for (size_t s = 0; s < N; ++s) {
+    if (emissionLogProbabilities[s] != -std::numeric_limits<P>::infinity()) {
+      is_broken = false;
+    }
+  }
+  if (is_broken) {
+    printf("ERR: HMM Break\n");
+    return;
+  }
+  message = emissionLogProbabilities;
+  num_time_steps = 1;
+}
+template <size_t N, size_t kMaxSteps, typename P>
+bool FixedViterbi<N, kMaxSteps, P>::NextStep(
+    const Vector& emissionLogProbabilities,
+    const Matrix& transitionLogProbabilities) {
+  // Not started, broken or full.
+  if (is_broken || num_time_steps == 0 || num_time_steps == kMaxSteps) {
+    return false;
+  }
+  Vector newMessage;
+  newMessage.fill(-std::numeric_limits<P>::infinity());
+  std::array<BackPointer, N>& backPointers = back_pointers[num_time_steps];
+  backPointers.fill(0);
+  // Rows are folded in ascending order so that the first previous state with
+  // the strictly larger log probability wins.
+  for (size_t p = 0; p < N; ++p) {
+    const Vector& row = transitionLogProbabilities[p];
+    for (size_t c = 0; c < N; ++c) {
+      const P logProbability = message[p] + row[c];
+      if (logProbability > newMessage[c]) {
+        newMessage[c] = logProbability;
+        backPointers[c] = static_cast<BackPointer>(p);
+      }
+    }
+  }
+  bool broken = true;
+  for (size_t c = 0; c < N; ++c) {
+    newMessage[c] += emissionLogProbabilities[c];
+    if (newMessage[c] != -std::numeric_limits<P>::infinity()) {
+      broken = false;
+    }
+  }
+  // The message of the last time step is kept, so the sequence up to it
+  // remains available.
+  if (broken) {
+    is_broken = true;
+    return false;
+  }
+  message = newMessage;
+  num_time_steps++;
+  return true;
+}
+template <size_t N, size_t kMaxSteps, typename P>
+size_t FixedViterbi<N, kMaxSteps, P>::ComputeMostLikelySequence(
+    Sequence& sequence) const {
+  int state = MostLikelyState();
+  if (state < 0) {
+    return 0;
+  }
+  for (size_t t = num_time_steps; t-- > 0;) {
+    sequence[t] = state;
+    if (t > 0) {
+      state = back_pointers[t][state];
+    }
+  }
+  return num_time_steps;
+}
+template <size_t N, size_t kMaxSteps, typename P>
+int FixedViterbi<N, kMaxSteps, P>::MostLikelyState() const {
+  if (num_time_steps == 0) {
+    return -1;
+  }
+  int result = -1;
+  P maxLogProbability = -std::numeric_limits<P>::infinity();
+  for (size_t s = 0; s < N; ++s) {
+    if (message[s] > maxLogProbability) {
+      result = static_cast<int>(s);
+      maxLogProbability = message[s];
+    }
+  }
+  return result;
+}
+template <size_t N, size_t kMaxSteps, typename P>
+P FixedViterbi<N, kMaxSteps, P>::MostLikelyLogProbability() const {
+  const int state = MostLikelyState();
+  return state < 0 ? -std::numeric_limits<P>::infinity() : message[state];
+}
+
+}  // namespace hmm
+
+#endif /* fixed_viterbi_def_hpp */
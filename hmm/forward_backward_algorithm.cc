@@ -0,0 +1,38 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "forward_backward_algorithm.h"
+
+namespace hmm {
+
+double LogSumExp(const double *values, size_t n) {
+  double max = -std::numeric_limits<double>::infinity();
+  for (size_t i = 0; i < n; ++i) {
+    max = values[i] > max ? values[i] : max;
+  }
+  if (max == -std::numeric_limits<double>::infinity()) {
+    return max;
+  }
+  // The largest term is exp(0) = 1, so the sum neither overflows nor
+  // underflows to zero.
+  double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += std::exp(values[i] - max);
+  }
+  return max + std::log(sum);
+}
+
+}  // namespace hmm
@@ -0,0 +1,109 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef FORWARD_BACKWARD_ALGORITHM_H_
+#define FORWARD_BACKWARD_ALGORITHM_H_
+
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+#include "transition.h"
+
+/**
+ * Computes the posterior probability of each state candidate given all
+ * observations, i.e. P(state at time step t | all observations).
+ *
+ * <p>Takes the same time step inputs as ViterbiAlgorithm: candidates, emission
+ * log probabilities (a missing emission counts as log probability 0) and
+ * transition log probabilities (missing transitions have zero probability).
+ * The forward and backward recursions run in log space on arrays indexed by
+ * candidate position; sums of probabilities are computed with LogSumExp(),
+ * which subtracts the maximum before exponentiating, so long sequences of
+ * small probabilities do not underflow.
+ *
+ * <p>The forward messages and the transitions of all time steps are kept until
+ * ComputePosteriorProbabilities() runs the backward pass, so memory grows with
+ * t*n² for n candidates per time step.
+ *
+ * @param <S> the state type
+ * @param <O> the observation type
+ */
+
+namespace hmm {
+
+// Returns log(sum_i exp(values[i])) for i in [0, n), -infinity if n == 0 or
+// all values are -infinity.
+double LogSumExp(const double *values, size_t n);
+
+template <typename S, typename O>
+class ForwardBackwardAlgorithm {
+ private:
+  // Candidates of each time step.
+  std::vector<std::vector<S>> candidate_history;
+  std::vector<O> observation_history;
+  // Log forward message of each time step: log P(observations up to t,
+  // state at t = candidate_history[t][i]).
+  std::vector<std::vector<double>> forward_history;
+  // Emission log probabilities of each time step, by candidate position.
+  std::vector<std::vector<double>> emission_history;
+  // Transition log probabilities into time step t as a row-major matrix with
+  // one row per candidate of time step t - 1. Empty for the first time step.
+  std::vector<std::vector<double>> transition_history;
+  bool is_broken = false;
+  // Scratch for one LogSumExp() argument.
+  std::vector<double> terms;
+
+ public:
+  ForwardBackwardAlgorithm() {}
+  ~ForwardBackwardAlgorithm() {}
+  bool processingStarted();
+  // Lets the computation start with the given initial state probabilities.
+  void StartWithInitialStateProbabilities(
+      std::vector<S> &initialStates,
+      std::map<S, double> &initialLogProbabilities);
+  // Lets the computation start at the given first observation and uses the
+  // given emission probabilities as the initial state probability for each
+  // starting state s.
+  void StartWithInitialObservation(
+      O observation, std::vector<S> &candidates,
+      std::map<S, double> &emissionLogProbabilities);
+  // Processes the next time step. Ignored once all candidates of a time step
+  // have zero probability, see IsBroken().
+  void NextStep(O observation, std::vector<S> &candidates,
+                std::map<S, double> &emissionLogProbabilities,
+                std::map<Transition<S>, double> &transitionLogProbabilities);
+  // Returns the posterior probability (not log probability) of each candidate
+  // for each time step before the HMM break, if any. The probabilities of
+  // each time step sum up to 1.
+  std::vector<std::map<S, double>> ComputePosteriorProbabilities();
+  // Log probability of all observations before the HMM break, if any.
+  double LogLikelihood();
+  // Returns whether an HMM break occurred.
+  bool IsBroken();
+
+ private:
+  void InitializeStateProbabilities(
+      O observation, std::vector<S> &candidates,
+      std::map<S, double> &initialLogProbabilities);
+};
+
+}  // namespace hmm
+
+#include "forward_backward_algorithm_def.h"
+#endif  // FORWARD_BACKWARD_ALGORITHM_H_
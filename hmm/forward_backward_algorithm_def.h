@@ -0,0 +1,184 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef forward_backward_algorithm_def_hpp
+#define forward_backward_algorithm_def_hpp
+
+#include "forward_backward_algorithm.h"
+
+namespace hmm {
+
+template <typename S, typename O>
+bool ForwardBackwardAlgorithm<S, O>::processingStarted() {
+  return !forward_history.empty();
+}
+template <typename S, typename O>
+void ForwardBackwardAlgorithm<S, O>::StartWithInitialStateProbabilities(
+    std::vector<S>& initialStates,
+    std::map<S, double>& initialLogProbabilities) {
+  InitializeStateProbabilities(O(), initialStates, initialLogProbabilities);
+}
+template <typename S, typename O>
+void ForwardBackwardAlgorithm<S, O>::StartWithInitialObservation(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& emissionLogProbabilities) {
+  InitializeStateProbabilities(observation, candidates,
+                               emissionLogProbabilities);
+}
+template <typename S, typename O>
+void ForwardBackwardAlgorithm<S, O>::NextStep(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& emissionLogProbabilities,
+    std::map<Transition<S>, double>& transitionLogProbabilities) {
+  if (is_broken) {
+    return;
+  }
+  if (!processingStarted()) {
+    printf("ERR: ForwardBackwardAlgorithm NextStep before initial step\n");
+    return;
+  }
+  const std::vector<S>& prevCandidates = candidate_history.back();
+  const std::vector<double>& prevForward = forward_history.back();
+  const size_t numPrev = prevCandidates.size();
+  const size_t numCur = candidates.size();
+
+  // A missing emission probability counts as log probability 0, as in
+  // ViterbiAlgorithm::NextStep().
+  std::vector<double> emissions(numCur, 0.0);
+  for (size_t c = 0; c < numCur; ++c) {
+    auto found = emissionLogProbabilities.find(candidates[c]);
+    if (found != emissionLogProbabilities.end()) {
+      emissions[c] = found->second;
+    }
+  }
+  std::vector<double> transitions(numPrev * numCur,
+                                  -std::numeric_limits<double>::infinity());
+  for (size_t p = 0; p < numPrev; ++p) {
+    for (size_t c = 0; c < numCur; ++c) {
+      auto found = transitionLogProbabilities.find(
+          Transition<S>(prevCandidates[p], candidates[c]));
+      if (found != transitionLogProbabilities.end()) {
+        transitions[p * numCur + c] = found->second;
+      }
+    }
+  }
+
+  // forward[c] = emission[c] + log(sum_p exp(prevForward[p] + transition[p][c]))
+  std::vector<double> forward(numCur);
+  bool broken = true;
+  terms.resize(numPrev);
+  for (size_t c = 0; c < numCur; ++c) {
+    for (size_t p = 0; p < numPrev; ++p) {
+      terms[p] = prevForward[p] + transitions[p * numCur + c];
+    }
+    forward[c] = emissions[c] + LogSumExp(terms.data(), numPrev);
+    broken = broken &&
+             forward[c] == -std::numeric_limits<double>::infinity();
+  }
+  is_broken = broken;
+  if (is_broken) {
+    return;
+  }
+  candidate_history.push_back(candidates);
+  observation_history.push_back(observation);
+  forward_history.push_back(forward);
+  emission_history.push_back(emissions);
+  transition_history.push_back(transitions);
+}
+template <typename S, typename O>
+std::vector<std::map<S, double>>
+ForwardBackwardAlgorithm<S, O>::ComputePosteriorProbabilities() {
+  std::vector<std::map<S, double>> result(forward_history.size());
+  if (!processingStarted()) {
+    return result;
+  }
+  const double logLikelihood = LogLikelihood();
+  // Backward messages: backward[i] = log P(observations after t | state at
+  // t = candidate_history[t][i]), starting with log(1) at the last time step.
+  std::vector<double> backward(candidate_history.back().size(), 0.0);
+  std::vector<double> prevBackward;
+  for (size_t t = forward_history.size(); t-- > 0;) {
+    const size_t numCur = candidate_history[t].size();
+    for (size_t c = 0; c < numCur; ++c) {
+      result[t][candidate_history[t][c]] =
+          std::exp(forward_history[t][c] + backward[c] - logLikelihood);
+    }
+    if (t == 0) {
+      break;
+    }
+    // prevBackward[p] = log(sum_c exp(transition[p][c] + emission[c] +
+    // backward[c])), with the transition row of p being contiguous.
+    const size_t numPrev = candidate_history[t - 1].size();
+    const std::vector<double>& transitions = transition_history[t];
+    const std::vector<double>& emissions = emission_history[t];
+    prevBackward.resize(numPrev);
+    terms.resize(numCur);
+    for (size_t p = 0; p < numPrev; ++p) {
+      for (size_t c = 0; c < numCur; ++c) {
+        terms[c] = transitions[p * numCur + c] + emissions[c] + backward[c];
+      }
+      prevBackward[p] = LogSumExp(terms.data(), numCur);
+    }
+    backward.swap(prevBackward);
+  }
+  return result;
+}
+template <typename S, typename O>
+double ForwardBackwardAlgorithm<S, O>::LogLikelihood() {
+  if (!processingStarted()) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  return LogSumExp(forward_history.back().data(),
+                   forward_history.back().size());
+}
+template <typename S, typename O>
+bool ForwardBackwardAlgorithm<S, O>::IsBroken() {
+  return is_broken;
+}
+template <typename S, typename O>
+void ForwardBackwardAlgorithm<S, O>::InitializeStateProbabilities(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& initialLogProbabilities) {
+  if (processingStarted()) {
+    return;
+  }
+  std::vector<double> forward;
+  bool broken = true;
+  for (auto& candidate : candidates) {
+    auto search = initialLogProbabilities.find(candidate);
+    if (search == initialLogProbabilities.end()) {
+      printf("ERR: No initial probability for a candidate\n");
+      return;
+    }
+    forward.push_back(search->second);
+    broken = broken &&
+             search->second == -std::numeric_limits<double>::infinity();
+  }
+  is_broken = broken;
+  if (is_broken) {
+    printf("ERR: HMM Break\n");
+    return;
+  }
+  candidate_history.push_back(candidates);
+  observation_history.push_back(observation);
+  forward_history.push_back(forward);
+  emission_history.push_back(forward);
+  transition_history.push_back(std::vector<double>());
+}
+
+}  // namespace hmm
+
+#endif /* forward_backward_algorithm_def_hpp */
@@ -0,0 +1,140 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef K_BEST_VITERBI_ALGORITHM_H_
+#define K_BEST_VITERBI_ALGORITHM_H_
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+#include "sequence_state.h"
+#include "transition.h"
+
+/**
+ * List Viterbi algorithm that computes the k most likely sequences in one
+ * pass.
+ *
+ * <p>Takes the same time step inputs as ViterbiAlgorithm. Instead of a single
+ * back pointer, the forward step keeps up to k (log probability, back pointer)
+ * entries per candidate: the k best among all entries of all previous
+ * candidates extended by the transition to the candidate. Every entry stands
+ * for a different sequence, so the k best entries of the last time step are
+ * the k most likely distinct sequences.
+ *
+ * <p>Entries with equal log probability are ordered by previous candidate
+ * order and then by rank, and the final entries by state order (w.r.t.
+ * operator<), so that the first sequence for k = 1 is the one
+ * ViterbiAlgorithm returns.
+ *
+ * <p>A time step costs O(n² k log k) for n candidates. Entries are kept in
+ * flat arrays, so memory grows with t*n*k.
+ *
+ * @param <S> the state type
+ * @param <O> the observation type
+ * @param <D> the transition descriptor type
+ */
+
+namespace hmm {
+
+template <typename S, typename O, typename D>
+class ScoredSequence {
+ public:
+  // Log probability of the sequence including all emissions.
+  double logProbability;
+  std::vector<SequenceState<S, O, D>> sequence;
+};
+
+template <typename S, typename O, typename D>
+class KBestViterbiAlgorithm {
+ private:
+  int k;
+  // Candidates of all time steps, concatenated. The candidates of time step t
+  // are stored in [step_offsets[t], step_offsets[t + 1]).
+  std::vector<S> candidate_history;
+  std::vector<size_t> step_offsets;
+  std::vector<O> observation_history;
+  // The entries of candidate_history[i] are stored in
+  // [entry_offsets[i], entry_offsets[i + 1]), best first. Each entry has the
+  // index of its previous entry (-1 for the first time step) and the
+  // transition descriptor to it.
+  std::vector<size_t> entry_offsets;
+  std::vector<int> entry_back_pointers;
+  std::vector<D> entry_descriptors;
+
+  // Log probabilities of the entries of the last time step, starting with the
+  // entry at entry_offsets[step_offsets[t]].
+  std::vector<double> message;
+  bool is_broken = false;
+
+  class Entry {
+   public:
+    double logProbability;
+    int prevIndex;
+    int backPointer;
+  };
+  // Entries considered for one candidate in the forward step.
+  std::vector<Entry> scratch;
+
+ public:
+  // Keeps the k most likely sequences, k >= 1.
+  explicit KBestViterbiAlgorithm(int k);
+  ~KBestViterbiAlgorithm() {}
+  bool processingStarted();
+  // Lets the HMM computation start with the given initial state probabilities.
+  void StartWithInitialStateProbabilities(
+      std::vector<S> &initialStates,
+      std::map<S, double> &initialLogProbabilities);
+  // Lets the HMM computation start at the given first observation and uses the
+  // given emission probabilities as the initial state probability for each
+  // starting state s.
+  void StartWithInitialObservation(
+      O observation, std::vector<S> &candidates,
+      std::map<S, double> &emissionLogProbabilities);
+  // Processes the next time step. See ViterbiAlgorithm::NextStep().
+  void NextStep(O observation, std::vector<S> &candidates,
+                std::map<S, double> &emissionLogProbabilities,
+                std::map<Transition<S>, double> &transitionLogProbabilities,
+                std::map<Transition<S>, D> &transitionDescriptors);
+  // See NextStep(O, std::vector, std::map, std::map, std::map)
+  void NextStep(O observation, std::vector<S> &candidates,
+                std::map<S, double> &emissionLogProbabilities,
+                std::map<Transition<S>, double> &transitionLogProbabilities);
+  // Returns up to k most likely sequences for all time steps, most likely
+  // first. Fewer are returned if there are fewer sequences with non-zero
+  // probability. Like ViterbiAlgorithm::ComputeMostLikelySequence(), the
+  // sequences end before the time step that caused an HMM break.
+  std::vector<ScoredSequence<S, O, D>> ComputeMostLikelySequences();
+  // Returns whether an HMM occurred in the last time step.
+  bool IsBroken();
+
+ private:
+  void InitializeStateProbabilities(
+      O observation, std::vector<S> &candidates,
+      std::map<S, double> &initialLogProbabilities);
+  void ForwardStep(O observation, std::vector<S> &candidates,
+                   std::map<S, double> &emissionLogProbabilities,
+                   std::map<Transition<S>, double> &transitionLogProbabilities,
+                   std::map<Transition<S>, D> *transitionDescriptors);
+  std::vector<SequenceState<S, O, D>> RetrieveSequence(int entry);
+};
+
+}  // namespace hmm
+
+#include "k_best_viterbi_algorithm_def.h"
+#endif  // K_BEST_VITERBI_ALGORITHM_H_
@@ -0,0 +1,261 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef k_best_viterbi_algorithm_def_hpp
+#define k_best_viterbi_algorithm_def_hpp
+
+#include "k_best_viterbi_algorithm.h"
+
+namespace hmm {
+
+template <typename S, typename O, typename D>
+KBestViterbiAlgorithm<S, O, D>::KBestViterbiAlgorithm(int k)
+    : k(k) {
+  if (this->k < 1) {
+    printf("ERR: KBestViterbiAlgorithm k must be at least 1\n");
+    this->k = 1;
+  }
+}
+template <typename S, typename O, typename D>
+bool KBestViterbiAlgorithm<S, O, D>::processingStarted() {
+  return !observation_history.empty();
+}
+template <typename S, typename O, typename D>
+void KBestViterbiAlgorithm<S, O, D>::StartWithInitialStateProbabilities(
+    std::vector<S>& initialStates,
+    std::map<S, double>& initialLogProbabilities) {
+  InitializeStateProbabilities(O(), initialStates, initialLogProbabilities);
+}
+template <typename S, typename O, typename D>
+void KBestViterbiAlgorithm<S, O, D>::StartWithInitialObservation(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& emissionLogProbabilities) {
+  InitializeStateProbabilities(observation, candidates,
+                               emissionLogProbabilities);
+}
+template <typename S, typename O, typename D>
+void KBestViterbiAlgorithm<S, O, D>::NextStep(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& emissionLogProbabilities,
+    std::map<Transition<S>, double>& transitionLogProbabilities,
+    std::map<Transition<S>, D>& transitionDescriptors) {
+  if (is_broken) {
+    return;
+  }
+  if (!processingStarted()) {
+    printf("ERR: KBestViterbiAlgorithm NextStep before initial step\n");
+    return;
+  }
+  ForwardStep(observation, candidates, emissionLogProbabilities,
+              transitionLogProbabilities, &transitionDescriptors);
+}
+template <typename S, typename O, typename D>
+void KBestViterbiAlgorithm<S, O, D>::NextStep(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& emissionLogProbabilities,
+    std::map<Transition<S>, double>& transitionLogProbabilities) {
+  if (is_broken) {
+    return;
+  }
+  if (!processingStarted()) {
+    printf("ERR: KBestViterbiAlgorithm NextStep before initial step\n");
+    return;
+  }
+  ForwardStep(observation, candidates, emissionLogProbabilities,
+              transitionLogProbabilities, nullptr);
+}
+template <typename S, typename O, typename D>
+std::vector<ScoredSequence<S, O, D>>
+KBestViterbiAlgorithm<S, O, D>::ComputeMostLikelySequences() {
+  std::vector<ScoredSequence<S, O, D>> result;
+  if (!processingStarted()) {
+    // Return no sequence if there are no time steps or if initial
+    // observations caused an HMM break.
+    return result;
+  }
+  // All entries of the last time step, best first, ties by state order.
+  const size_t candidateBegin = step_offsets[step_offsets.size() - 2];
+  const size_t candidateEnd = step_offsets.back();
+  const size_t entryBegin = entry_offsets[candidateBegin];
+  std::vector<std::pair<size_t, size_t>> entries;
+  for (size_t i = candidateBegin; i < candidateEnd; ++i) {
+    for (size_t e = entry_offsets[i]; e < entry_offsets[i + 1]; ++e) {
+      entries.push_back(std::make_pair(e, i));
+    }
+  }
+  std::stable_sort(entries.begin(), entries.end(),
+                   [&](const std::pair<size_t, size_t>& lhs,
+                       const std::pair<size_t, size_t>& rhs) {
+                     const double l = message[lhs.first - entryBegin];
+                     const double r = message[rhs.first - entryBegin];
+                     if (l != r) {
+                       return l > r;
+                     }
+                     return candidate_history[lhs.second] <
+                            candidate_history[rhs.second];
+                   });
+  for (size_t i = 0; i < entries.size() && i < (size_t)k; ++i) {
+    ScoredSequence<S, O, D> scored;
+    scored.logProbability = message[entries[i].first - entryBegin];
+    scored.sequence = RetrieveSequence((int)entries[i].first);
+    result.push_back(scored);
+  }
+  return result;
+}
+template <typename S, typename O, typename D>
+bool KBestViterbiAlgorithm<S, O, D>::IsBroken() {
+  return is_broken;
+}
+template <typename S, typename O, typename D>
+void KBestViterbiAlgorithm<S, O, D>::InitializeStateProbabilities(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& initialLogProbabilities) {
+  if (processingStarted()) {
+    return;
+  }
+  std::vector<double> initialMessage;
+  for (auto& candidate : candidates) {
+    auto search = initialLogProbabilities.find(candidate);
+    if (search == initialLogProbabilities.end()) {
+      printf("ERR: No initial probability for a candidate\n");
+      return;
+    }
+    initialMessage.push_back(search->second);
+  }
+  entry_offsets.assign(1, 0);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    // Candidates with zero probability get no entry.
+    if (initialMessage[i] != -std::numeric_limits<double>::infinity()) {
+      message.push_back(initialMessage[i]);
+      entry_back_pointers.push_back(-1);
+      entry_descriptors.push_back(D());
+    }
+    candidate_history.push_back(candidates[i]);
+    entry_offsets.push_back(entry_back_pointers.size());
+  }
+  is_broken = message.empty();
+  if (is_broken) {
+    printf("ERR: HMM Break\n");
+    candidate_history.clear();
+    entry_offsets.clear();
+    return;
+  }
+  step_offsets.push_back(0);
+  step_offsets.push_back(candidate_history.size());
+  observation_history.push_back(observation);
+}
+template <typename S, typename O, typename D>
+void KBestViterbiAlgorithm<S, O, D>::ForwardStep(
+    O observation, std::vector<S>& candidates,
+    std::map<S, double>& emissionLogProbabilities,
+    std::map<Transition<S>, double>& transitionLogProbabilities,
+    std::map<Transition<S>, D>* transitionDescriptors) {
+  const size_t prevBegin = step_offsets[step_offsets.size() - 2];
+  const size_t prevEnd = step_offsets.back();
+  const size_t prevEntryBegin = entry_offsets[prevBegin];
+  // Entries with equal log probability keep previous candidate order, then
+  // rank order.
+  auto better = [](const Entry& lhs, const Entry& rhs) {
+    if (lhs.logProbability != rhs.logProbability) {
+      return lhs.logProbability > rhs.logProbability;
+    }
+    return lhs.backPointer < rhs.backPointer;
+  };
+  std::vector<double> newMessage;
+  for (auto& curState : candidates) {
+    scratch.clear();
+    for (size_t p = prevBegin; p < prevEnd; ++p) {
+      auto transition = transitionLogProbabilities.find(
+          Transition<S>(candidate_history[p], curState));
+      if (transition == transitionLogProbabilities.end() ||
+          transition->second == -std::numeric_limits<double>::infinity()) {
+        continue;
+      }
+      for (size_t e = entry_offsets[p]; e < entry_offsets[p + 1]; ++e) {
+        Entry entry;
+        entry.logProbability =
+            message[e - prevEntryBegin] + transition->second;
+        entry.prevIndex = (int)p;
+        entry.backPointer = (int)e;
+        scratch.push_back(entry);
+      }
+    }
+    const size_t numEntries = std::min(scratch.size(), (size_t)k);
+    std::partial_sort(scratch.begin(), scratch.begin() + numEntries,
+                      scratch.end(), better);
+    auto emission = emissionLogProbabilities.find(curState);
+    const double emissionLogProbability =
+        emission == emissionLogProbabilities.end() ? 0.0 : emission->second;
+    for (size_t i = 0; i < numEntries; ++i) {
+      const double logProbability =
+          scratch[i].logProbability + emissionLogProbability;
+      if (logProbability == -std::numeric_limits<double>::infinity()) {
+        break;
+      }
+      newMessage.push_back(logProbability);
+      entry_back_pointers.push_back(scratch[i].backPointer);
+      D descriptor = D();
+      if (transitionDescriptors != nullptr) {
+        auto found = transitionDescriptors->find(Transition<S>(
+            candidate_history[scratch[i].prevIndex], curState));
+        if (found != transitionDescriptors->end()) {
+          descriptor = found->second;
+        }
+      }
+      entry_descriptors.push_back(descriptor);
+    }
+    candidate_history.push_back(curState);
+    entry_offsets.push_back(entry_back_pointers.size());
+  }
+  is_broken = newMessage.empty();
+  if (is_broken) {
+    // Keep the history up to the last time step.
+    candidate_history.resize(prevEnd);
+    entry_offsets.resize(prevEnd + 1);
+    entry_back_pointers.resize(entry_offsets.back());
+    entry_descriptors.resize(entry_offsets.back());
+    return;
+  }
+  step_offsets.push_back(candidate_history.size());
+  observation_history.push_back(observation);
+  message.swap(newMessage);
+}
+template <typename S, typename O, typename D>
+std::vector<SequenceState<S, O, D>>
+KBestViterbiAlgorithm<S, O, D>::RetrieveSequence(int entry) {
+  std::vector<SequenceState<S, O, D>> result;
+  // Retrieve the sequence in reverse order
+  for (size_t t = observation_history.size(); t-- > 0 && entry >= 0;) {
+    // Find the candidate owning the entry within time step t.
+    auto next = std::upper_bound(entry_offsets.begin() + step_offsets[t],
+                                 entry_offsets.begin() + step_offsets[t + 1],
+                                 (size_t)entry);
+    const size_t candidate = next - entry_offsets.begin() - 1;
+    result.push_back(SequenceState<S, O, D>(candidate_history[candidate],
+                                            observation_history[t],
+                                            entry_descriptors[entry]));
+    entry = entry_back_pointers[entry];
+  }
+  std::vector<SequenceState<S, O, D>> real_result;
+  for (auto i = result.rbegin(); i < result.rend(); ++i) {
+    real_result.push_back(*i);
+  }
+  return real_result;
+}
+
+}  // namespace hmm
+
+#endif /* k_best_viterbi_algorithm_def_hpp */
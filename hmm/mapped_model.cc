@@ -0,0 +1,59 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "mapped_model.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hmm {
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  void *mapping =
+      mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  data = static_cast<const char *>(mapping);
+  size = (size_t)status.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data != nullptr) {
+    munmap(const_cast<char *>(data), size);
+    data = nullptr;
+    size = 0;
+  }
+}
+
+}  // namespace hmm
@@ -0,0 +1,179 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Read-only binary model format for time-homogeneous HMMs that is used in
+ * place via mmap.
+ *
+ * <p>A model consists of numStates states with names, one emission table per
+ * observation symbol and one transition table, which is the same in every
+ * time step. Observations are symbol indices, states are state indices, so
+ * the model drives a DenseViterbiAlgorithm<int, int, D, P> with StateIndices()
+ * as candidates:
+ *
+ *   MappedModel<double> model;
+ *   if (!model.Open(path)) { ... }
+ *   std::vector<int> states = model.StateIndices();
+ *   viterbi.StartWithInitialObservation(o, states,
+ *                                       model.EmissionLogProbabilities(o));
+ *   viterbi.NextStep(o, states, model.EmissionLogProbabilities(o),
+ *                    model.TransitionLogProbabilities());  // dense
+ *   viterbi.NextStep(o, states, model.EmissionLogProbabilities(o),
+ *                    model.TransitionOffsets(), model.PrevIndices(),
+ *                    model.TransitionLogProbabilities());  // sparse
+ *
+ * <p>The file is mapped read-only and shared, so all processes that open the
+ * same model share its pages in the page cache. Open() only checks the
+ * header and the index arrays; tables are paged in on first use.
+ *
+ * <p>Layout, in native byte order: MappedModelHeader, followed by the
+ * sections it points to, each aligned to kMappedModelAlignment bytes:
+ * - stateNameOffsets: uint32[numStates + 1], the name of state i is the
+ *   null-terminated string at stateNames + stateNameOffsets[i],
+ * - stateNames: the names,
+ * - emissionLogProbabilities: P[numSymbols][numStates],
+ * - dense models: transitionLogProbabilities: P[numStates][numStates],
+ *   row-major as in DenseViterbiAlgorithm,
+ * - sparse models: transitionOffsets: int32[numStates + 1],
+ *   prevIndices: int32[numTransitions] and
+ *   transitionLogProbabilities: P[numTransitions], in the compressed sparse
+ *   column layout of SparseTransitions.
+ * Transition descriptors are not stored. Files are written by Write() and are
+ * meant for hosts with the same byte order and probability type P.
+ *
+ * @param <P> the probability type, double or float
+ */
+
+#ifndef MAPPED_MODEL_H_
+#define MAPPED_MODEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sparse_transitions.h"
+
+namespace hmm {
+
+const char kMappedModelMagic[4] = {'H', 'M', 'M', 'M'};
+const uint32_t kMappedModelVersion = 1;
+const uint64_t kMappedModelAlignment = 64;
+// MappedModelHeader::flags
+const uint32_t kMappedModelSparse = 1;
+
+// Section positions are byte offsets from the start of the file.
+struct MappedModelHeader {
+  char magic[4];
+  uint32_t version;
+  // sizeof(P)
+  uint32_t probabilitySize;
+  uint32_t flags;
+  uint32_t numStates;
+  uint32_t numSymbols;
+  uint64_t numTransitions;
+  uint64_t stateNameOffsets;
+  uint64_t stateNames;
+  uint64_t emissionLogProbabilities;
+  uint64_t transitionOffsets;
+  uint64_t prevIndices;
+  uint64_t transitionLogProbabilities;
+  uint64_t fileSize;
+};
+
+// Read-only shared memory mapping of a whole file.
+class MappedFile {
+ private:
+  const char *data = nullptr;
+  size_t size = 0;
+
+ public:
+  MappedFile() {}
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+  // Maps the file at path, replacing a previous mapping. Returns false if
+  // the file cannot be opened or is empty.
+  bool Open(const std::string &path);
+  void Close();
+  const char *Data() const { return data; }
+  size_t Size() const { return size; }
+};
+
+template <typename P>
+class MappedModel {
+ private:
+  MappedFile file;
+  const MappedModelHeader *header = nullptr;
+
+ public:
+  MappedModel() {}
+  // Maps the model at path. Returns false and leaves the model closed if the
+  // file cannot be mapped, has another format version or probability type,
+  // or is inconsistent.
+  bool Open(const std::string &path);
+  void Close();
+  bool IsOpen() const { return header != nullptr; }
+  int NumStates() const { return (int)header->numStates; }
+  int NumSymbols() const { return (int)header->numSymbols; }
+  bool IsSparse() const { return (header->flags & kMappedModelSparse) != 0; }
+  // numStates * numStates for dense models.
+  size_t NumTransitions() const { return (size_t)header->numTransitions; }
+  // 0, ..., NumStates() - 1, the candidates of every time step.
+  std::vector<int> StateIndices() const;
+  const char *StateName(int state) const;
+  // NumStates() values for observation symbol.
+  const P *EmissionLogProbabilities(int symbol) const;
+  // Dense matrix or values of the sparse columns.
+  const P *TransitionLogProbabilities() const;
+  // Sparse models only.
+  const int *TransitionOffsets() const;
+  const int *PrevIndices() const;
+
+  // Writes a dense model to path. transitionLogProbabilities is the row-major
+  // matrix of stateNames.size() x stateNames.size() entries, missing
+  // transitions are -infinity. Returns false on inconsistent sizes or I/O
+  // errors.
+  static bool Write(const std::string &path,
+                    const std::vector<std::string> &stateNames,
+                    const std::vector<std::vector<P>> &emissionLogProbabilities,
+                    const std::vector<P> &transitionLogProbabilities);
+  // Writes a sparse model to path. Descriptors of transitions are dropped.
+  template <typename D>
+  static bool Write(const std::string &path,
+                    const std::vector<std::string> &stateNames,
+                    const std::vector<std::vector<P>> &emissionLogProbabilities,
+                    const SparseTransitions<D, P> &transitions);
+
+ private:
+  // Checks header and index arrays of the mapped file.
+  bool Validate() const;
+  template <typename T>
+  const T *Section(uint64_t offset) const {
+    return reinterpret_cast<const T *>(file.Data() + offset);
+  }
+  // offsets, prevIndices are nullptr for dense models.
+  static bool WriteFile(const std::string &path,
+                        const std::vector<std::string> &stateNames,
+                        const std::vector<std::vector<P>> &emissionLogProbabilities,
+                        const int *offsets, const int *prevIndices,
+                        const P *transitionLogProbabilities,
+                        size_t numTransitions);
+};
+
+}  // namespace hmm
+
+#include "mapped_model_def.h"
+#endif  // MAPPED_MODEL_H_
@@ -0,0 +1,274 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef mapped_model_def_hpp
+#define mapped_model_def_hpp
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include "mapped_model.h"
+
+namespace hmm {
+
+template <typename P>
+bool MappedModel<P>::Open(const std::string& path) {
+  Close();
+  if (!file.Open(path)) {
+    return false;
+  }
+  if (!Validate()) {
+    file.Close();
+    return false;
+  }
+  header = Section<MappedModelHeader>(0);
+  return true;
+}
+template <typename P>
+void MappedModel<P>::Close() {
+  header = nullptr;
+  file.Close();
+}
+template <typename P>
+std::vector<int> MappedModel<P>::StateIndices() const {
+  std::vector<int> states(header->numStates);
+  for (size_t i = 0; i < states.size(); ++i) {
+    states[i] = (int)i;
+  }
+  return states;
+}
+template <typename P>
+const char* MappedModel<P>::StateName(int state) const {
+  return Section<char>(header->stateNames) +
+         Section<uint32_t>(header->stateNameOffsets)[state];
+}
+template <typename P>
+const P* MappedModel<P>::EmissionLogProbabilities(int symbol) const {
+  return Section<P>(header->emissionLogProbabilities) +
+         (size_t)symbol * header->numStates;
+}
+template <typename P>
+const P* MappedModel<P>::TransitionLogProbabilities() const {
+  return Section<P>(header->transitionLogProbabilities);
+}
+template <typename P>
+const int* MappedModel<P>::TransitionOffsets() const {
+  return Section<int>(header->transitionOffsets);
+}
+template <typename P>
+const int* MappedModel<P>::PrevIndices() const {
+  return Section<int>(header->prevIndices);
+}
+template <typename P>
+bool MappedModel<P>::Write(
+    const std::string& path, const std::vector<std::string>& stateNames,
+    const std::vector<std::vector<P>>& emissionLogProbabilities,
+    const std::vector<P>& transitionLogProbabilities) {
+  if (transitionLogProbabilities.size() !=
+      stateNames.size() * stateNames.size()) {
+    return false;
+  }
+  return WriteFile(path, stateNames, emissionLogProbabilities, nullptr,
+                   nullptr, transitionLogProbabilities.data(),
+                   transitionLogProbabilities.size());
+}
+template <typename P>
+template <typename D>
+bool MappedModel<P>::Write(
+    const std::string& path, const std::vector<std::string>& stateNames,
+    const std::vector<std::vector<P>>& emissionLogProbabilities,
+    const SparseTransitions<D, P>& transitions) {
+  if ((size_t)transitions.NumCandidates() != stateNames.size() ||
+      transitions.logProbabilities.size() != transitions.prevIndices.size()) {
+    return false;
+  }
+  return WriteFile(path, stateNames, emissionLogProbabilities,
+                   transitions.offsets.data(), transitions.prevIndices.data(),
+                   transitions.logProbabilities.data(),
+                   transitions.prevIndices.size());
+}
+template <typename P>
+bool MappedModel<P>::Validate() const {
+  const uint64_t size = file.Size();
+  if (size < sizeof(MappedModelHeader)) {
+    return false;
+  }
+  const MappedModelHeader& h = *Section<MappedModelHeader>(0);
+  if (memcmp(h.magic, kMappedModelMagic, 4) != 0 ||
+      h.version != kMappedModelVersion || h.probabilitySize != sizeof(P) ||
+      (h.flags & ~kMappedModelSparse) != 0 || h.fileSize != size ||
+      h.numStates == 0 || h.numStates > INT_MAX || h.numSymbols > INT_MAX) {
+    return false;
+  }
+  const bool sparse = (h.flags & kMappedModelSparse) != 0;
+  const uint64_t numStates = h.numStates;
+  // Element counts are bounded by the file size first, so that the byte
+  // sizes below cannot overflow.
+  auto inFile = [size](uint64_t offset, uint64_t count, uint64_t elementSize,
+                       uint64_t alignment) {
+    return offset % alignment == 0 && offset <= size &&
+           count <= (size - offset) / elementSize;
+  };
+  if (!inFile(h.stateNameOffsets, numStates + 1, sizeof(uint32_t),
+              kMappedModelAlignment) ||
+      !inFile(h.emissionLogProbabilities, (uint64_t)h.numSymbols * numStates,
+              sizeof(P), kMappedModelAlignment) ||
+      !inFile(h.transitionLogProbabilities, h.numTransitions, sizeof(P),
+              kMappedModelAlignment)) {
+    return false;
+  }
+  const uint32_t* nameOffsets = Section<uint32_t>(h.stateNameOffsets);
+  if (!inFile(h.stateNames, nameOffsets[numStates], 1, 1)) {
+    return false;
+  }
+  // Offsets are checked before any name is read through them.
+  if (nameOffsets[0] != 0) {
+    return false;
+  }
+  for (uint64_t i = 0; i < numStates; ++i) {
+    if (nameOffsets[i] >= nameOffsets[i + 1] ||
+        nameOffsets[i + 1] > nameOffsets[numStates]) {
+      return false;
+    }
+  }
+  const char* names = Section<char>(h.stateNames);
+  for (uint64_t i = 0; i < numStates; ++i) {
+    if (names[nameOffsets[i + 1] - 1] != '\0') {
+      return false;
+    }
+  }
+  if (!sparse) {
+    return h.numTransitions == numStates * numStates;
+  }
+  if (h.numTransitions > INT_MAX ||
+      !inFile(h.transitionOffsets, numStates + 1, sizeof(int),
+              kMappedModelAlignment) ||
+      !inFile(h.prevIndices, h.numTransitions, sizeof(int),
+              kMappedModelAlignment)) {
+    return false;
+  }
+  // DenseViterbiAlgorithm does not check the index arrays read in place.
+  const int* offsets = Section<int>(h.transitionOffsets);
+  const int* prevIndices = Section<int>(h.prevIndices);
+  if (offsets[0] != 0 || (uint64_t)offsets[numStates] != h.numTransitions) {
+    return false;
+  }
+  for (uint64_t c = 0; c < numStates; ++c) {
+    if (offsets[c] > offsets[c + 1]) {
+      return false;
+    }
+  }
+  for (uint64_t k = 0; k < h.numTransitions; ++k) {
+    if (prevIndices[k] < 0 || (uint64_t)prevIndices[k] >= numStates) {
+      return false;
+    }
+  }
+  return true;
+}
+template <typename P>
+bool MappedModel<P>::WriteFile(
+    const std::string& path, const std::vector<std::string>& stateNames,
+    const std::vector<std::vector<P>>& emissionLogProbabilities,
+    const int* offsets, const int* prevIndices,
+    const P* transitionLogProbabilities, size_t numTransitions) {
+  const size_t numStates = stateNames.size();
+  if (numStates == 0 || numStates > INT_MAX ||
+      emissionLogProbabilities.size() > INT_MAX ||
+      (offsets != nullptr && numTransitions > INT_MAX)) {
+    return false;
+  }
+  for (auto& symbolEmissions : emissionLogProbabilities) {
+    if (symbolEmissions.size() != numStates) {
+      return false;
+    }
+  }
+  std::vector<uint32_t> nameOffsets(1, 0);
+  for (auto& name : stateNames) {
+    const uint64_t end = (uint64_t)nameOffsets.back() + name.size() + 1;
+    if (end > UINT32_MAX || name.find('\0') != std::string::npos) {
+      return false;
+    }
+    nameOffsets.push_back((uint32_t)end);
+  }
+
+  MappedModelHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMappedModelMagic, 4);
+  header.version = kMappedModelVersion;
+  header.probabilitySize = sizeof(P);
+  header.flags = offsets != nullptr ? kMappedModelSparse : 0;
+  header.numStates = (uint32_t)numStates;
+  header.numSymbols = (uint32_t)emissionLogProbabilities.size();
+  header.numTransitions = numTransitions;
+  uint64_t position = sizeof(header);
+  auto place = [&position](uint64_t bytes) {
+    position = (position + kMappedModelAlignment - 1) /
+               kMappedModelAlignment * kMappedModelAlignment;
+    const uint64_t offset = position;
+    position += bytes;
+    return offset;
+  };
+  header.stateNameOffsets = place(nameOffsets.size() * sizeof(uint32_t));
+  header.stateNames = place(nameOffsets.back());
+  header.emissionLogProbabilities =
+      place(header.numSymbols * numStates * sizeof(P));
+  if (offsets != nullptr) {
+    header.transitionOffsets = place((numStates + 1) * sizeof(int));
+    header.prevIndices = place(numTransitions * sizeof(int));
+  }
+  header.transitionLogProbabilities = place(numTransitions * sizeof(P));
+  header.fileSize = position;
+
+  FILE* out = fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    return false;
+  }
+  uint64_t written = 0;
+  bool good = true;
+  // Pads with zeros up to offset and writes bytes from data.
+  auto writeAt = [&](uint64_t offset, const void* data, uint64_t bytes) {
+    static const char kZeros[kMappedModelAlignment] = {};
+    good = good && fwrite(kZeros, 1, offset - written, out) == offset - written &&
+           fwrite(data, 1, bytes, out) == bytes;
+    written = offset + bytes;
+  };
+  writeAt(0, &header, sizeof(header));
+  writeAt(header.stateNameOffsets, nameOffsets.data(),
+          nameOffsets.size() * sizeof(uint32_t));
+  for (size_t i = 0; i < numStates; ++i) {
+    writeAt(header.stateNames + nameOffsets[i], stateNames[i].c_str(),
+            stateNames[i].size() + 1);
+  }
+  for (size_t o = 0; o < emissionLogProbabilities.size(); ++o) {
+    writeAt(header.emissionLogProbabilities + o * numStates * sizeof(P),
+            emissionLogProbabilities[o].data(), numStates * sizeof(P));
+  }
+  if (offsets != nullptr) {
+    writeAt(header.transitionOffsets, offsets, (numStates + 1) * sizeof(int));
+    writeAt(header.prevIndices, prevIndices, numTransitions * sizeof(int));
+  }
+  writeAt(header.transitionLogProbabilities, transitionLogProbabilities,
+          numTransitions * sizeof(P));
+  good = fclose(out) == 0 && good;
+  if (!good) {
+    remove(path.c_str());
+  }
+  return good;
+}
+
+}  // namespace hmm
+
+#endif /* mapped_model_def_hpp */
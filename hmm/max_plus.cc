@@ -0,0 +1,267 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "max_plus.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HMM_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace hmm {
+
+namespace {
+
+typedef void (*MaxPlusRowUpdateFunction)(double, const double*, size_t, int,
+                                          double*, int*);
+typedef void (*FloatMaxPlusRowUpdateFunction)(float, const float*, size_t,
+                                               int, float*, int*);
+
+template <typename T>
+void MaxPlusRowUpdateScalar(T base, const T* row, size_t n, int index,
+                            T* best, int* argmax) {
+  for (size_t c = 0; c < n; ++c) {
+    const T logProbability = base + row[c];
+    if (logProbability > best[c]) {
+      best[c] = logProbability;
+      argmax[c] = index;
+    }
+  }
+}
+
+#ifdef HMM_X86_DISPATCH
+__attribute__((target("sse4.2"))) void MaxPlusRowUpdateSse42(
+    double base, const double* row, size_t n, int index, double* best,
+    int* argmax) {
+  const __m128d vbase = _mm_set1_pd(base);
+  size_t c = 0;
+  for (; c + 2 <= n; c += 2) {
+    const __m128d value = _mm_add_pd(vbase, _mm_loadu_pd(row + c));
+    const __m128d current = _mm_loadu_pd(best + c);
+    const __m128d greater = _mm_cmpgt_pd(value, current);
+    const int mask = _mm_movemask_pd(greater);
+    if (mask != 0) {
+      _mm_storeu_pd(best + c, _mm_blendv_pd(current, value, greater));
+      if (mask & 1) argmax[c] = index;
+      if (mask & 2) argmax[c + 1] = index;
+    }
+  }
+  MaxPlusRowUpdateScalar(base, row + c, n - c, index, best + c, argmax + c);
+}
+
+__attribute__((target("avx2"))) void MaxPlusRowUpdateAvx2(
+    double base, const double* row, size_t n, int index, double* best,
+    int* argmax) {
+  const __m256d vbase = _mm256_set1_pd(base);
+  const __m128i vindex = _mm_set1_epi32(index);
+  // Picks the low 32 bits of each 64 bit lane mask.
+  const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+  size_t c = 0;
+  for (; c + 4 <= n; c += 4) {
+    const __m256d value = _mm256_add_pd(vbase, _mm256_loadu_pd(row + c));
+    const __m256d current = _mm256_loadu_pd(best + c);
+    const __m256d greater = _mm256_cmp_pd(value, current, _CMP_GT_OQ);
+    if (!_mm256_testz_pd(greater, greater)) {
+      _mm256_storeu_pd(best + c, _mm256_blendv_pd(current, value, greater));
+      const __m128i mask = _mm256_castsi256_si128(
+          _mm256_permutevar8x32_epi32(_mm256_castpd_si256(greater), pack));
+      _mm_maskstore_epi32(argmax + c, mask, vindex);
+    }
+  }
+  MaxPlusRowUpdateScalar(base, row + c, n - c, index, best + c, argmax + c);
+}
+
+__attribute__((target("avx512f"))) void MaxPlusRowUpdateAvx512(
+    double base, const double* row, size_t n, int index, double* best,
+    int* argmax) {
+  const __m512d vbase = _mm512_set1_pd(base);
+  const __m512i vindex = _mm512_set1_epi32(index);
+  size_t c = 0;
+  for (; c + 8 <= n; c += 8) {
+    const __m512d value = _mm512_add_pd(vbase, _mm512_loadu_pd(row + c));
+    const __m512d current = _mm512_loadu_pd(best + c);
+    const __mmask8 greater = _mm512_cmp_pd_mask(value, current, _CMP_GT_OQ);
+    if (greater != 0) {
+      _mm512_mask_storeu_pd(best + c, greater, value);
+      _mm512_mask_storeu_epi32(argmax + c, greater, vindex);
+    }
+  }
+  MaxPlusRowUpdateScalar(base, row + c, n - c, index, best + c, argmax + c);
+}
+
+__attribute__((target("sse4.2"))) void FloatMaxPlusRowUpdateSse42(
+    float base, const float* row, size_t n, int index, float* best,
+    int* argmax) {
+  const __m128 vbase = _mm_set1_ps(base);
+  const __m128i vindex = _mm_set1_epi32(index);
+  size_t c = 0;
+  for (; c + 4 <= n; c += 4) {
+    const __m128 value = _mm_add_ps(vbase, _mm_loadu_ps(row + c));
+    const __m128 current = _mm_loadu_ps(best + c);
+    const __m128 greater = _mm_cmpgt_ps(value, current);
+    if (_mm_movemask_ps(greater) != 0) {
+      _mm_storeu_ps(best + c, _mm_blendv_ps(current, value, greater));
+      const __m128i previous =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(argmax + c));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(argmax + c),
+                       _mm_blendv_epi8(previous, vindex,
+                                       _mm_castps_si128(greater)));
+    }
+  }
+  MaxPlusRowUpdateScalar(base, row + c, n - c, index, best + c, argmax + c);
+}
+
+__attribute__((target("avx2"))) void FloatMaxPlusRowUpdateAvx2(
+    float base, const float* row, size_t n, int index, float* best,
+    int* argmax) {
+  const __m256 vbase = _mm256_set1_ps(base);
+  const __m256i vindex = _mm256_set1_epi32(index);
+  size_t c = 0;
+  for (; c + 8 <= n; c += 8) {
+    const __m256 value = _mm256_add_ps(vbase, _mm256_loadu_ps(row + c));
+    const __m256 current = _mm256_loadu_ps(best + c);
+    const __m256 greater = _mm256_cmp_ps(value, current, _CMP_GT_OQ);
+    if (!_mm256_testz_ps(greater, greater)) {
+      _mm256_storeu_ps(best + c, _mm256_blendv_ps(current, value, greater));
+      // Lanes of float and int have the same width, so the comparison result
+      // is the store mask.
+      _mm256_maskstore_epi32(argmax + c, _mm256_castps_si256(greater), vindex);
+    }
+  }
+  MaxPlusRowUpdateScalar(base, row + c, n - c, index, best + c, argmax + c);
+}
+
+__attribute__((target("avx512f"))) void FloatMaxPlusRowUpdateAvx512(
+    float base, const float* row, size_t n, int index, float* best,
+    int* argmax) {
+  const __m512 vbase = _mm512_set1_ps(base);
+  const __m512i vindex = _mm512_set1_epi32(index);
+  size_t c = 0;
+  for (; c + 16 <= n; c += 16) {
+    const __m512 value = _mm512_add_ps(vbase, _mm512_loadu_ps(row + c));
+    const __m512 current = _mm512_loadu_ps(best + c);
+    const __mmask16 greater = _mm512_cmp_ps_mask(value, current, _CMP_GT_OQ);
+    if (greater != 0) {
+      _mm512_mask_storeu_ps(best + c, greater, value);
+      _mm512_mask_storeu_epi32(argmax + c, greater, vindex);
+    }
+  }
+  MaxPlusRowUpdateScalar(base, row + c, n - c, index, best + c, argmax + c);
+}
+#endif  // HMM_X86_DISPATCH
+
+MaxPlusRowUpdateFunction FunctionFor(SimdLevel level) {
+#ifdef HMM_X86_DISPATCH
+  switch (level) {
+    case SimdLevel::kAvx512:
+      return MaxPlusRowUpdateAvx512;
+    case SimdLevel::kAvx2:
+      return MaxPlusRowUpdateAvx2;
+    case SimdLevel::kSse42:
+      return MaxPlusRowUpdateSse42;
+    default:
+      break;
+  }
+#endif
+  return MaxPlusRowUpdateScalar<double>;
+}
+
+FloatMaxPlusRowUpdateFunction FloatFunctionFor(SimdLevel level) {
+#ifdef HMM_X86_DISPATCH
+  switch (level) {
+    case SimdLevel::kAvx512:
+      return FloatMaxPlusRowUpdateAvx512;
+    case SimdLevel::kAvx2:
+      return FloatMaxPlusRowUpdateAvx2;
+    case SimdLevel::kSse42:
+      return FloatMaxPlusRowUpdateSse42;
+    default:
+      break;
+  }
+#endif
+  return MaxPlusRowUpdateScalar<float>;
+}
+
+struct Dispatch {
+  SimdLevel level;
+  MaxPlusRowUpdateFunction function;
+  FloatMaxPlusRowUpdateFunction float_function;
+  Dispatch()
+      : level(DetectSimdLevel()),
+        function(FunctionFor(level)),
+        float_function(FloatFunctionFor(level)) {}
+};
+
+Dispatch& ActiveDispatch() {
+  static Dispatch dispatch;
+  return dispatch;
+}
+
+}  // namespace
+
+SimdLevel DetectSimdLevel() {
+#ifdef HMM_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SimdLevel::kAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::kAvx2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return SimdLevel::kSse42;
+  }
+#endif
+  return SimdLevel::kScalar;
+}
+
+SimdLevel ActiveSimdLevel() { return ActiveDispatch().level; }
+
+bool SetSimdLevel(SimdLevel level) {
+  if (static_cast<int>(level) > static_cast<int>(DetectSimdLevel())) {
+    return false;
+  }
+  Dispatch& dispatch = ActiveDispatch();
+  dispatch.level = level;
+  dispatch.function = FunctionFor(level);
+  dispatch.float_function = FloatFunctionFor(level);
+  return true;
+}
+
+const char* SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kAvx512:
+      return "AVX-512";
+    case SimdLevel::kAvx2:
+      return "AVX2";
+    case SimdLevel::kSse42:
+      return "SSE4.2";
+    default:
+      return "scalar";
+  }
+}
+
+void MaxPlusRowUpdate(double base, const double* row, size_t n, int index,
+                      double* best, int* argmax) {
+  ActiveDispatch().function(base, row, n, index, best, argmax);
+}
+
+void MaxPlusRowUpdate(float base, const float* row, size_t n, int index,
+                      float* best, int* argmax) {
+  ActiveDispatch().float_function(base, row, n, index, best, argmax);
+}
+
+}  // namespace hmm
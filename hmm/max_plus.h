@@ -0,0 +1,66 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Max-plus kernel of the forward step.
+ *
+ * <p>The Viterbi forward step is a max-plus matrix-vector product:
+ * new_message[c] = max_p(message[p] + transition[p][c]) together with the
+ * argmax p. With a row-major transition matrix (one row per previous
+ * candidate) the contiguous direction is c, so the kernel folds one row at a
+ * time into running maxima of all current candidates:
+ *
+ *   for each c: if (base + row[c] > best[c]) { best[c] = ...; argmax[c] = p; }
+ *
+ * <p>Calling it for p = 0, 1, ... in ascending order gives exactly the tie
+ * breaking of the scalar loop: the first previous candidate with the strictly
+ * larger log probability wins. Comparisons are ordered, so NaN never wins.
+ *
+ * <p>The implementation is selected once at runtime via cpuid (AVX-512, AVX2,
+ * SSE4.2 or plain scalar code). The single precision kernel processes twice
+ * as many candidates per instruction as the double precision one.
+ */
+
+#ifndef MAX_PLUS_H_
+#define MAX_PLUS_H_
+
+#include <cstddef>
+
+namespace hmm {
+
+enum class SimdLevel { kScalar = 0, kSse42 = 1, kAvx2 = 2, kAvx512 = 3 };
+
+// Highest instruction set supported by this CPU and compiler.
+SimdLevel DetectSimdLevel();
+// Instruction set currently used by MaxPlusRowUpdate().
+SimdLevel ActiveSimdLevel();
+// Forces a lower instruction set, e.g. for testing or benchmarking. Returns
+// false and keeps the current implementation if the level is not supported.
+// Not thread-safe with respect to concurrent MaxPlusRowUpdate() calls.
+bool SetSimdLevel(SimdLevel level);
+const char* SimdLevelName(SimdLevel level);
+
+// For c in [0, n): if base + row[c] > best[c], sets best[c] = base + row[c]
+// and argmax[c] = index.
+void MaxPlusRowUpdate(double base, const double* row, size_t n, int index,
+                      double* best, int* argmax);
+// Same as above in single precision.
+void MaxPlusRowUpdate(float base, const float* row, size_t n, int index,
+                      float* best, int* argmax);
+
+}  // namespace hmm
+
+#endif  // MAX_PLUS_H_
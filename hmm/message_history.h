@@ -0,0 +1,181 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Forward messages of all time steps in columnar form.
+ *
+ * <p>All log probabilities are stored in one contiguous buffer. The message of
+ * time step t occupies [offsets[t], offsets[t + 1]) and is ordered by state
+ * (w.r.t. operator<). Instead of a copy
+ * of the state, each value stores the handle of its state in a
+ * StateInterner holding every distinct state once.
+ *
+ * <p>MessageHistoryView and MessageView give read access without copying.
+ * Views refer to the history they were taken from and see later time steps;
+ * values returned by them are invalidated by Clear().
+ *
+ * @param <S> the state type
+ */
+
+#ifndef MESSAGE_HISTORY_H_
+#define MESSAGE_HISTORY_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "state_interner.h"
+
+namespace hmm {
+
+template <typename S>
+class ColumnarMessageHistory;
+
+// Forward message of one time step.
+template <typename S>
+class MessageView {
+ public:
+  MessageView(const ColumnarMessageHistory<S> *history, size_t timeStep)
+      : history(history), time_step(timeStep) {}
+  // Number of states in the message.
+  size_t size() const;
+  // i-th state, in ascending state order.
+  const S &State(size_t i) const;
+  // Log probability of the i-th state.
+  double LogProbability(size_t i) const;
+  // Log probability of the given state, -infinity if the state is not part of
+  // the message. O(log n).
+  double LogProbability(const S &state) const;
+
+ private:
+  const ColumnarMessageHistory<S> *history;
+  size_t time_step;
+};
+
+// Forward messages of all recorded time steps.
+template <typename S>
+class MessageHistoryView {
+ public:
+  explicit MessageHistoryView(const ColumnarMessageHistory<S> *history)
+      : history(history) {}
+  // Number of time steps.
+  size_t size() const;
+  bool empty() const;
+  MessageView<S> operator[](size_t timeStep) const;
+
+ private:
+  const ColumnarMessageHistory<S> *history;
+};
+
+template <typename S>
+class ColumnarMessageHistory {
+ public:
+  ColumnarMessageHistory() : offsets(1, 0) {}
+  // Appends the message of the next time step: logProbabilities[i] belongs to
+  // states[i]. States must be distinct.
+  void Append(const std::vector<S> &states,
+              const std::vector<double> &logProbabilities);
+  // Drops all time steps but keeps the allocated memory.
+  void Clear();
+  MessageHistoryView<S> View() const;
+
+ private:
+  friend class MessageView<S>;
+  friend class MessageHistoryView<S>;
+
+  std::vector<double> values;
+  // Handle in candidates of each value.
+  std::vector<StateHandle> states;
+  std::vector<size_t> offsets;
+  StateInterner<S> candidates;
+  // Scratch for sorting one message by state.
+  std::vector<size_t> order;
+};
+
+template <typename S>
+size_t MessageView<S>::size() const {
+  return history->offsets[time_step + 1] - history->offsets[time_step];
+}
+template <typename S>
+const S &MessageView<S>::State(size_t i) const {
+  return history->candidates.State(
+      history->states[history->offsets[time_step] + i]);
+}
+template <typename S>
+double MessageView<S>::LogProbability(size_t i) const {
+  return history->values[history->offsets[time_step] + i];
+}
+template <typename S>
+double MessageView<S>::LogProbability(const S &state) const {
+  // States of one time step are sorted, see ColumnarMessageHistory::Append().
+  size_t begin = 0;
+  size_t end = size();
+  while (begin < end) {
+    const size_t middle = begin + (end - begin) / 2;
+    if (State(middle) < state) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  if (begin < size() && !(state < State(begin))) {
+    return LogProbability(begin);
+  }
+  return -std::numeric_limits<double>::infinity();
+}
+template <typename S>
+size_t MessageHistoryView<S>::size() const {
+  return history->offsets.size() - 1;
+}
+template <typename S>
+bool MessageHistoryView<S>::empty() const {
+  return size() == 0;
+}
+template <typename S>
+MessageView<S> MessageHistoryView<S>::operator[](size_t timeStep) const {
+  return MessageView<S>(history, timeStep);
+}
+template <typename S>
+void ColumnarMessageHistory<S>::Append(
+    const std::vector<S> &states, const std::vector<double> &logProbabilities) {
+  order.resize(states.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&states](size_t lhs, size_t rhs) {
+    return states[lhs] < states[rhs];
+  });
+  for (auto i : order) {
+    this->states.push_back(candidates.Intern(states[i]));
+    values.push_back(logProbabilities[i]);
+  }
+  offsets.push_back(values.size());
+}
+template <typename S>
+void ColumnarMessageHistory<S>::Clear() {
+  values.clear();
+  states.clear();
+  offsets.assign(1, 0);
+  candidates.Clear();
+}
+template <typename S>
+MessageHistoryView<S> ColumnarMessageHistory<S>::View() const {
+  return MessageHistoryView<S>(this);
+}
+
+}  // namespace hmm
+
+#endif  // MESSAGE_HISTORY_H_
@@ -0,0 +1,153 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Slab allocator for objects of a single type.
+ *
+ * <p>Objects are constructed in place in fixed-size slabs, so allocation is a
+ * pointer bump or a free list pop and never touches the heap once enough
+ * slabs exist. Single objects can be given back with Release(); their slots
+ * are reused by later allocations. All remaining objects are destroyed in
+ * bulk by Clear() or when the pool is destroyed; the slabs themselves are
+ * kept by Clear() for reuse.
+ *
+ * @param <T> the object type
+ */
+
+#ifndef OBJECT_POOL_H_
+#define OBJECT_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace hmm {
+
+template <typename T>
+class ObjectPool {
+ private:
+  struct Slot {
+    union {
+      alignas(T) unsigned char storage[sizeof(T)];
+      // Next free slot while the slot is on the free list.
+      Slot *next;
+    };
+    bool live;
+  };
+
+  size_t slab_size;
+  std::vector<std::unique_ptr<Slot[]>> slabs;
+  // Slab and slot of the next allocation.
+  size_t current_slab = 0;
+  size_t current_slot = 0;
+  Slot *free_list = nullptr;
+  size_t size = 0;
+
+ public:
+  explicit ObjectPool(size_t slabSize = 256)
+      : slab_size(slabSize > 0 ? slabSize : 1) {}
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+  ObjectPool(ObjectPool &&other) { *this = std::move(other); }
+  ObjectPool &operator=(ObjectPool &&other) {
+    if (this != &other) {
+      Clear();
+      slab_size = other.slab_size;
+      slabs = std::move(other.slabs);
+      current_slab = other.current_slab;
+      current_slot = other.current_slot;
+      free_list = other.free_list;
+      size = other.size;
+      other.slabs.clear();
+      other.current_slab = 0;
+      other.current_slot = 0;
+      other.free_list = nullptr;
+      other.size = 0;
+    }
+    return *this;
+  }
+  ~ObjectPool() { Clear(); }
+
+  // Constructs a new object in the pool.
+  template <typename... Args>
+  T *Allocate(Args &&... args) {
+    Slot *slot;
+    if (free_list != nullptr) {
+      slot = free_list;
+      free_list = slot->next;
+    } else {
+      if (current_slot == slab_size) {
+        current_slab++;
+        current_slot = 0;
+      }
+      if (current_slab == slabs.size()) {
+        slabs.push_back(std::unique_ptr<Slot[]>(new Slot[slab_size]));
+      }
+      slot = &slabs[current_slab][current_slot];
+      current_slot++;
+    }
+    T *object = new (slot->storage) T(std::forward<Args>(args)...);
+    slot->live = true;
+    size++;
+    return object;
+  }
+  // Destroys an object allocated by this pool and makes its slot reusable.
+  void Release(T *object) {
+    object->~T();
+    Slot *slot = reinterpret_cast<Slot *>(object);
+    slot->live = false;
+    slot->next = free_list;
+    free_list = slot;
+    size--;
+  }
+  // Destroys all objects. Slabs are kept for subsequent allocations.
+  void Clear() {
+    for (size_t s = 0; s < slabs.size() && s <= current_slab; ++s) {
+      const size_t used = s < current_slab ? slab_size : current_slot;
+      for (size_t i = 0; i < used; ++i) {
+        if (slabs[s][i].live) {
+          reinterpret_cast<T *>(slabs[s][i].storage)->~T();
+        }
+      }
+    }
+    current_slab = 0;
+    current_slot = 0;
+    free_list = nullptr;
+    size = 0;
+  }
+  // Calls f(T *) for each object currently alive, in slot order.
+  template <typename F>
+  void ForEach(F f) {
+    for (size_t s = 0; s < slabs.size() && s <= current_slab; ++s) {
+      const size_t used = s < current_slab ? slab_size : current_slot;
+      for (size_t i = 0; i < used; ++i) {
+        if (slabs[s][i].live) {
+          f(reinterpret_cast<T *>(slabs[s][i].storage));
+        }
+      }
+    }
+  }
+  // Number of objects currently alive.
+  size_t Size() const { return size; }
+  // Bytes of slab memory held by the pool.
+  size_t CapacityBytes() const { return slabs.size() * slab_size * sizeof(Slot); }
+};
+
+}  // namespace hmm
+
+#endif  // OBJECT_POOL_H_
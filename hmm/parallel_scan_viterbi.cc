@@ -0,0 +1,207 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "parallel_scan_viterbi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include "max_plus.h"
+
+namespace hmm {
+
+ParallelScanViterbi::ParallelScanViterbi(int numThreads)
+    : own_pool(new ThreadPool(numThreads)), pool(own_pool.get()) {}
+
+ParallelScanViterbi::ParallelScanViterbi(ThreadPool *threadPool)
+    : pool(threadPool) {}
+
+void ParallelScanViterbi::SetMinChunkLength(size_t minChunkLength) {
+  min_chunk_length = std::max<size_t>(minChunkLength, 1);
+}
+
+std::vector<int> ParallelScanViterbi::Decode(
+    size_t numStates,
+    const std::vector<const double *> &emissionLogProbabilities,
+    const double *transitionLogProbabilities) {
+  homogeneous_transitions.assign(
+      emissionLogProbabilities.empty() ? 0
+                                       : emissionLogProbabilities.size() - 1,
+      transitionLogProbabilities);
+  return Decode(numStates, emissionLogProbabilities, homogeneous_transitions);
+}
+
+std::vector<int> ParallelScanViterbi::Decode(
+    size_t numStates,
+    const std::vector<const double *> &emissionLogProbabilities,
+    const std::vector<const double *> &transitionLogProbabilities) {
+  std::vector<int> sequence;
+  is_broken = false;
+  const size_t numTimeSteps = emissionLogProbabilities.size();
+  if (numTimeSteps == 0) {
+    return sequence;
+  }
+  if (numStates == 0 ||
+      transitionLogProbabilities.size() + 1 != numTimeSteps) {
+    printf("ERR: ParallelScanViterbi Decode input size mismatch\n");
+    return sequence;
+  }
+  num_states = numStates;
+  emissions = &emissionLogProbabilities;
+  transitions = &transitionLogProbabilities;
+  const double *initial = emissionLogProbabilities[0];
+  if (std::all_of(initial, initial + numStates, [](double logProbability) {
+        return logProbability == -std::numeric_limits<double>::infinity();
+      })) {
+    is_broken = true;
+    return sequence;
+  }
+  back_pointers.resize(numTimeSteps * numStates);
+  std::fill(back_pointers.begin(), back_pointers.begin() + numStates, -1);
+
+  const size_t numSteps = numTimeSteps - 1;
+  const size_t chunkLength =
+      std::max<size_t>(pool->GrainSize(numSteps, min_chunk_length), 1);
+  const size_t numChunks =
+      std::max<size_t>((numSteps + chunkLength - 1) / chunkLength, 1);
+  chunks.resize(numChunks);
+  for (size_t k = 0; k < numChunks; ++k) {
+    chunks[k].begin = 1 + k * chunkLength;
+    chunks[k].end = std::min(numTimeSteps, chunks[k].begin + chunkLength);
+    chunks[k].startMessage.resize(numStates);
+  }
+  chunks[0].startMessage.assign(initial, initial + numStates);
+
+  // The first chunk knows its start message, the products of the last chunk
+  // are never needed.
+  pool->ParallelFor(numChunks, 1, [this, numChunks](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      if (k == 0) {
+        ForwardChunk(chunks[0]);
+      } else if (k + 1 < numChunks) {
+        ComputeProduct(chunks[k]);
+      }
+    }
+  });
+  if (chunks[0].brokenStep == chunks[0].end) {
+    for (size_t k = 1; k < numChunks; ++k) {
+      if (k == 1) {
+        chunks[1].startMessage = chunks[0].lastMessage;
+      } else {
+        MaxPlusProduct(chunks[k - 1].startMessage.data(),
+                       chunks[k - 1].product.data(), nullptr,
+                       chunks[k].startMessage.data(),
+                       chunks[k - 1].argmax.data());
+      }
+    }
+    pool->ParallelFor(numChunks - 1, 1, [this](size_t begin, size_t end) {
+      for (size_t k = begin; k < end; ++k) {
+        ForwardChunk(chunks[k + 1]);
+      }
+    });
+  }
+
+  // Back tracking from the last time step before the first HMM break.
+  const Chunk *last = &chunks.back();
+  for (auto &chunk : chunks) {
+    if (chunk.brokenStep < chunk.end) {
+      last = &chunk;
+      is_broken = true;
+      break;
+    }
+  }
+  const std::vector<double> &message = last->lastMessage;
+  int state = 0;
+  for (size_t i = 1; i < numStates; ++i) {
+    if (message[i] > message[state]) {
+      state = (int)i;
+    }
+  }
+  sequence.resize(last->brokenStep);
+  for (size_t t = sequence.size(); t-- > 0;) {
+    sequence[t] = state;
+    state = back_pointers[t * numStates + state];
+  }
+  return sequence;
+}
+
+void ParallelScanViterbi::ComputeProduct(Chunk &chunk) {
+  const size_t n = num_states;
+  chunk.product.resize(n * n);
+  chunk.message.resize(n * n);
+  chunk.argmax.resize(n);
+  // Step matrix of the first time step.
+  const double *matrix = (*transitions)[chunk.begin - 1];
+  const double *emission = (*emissions)[chunk.begin];
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      chunk.product[i * n + j] = matrix[i * n + j] + emission[j];
+    }
+  }
+  for (size_t t = chunk.begin + 1; t < chunk.end; ++t) {
+    for (size_t i = 0; i < n; ++i) {
+      MaxPlusProduct(&chunk.product[i * n], (*transitions)[t - 1],
+                     (*emissions)[t], &chunk.message[i * n],
+                     chunk.argmax.data());
+    }
+    chunk.product.swap(chunk.message);
+  }
+}
+
+void ParallelScanViterbi::ForwardChunk(Chunk &chunk) {
+  const size_t n = num_states;
+  chunk.lastMessage = chunk.startMessage;
+  chunk.message.resize(n);
+  chunk.brokenStep = chunk.end;
+  for (size_t t = chunk.begin; t < chunk.end; ++t) {
+    MaxPlusProduct(chunk.lastMessage.data(), (*transitions)[t - 1],
+                   (*emissions)[t], chunk.message.data(),
+                   &back_pointers[t * n]);
+    if (std::all_of(chunk.message.begin(), chunk.message.end(),
+                    [](double logProbability) {
+                      return logProbability ==
+                             -std::numeric_limits<double>::infinity();
+                    })) {
+      chunk.brokenStep = t;
+      return;
+    }
+    chunk.lastMessage.swap(chunk.message);
+  }
+}
+
+void ParallelScanViterbi::MaxPlusProduct(const double *message,
+                                         const double *matrix,
+                                         const double *emission,
+                                         double *result, int *argmax) const {
+  const size_t n = num_states;
+  std::fill(result, result + n, -std::numeric_limits<double>::infinity());
+  std::fill(argmax, argmax + n, -1);
+  // Same order of operations as DenseViterbiAlgorithm::ForwardColumns().
+  for (size_t p = 0; p < n; ++p) {
+    if (message[p] == -std::numeric_limits<double>::infinity()) {
+      continue;
+    }
+    MaxPlusRowUpdate(message[p], matrix + p * n, n, static_cast<int>(p),
+                     result, argmax);
+  }
+  if (emission != nullptr) {
+    for (size_t c = 0; c < n; ++c) {
+      result[c] += emission[c];
+    }
+  }
+}
+
+}  // namespace hmm
@@ -0,0 +1,132 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Parallel-in-time Viterbi decoding of one long index based sequence.
+ *
+ * <p>The forward recursion m_t = m_t-1 ⊗ M_t with M_t[i][j] = A_t[i][j] +
+ * e_t[j] is a chain of max-plus products, and max-plus products are
+ * associative. Decode() splits the time steps into chunks and
+ * - computes the max-plus product of the step matrices of each chunk in
+ *   parallel, while the first chunk runs the ordinary forward step,
+ * - scans the chunk products to get the message at the start of each chunk,
+ *   which is sequential but costs only O(numStates²) per chunk,
+ * - reruns the forward step of each chunk from its start message in
+ *   parallel, recording the back pointers, and back tracks the whole
+ *   sequence.
+ * The product of a chunk costs O(numStates³) per time step instead of
+ * O(numStates²), so the scan pays off when the pool has clearly more threads
+ * than there are states, e.g. for small state spaces and very long traces.
+ * With a single chunk, Decode() is the ordinary sequential algorithm.
+ *
+ * <p>Inputs follow DenseViterbiAlgorithm with candidates 0, ...,
+ * numStates - 1 in every time step: emissionLogProbabilities[t] points to
+ * numStates values, the first time step's are the initial log probabilities
+ * as in StartWithInitialObservation(), and transition matrices are row-major
+ * with -infinity for missing transitions. Ties are broken as in
+ * DenseViterbiAlgorithm.
+ *
+ * <p>Floating-point caveat: the start messages of the chunks are computed
+ * with the additions grouped differently than in the sequential recursion,
+ * and floating-point addition is not associative. Messages can therefore
+ * differ in the last bits, which changes the path where two paths are
+ * within rounding error of each other. The result equals the one of
+ * DenseViterbiAlgorithm whenever all sums are exact, e.g. for log
+ * probabilities that are multiples of a power of two of bounded magnitude.
+ */
+
+#ifndef PARALLEL_SCAN_VITERBI_H_
+#define PARALLEL_SCAN_VITERBI_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "thread_pool.h"
+
+namespace hmm {
+
+class ParallelScanViterbi {
+ private:
+  // Time steps [begin, end) of the sequence, begin >= 1.
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    // Max-plus product of the step matrices, numStates x numStates.
+    std::vector<double> product;
+    // Message of time step begin - 1.
+    std::vector<double> startMessage;
+    // Message of the last time step before end or before an HMM break.
+    std::vector<double> lastMessage;
+    // First time step with an HMM break, end if none.
+    size_t brokenStep;
+    // Scratch of MaxPlusRowUpdate().
+    std::vector<double> message;
+    std::vector<int> argmax;
+  };
+
+  std::unique_ptr<ThreadPool> own_pool;
+  ThreadPool *pool;
+  size_t min_chunk_length = 256;
+  size_t num_states = 0;
+  const std::vector<const double *> *emissions = nullptr;
+  const std::vector<const double *> *transitions = nullptr;
+  std::vector<Chunk> chunks;
+  // numStates back pointers per time step, see DenseViterbiAlgorithm.
+  std::vector<int> back_pointers;
+  std::vector<const double *> homogeneous_transitions;
+  bool is_broken = false;
+
+ public:
+  // Uses a new pool with one thread per hardware thread if numThreads <= 0.
+  explicit ParallelScanViterbi(int numThreads = 0);
+  // Uses the given pool, which must outlive this instance.
+  explicit ParallelScanViterbi(ThreadPool *threadPool);
+  ~ParallelScanViterbi() {}
+
+  // Chunks have at least minChunkLength time steps, 256 by default.
+  void SetMinChunkLength(size_t minChunkLength);
+  // Returns the most likely state of each time step. The matrix into time
+  // step t is transitionLogProbabilities[t - 1]. Stops at an HMM break like
+  // DenseViterbiAlgorithm::ComputeMostLikelySequence(), i.e. returns the most
+  // likely sequence of the time steps before the break.
+  std::vector<int> Decode(
+      size_t numStates,
+      const std::vector<const double *> &emissionLogProbabilities,
+      const std::vector<const double *> &transitionLogProbabilities);
+  // Same as above with the same transition matrix for all time steps.
+  std::vector<int> Decode(
+      size_t numStates,
+      const std::vector<const double *> &emissionLogProbabilities,
+      const double *transitionLogProbabilities);
+  // Whether the last Decode() stopped at an HMM break.
+  bool IsBroken() const { return is_broken; }
+
+ private:
+  // Sets chunk.product to the product of the step matrices of the chunk.
+  void ComputeProduct(Chunk &chunk);
+  // Runs the forward step from chunk.startMessage, sets back_pointers,
+  // chunk.lastMessage and chunk.brokenStep.
+  void ForwardChunk(Chunk &chunk);
+  // Sets result to the max-plus product of message and the row-major matrix.
+  // Adds emission to the result if it is not nullptr. argmax is scratch.
+  void MaxPlusProduct(const double *message, const double *matrix,
+                      const double *emission, double *result,
+                      int *argmax) const;
+};
+
+}  // namespace hmm
+
+#endif  // PARALLEL_SCAN_VITERBI_H_
@@ -54,7 +54,7 @@ class SequenceState {
  public:
   SequenceState(S state, O observation, D transitionDescriptor);
   friend bool operator==<>(const SequenceState& lhs, const SequenceState& rhs);
-  SequenceState<S, O, D>& operator=(SequenceState<S, O, D>& rhs);
+  SequenceState<S, O, D>& operator=(const SequenceState<S, O, D>& rhs);
 
   std::string ToString() {
     return "SequenceState [state=" + state + ", observation=" + observation +
@@ -64,7 +64,7 @@ class SequenceState {
 
 template <typename S, typename O, typename D>
 SequenceState<S, O, D>& SequenceState<S, O, D>::operator=(
-    SequenceState<S, O, D>& rhs) {
+    const SequenceState<S, O, D>& rhs) {
   state = rhs.state;
   observation = rhs.observation;
   transitionDescriptor = rhs.transitionDescriptor;
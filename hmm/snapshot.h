@@ -0,0 +1,127 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Binary snapshots of decoder state, see ViterbiAlgorithm::SaveSnapshot().
+ *
+ * <p>SnapshotWriter appends fixed-width values in native byte order to a
+ * byte string, SnapshotReader reads them back with bounds checks. Snapshots
+ * are meant for moving sessions between processes of the same build, not as
+ * an archive format.
+ *
+ * <p>Values of state, observation and descriptor types are written by
+ * SnapshotTraits<T>. Arithmetic types, enums and std::string are supported
+ * out of the box; other types are made serializable by specializing
+ * SnapshotTraits in namespace hmm:
+ *
+ *   template <>
+ *   class SnapshotTraits<Rain> {
+ *    public:
+ *     static void Write(const Rain &value, SnapshotWriter &writer) {
+ *       SnapshotTraits<std::string>::Write(value.weather_, writer);
+ *     }
+ *     static bool Read(SnapshotReader &reader, Rain &value) {
+ *       return SnapshotTraits<std::string>::Read(reader, value.weather_);
+ *     }
+ *   };
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace hmm {
+
+// Leading bytes of every snapshot, followed by kSnapshotVersion. The version
+// is increased whenever the layout changes.
+const char kSnapshotMagic[4] = {'H', 'M', 'M', 'V'};
+const uint32_t kSnapshotVersion = 3;
+
+class SnapshotWriter {
+ private:
+  std::string &bytes;
+
+ public:
+  // Appends to snapshot.
+  explicit SnapshotWriter(std::string &snapshot) : bytes(snapshot) {}
+  void WriteBytes(const void *data, size_t size) {
+    bytes.append(static_cast<const char *>(data), size);
+  }
+  void WriteUint32(uint32_t value) { WriteBytes(&value, sizeof(value)); }
+  void WriteInt32(int32_t value) { WriteBytes(&value, sizeof(value)); }
+};
+
+class SnapshotReader {
+ private:
+  const char *position;
+  const char *end;
+
+ public:
+  SnapshotReader(const char *data, size_t size)
+      : position(data), end(data + size) {}
+  // Returns false if fewer than size bytes are left.
+  bool ReadBytes(void *data, size_t size) {
+    if ((size_t)(end - position) < size) {
+      return false;
+    }
+    memcpy(data, position, size);
+    position += size;
+    return true;
+  }
+  bool ReadUint32(uint32_t &value) { return ReadBytes(&value, sizeof(value)); }
+  bool ReadInt32(int32_t &value) { return ReadBytes(&value, sizeof(value)); }
+  size_t Remaining() const { return end - position; }
+};
+
+template <typename T, typename Enable = void>
+class SnapshotTraits;
+
+template <typename T>
+class SnapshotTraits<T, typename std::enable_if<std::is_arithmetic<T>::value ||
+                                                std::is_enum<T>::value>::type> {
+ public:
+  static void Write(const T &value, SnapshotWriter &writer) {
+    writer.WriteBytes(&value, sizeof(value));
+  }
+  static bool Read(SnapshotReader &reader, T &value) {
+    return reader.ReadBytes(&value, sizeof(value));
+  }
+};
+
+template <>
+class SnapshotTraits<std::string> {
+ public:
+  static void Write(const std::string &value, SnapshotWriter &writer) {
+    writer.WriteUint32((uint32_t)value.size());
+    writer.WriteBytes(value.data(), value.size());
+  }
+  static bool Read(SnapshotReader &reader, std::string &value) {
+    uint32_t size;
+    if (!reader.ReadUint32(size) || reader.Remaining() < size) {
+      return false;
+    }
+    value.resize(size);
+    return reader.ReadBytes(&value[0], size);
+  }
+};
+
+}  // namespace hmm
+
+#endif  // SNAPSHOT_H_
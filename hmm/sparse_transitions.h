@@ -0,0 +1,73 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Sparse transitions of one time step for DenseViterbiAlgorithm.
+ *
+ * <p>Transitions are stored column-wise (compressed sparse column with one
+ * column per current candidate): the predecessors of the current candidate c
+ * are prevIndices[offsets[c]] ... prevIndices[offsets[c + 1] - 1], with the
+ * log probabilities and descriptors at the same positions. Transitions that
+ * are not stored have zero probability. descriptors may be empty.
+ *
+ * <p>Build it by calling AddTransition() for all predecessors of a current
+ * candidate followed by EndCandidate(), for each current candidate in order.
+ *
+ * @param <D> the transition descriptor type
+ * @param <P> the probability type, see DenseViterbiAlgorithm
+ */
+
+#ifndef SPARSE_TRANSITIONS_H_
+#define SPARSE_TRANSITIONS_H_
+
+#include <vector>
+
+namespace hmm {
+
+template <typename D, typename P = double>
+class SparseTransitions {
+ public:
+  std::vector<int> offsets;
+  std::vector<int> prevIndices;
+  std::vector<P> logProbabilities;
+  std::vector<D> descriptors;
+
+  SparseTransitions() : offsets(1, 0) {}
+
+  // Removes all transitions, keeping the allocated memory.
+  void Clear() {
+    offsets.assign(1, 0);
+    prevIndices.clear();
+    logProbabilities.clear();
+    descriptors.clear();
+  }
+  void AddTransition(int prevIndex, P logProbability) {
+    prevIndices.push_back(prevIndex);
+    logProbabilities.push_back(logProbability);
+  }
+  void AddTransition(int prevIndex, P logProbability, D descriptor) {
+    AddTransition(prevIndex, logProbability);
+    descriptors.push_back(descriptor);
+  }
+  // Closes the column of the current candidate.
+  void EndCandidate() { offsets.push_back((int)prevIndices.size()); }
+  int NumCandidates() const { return (int)offsets.size() - 1; }
+  int NumTransitions() const { return (int)prevIndices.size(); }
+};
+
+}  // namespace hmm
+
+#endif  // SPARSE_TRANSITIONS_H_
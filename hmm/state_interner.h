@@ -0,0 +1,104 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Table of distinct states, each identified by a dense 32-bit handle.
+ *
+ * <p>Handles are assigned in order of first occurrence, starting with 0, and
+ * stay valid until Clear(). Internals that store or move states by handle
+ * instead of by value avoid copying and comparing heavyweight states such
+ * as strings; the state itself is only looked up for input and output.
+ *
+ * <p>Each state is stored once, as key of the lookup map. Requires
+ * operator< on S, like the std::map arguments of the decoders.
+ *
+ * @param <S> the state type
+ */
+
+#ifndef STATE_INTERNER_H_
+#define STATE_INTERNER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace hmm {
+
+typedef uint32_t StateHandle;
+// Not the handle of any state.
+const StateHandle kNoStateHandle = UINT32_MAX;
+
+template <typename S>
+class StateInterner {
+ private:
+  std::map<S, StateHandle> handles;
+  // Key of handles for each handle. Map nodes never move, so the pointers
+  // stay valid until Clear().
+  std::vector<const S *> states;
+
+  bool IsHandleOf(StateHandle handle, const S &state) const {
+    return handle < states.size() && !(*states[handle] < state) &&
+           !(state < *states[handle]);
+  }
+
+ public:
+  StateInterner() {}
+  StateInterner(const StateInterner &) = delete;
+  StateInterner &operator=(const StateInterner &) = delete;
+  StateInterner(StateInterner &&) = default;
+  StateInterner &operator=(StateInterner &&) = default;
+
+  // Returns the handle of state, adding state to the table if it is new.
+  // hint is a handle that probably belongs to state, e.g. the handle of the
+  // same candidate in the previous time step. It is checked first, so that a
+  // correct hint costs one comparison instead of a lookup.
+  StateHandle Intern(const S &state, StateHandle hint = kNoStateHandle) {
+    if (IsHandleOf(hint, state)) {
+      return hint;
+    }
+    auto found = handles.lower_bound(state);
+    if (found != handles.end() && !(state < found->first)) {
+      return found->second;
+    }
+    const StateHandle handle = (StateHandle)states.size();
+    found = handles.emplace_hint(found, state, handle);
+    states.push_back(&found->first);
+    return handle;
+  }
+  // Returns the handle of state or kNoStateHandle if state is not in the
+  // table. hint as for Intern().
+  StateHandle Find(const S &state, StateHandle hint = kNoStateHandle) const {
+    if (IsHandleOf(hint, state)) {
+      return hint;
+    }
+    auto found = handles.find(state);
+    return found == handles.end() ? kNoStateHandle : found->second;
+  }
+  // Returns the state of handle, which must have been returned by Intern().
+  const S &State(StateHandle handle) const { return *states[handle]; }
+  // Number of distinct states.
+  size_t Size() const { return states.size(); }
+  // Removes all states, invalidating all handles.
+  void Clear() {
+    handles.clear();
+    states.clear();
+  }
+};
+
+}  // namespace hmm
+
+#endif  // STATE_INTERNER_H_
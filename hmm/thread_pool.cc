@@ -0,0 +1,154 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace hmm {
+
+ThreadPool::ThreadPool(int numThreads) : next_queue(0) {
+  if (numThreads <= 0) {
+    numThreads = static_cast<int>(std::thread::hardware_concurrency());
+    if (numThreads <= 0) {
+      numThreads = 1;
+    }
+  }
+  for (int i = 0; i <= numThreads; ++i) {
+    queues.push_back(std::unique_ptr<Queue>(new Queue()));
+  }
+  for (int i = 0; i < numThreads; ++i) {
+    threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+int ThreadPool::NumThreads() const { return static_cast<int>(threads.size()); }
+
+size_t ThreadPool::GrainSize(size_t count, size_t minGrainSize) const {
+  // Four ranges per thread, counting the caller, leave room for stealing.
+  const size_t numRanges = 4 * (threads.size() + 1);
+  return std::max(minGrainSize, (count + numRanges - 1) / numRanges);
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grainSize,
+                             const std::function<void(size_t, size_t)> &body) {
+  if (count == 0) {
+    return;
+  }
+  if (grainSize == 0) {
+    grainSize = 1;
+  }
+  const size_t numTasks = (count + grainSize - 1) / grainSize;
+  if (numTasks == 1 || threads.empty()) {
+    for (size_t begin = 0; begin < count; begin += grainSize) {
+      body(begin, std::min(count, begin + grainSize));
+    }
+    return;
+  }
+  Job job;
+  job.body = &body;
+  job.remaining = numTasks;
+  // Counted before the first task becomes visible, so that a worker popping
+  // it right away cannot take pending below zero.
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    pending += numTasks;
+  }
+  // Deal the tasks out round-robin, starting at a different worker for each
+  // job so that concurrent callers do not pile up on the first queue.
+  const size_t numWorkers = threads.size();
+  size_t queue = next_queue++ % numWorkers;
+  for (size_t begin = 0; begin < count; begin += grainSize) {
+    Task task = {&job, begin, std::min(count, begin + grainSize)};
+    {
+      std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+      queues[queue]->tasks.push_back(task);
+    }
+    queue = (queue + 1) % numWorkers;
+  }
+  wake.notify_all();
+
+  // Help until no task is left to take, then wait for the running ones.
+  Task task;
+  while (job.remaining.load() > 0 && PopTask(numWorkers, &task)) {
+    RunTask(task);
+  }
+  std::unique_lock<std::mutex> lock(job.mutex);
+  job.done.wait(lock, [&job] { return job.remaining.load() == 0; });
+}
+
+bool ThreadPool::PopTask(size_t index, Task *task) {
+  bool found = false;
+  for (size_t i = 0; i < queues.size() && !found; ++i) {
+    Queue &queue = *queues[(index + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+    } else {
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+    found = true;
+  }
+  if (found) {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    pending--;
+  }
+  return found;
+}
+
+void ThreadPool::RunTask(const Task &task) {
+  (*task.job->body)(task.begin, task.end);
+  // The job lives on the stack of ParallelFor(), which returns as soon as it
+  // sees remaining == 0 under the job mutex.
+  Job *job = task.job;
+  std::lock_guard<std::mutex> lock(job->mutex);
+  if (--job->remaining == 0) {
+    job->done.notify_all();
+  }
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+  for (;;) {
+    Task task;
+    if (PopTask(index, &task)) {
+      RunTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    wake.wait(lock, [this] { return stopping || pending > 0; });
+    if (stopping && pending == 0) {
+      return;
+    }
+  }
+}
+
+}  // namespace hmm
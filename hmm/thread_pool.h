@@ -0,0 +1,98 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Work-stealing thread pool.
+ *
+ * <p>Each worker owns a task deque. ParallelFor() splits an index range into
+ * tasks and deals them out over the deques in index order; a worker takes
+ * tasks from the front of its own deque, i.e. in index order, and steals from
+ * the back of the others once it runs dry. This balances tasks of very
+ * different cost, e.g. sequences of different length sorted longest first.
+ * The calling thread takes part in the work until the range is done.
+ */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hmm {
+
+class ThreadPool {
+ public:
+  // Starts numThreads workers, or one per hardware thread if numThreads <= 0.
+  explicit ThreadPool(int numThreads = 0);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  int NumThreads() const;
+  // Grain size that splits count indices into a few ranges per thread, but
+  // no ranges smaller than minGrainSize.
+  size_t GrainSize(size_t count, size_t minGrainSize) const;
+  // Calls body(begin, end) for consecutive ranges of at most grainSize
+  // indices covering [0, count) and blocks until all calls have returned.
+  // Ranges are processed concurrently and in no particular order. Can be
+  // called from several threads at once, but not from within a body.
+  void ParallelFor(size_t count, size_t grainSize,
+                   const std::function<void(size_t, size_t)> &body);
+
+ private:
+  struct Job {
+    const std::function<void(size_t, size_t)> *body;
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  struct Task {
+    Job *job;
+    size_t begin;
+    size_t end;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Takes a task from the front of queues[index] or steals one from the back
+  // of another queue.
+  bool PopTask(size_t index, Task *task);
+  void RunTask(const Task &task);
+  void WorkerLoop(size_t index);
+
+  // One queue per worker. The last queue belongs to callers of ParallelFor().
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  // Number of queued tasks, guarded by sleep_mutex.
+  size_t pending = 0;
+  bool stopping = false;
+  std::atomic<size_t> next_queue;
+};
+
+}  // namespace hmm
+
+#endif  // THREAD_POOL_H_
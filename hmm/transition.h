@@ -38,7 +38,7 @@ class Transition {
   friend bool operator==<>(const Transition<S>& lhs, const Transition<S>& rhs);
   friend bool operator< <>(const Transition<S>& lhs, const Transition<S>& rhs);
 
-  Transition(S fromCandidate, S toCandidate)
+  Transition(const S& fromCandidate, const S& toCandidate)
       : fromCandidate(fromCandidate), toCandidate(toCandidate) {}
   ~Transition() {}
 
@@ -17,6 +17,7 @@
 */
 
 #include "utils.h"
+#include <cstdio>
 
 int Utils::initialHashMapCapacity(int maxElements) {
   // Default load factor of HashMaps is 0.75
@@ -26,8 +27,7 @@ int Utils::initialHashMapCapacity(int maxElements) {
 template <typename S>
 std::unordered_map<S, double> Utils::logToNonLogProbabilities(
     std::unordered_map<S, double> &logProbabilities) {
-  const std::unordered_map<S, double> result =
-      new std::unordered_map<S, double>();
+  std::unordered_map<S, double> result;
   for (auto entry : logProbabilities) {
     auto rst = result.emplace(entry.first, std::exp(entry.second));
     if (!rst.second) {
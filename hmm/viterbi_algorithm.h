@@ -10,14 +10,22 @@
 #define VITERBI_ALGORITHM_H_
 
 #include <algorithm>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include "message_history.h"
+#include "object_pool.h"
 #include "sequence_state.h"
+#include "snapshot.h"
+#include "state_interner.h"
+#include "thread_pool.h"
 #include "transition.h"
 #include "utils.h"
+#include "viterbi_observer.h"
 
 /**
  * Implementation of the Viterbi algorithm for time-inhomogeneous Markov
@@ -45,10 +53,11 @@
  * path after a certain number of time steps. For instance, when matching GPS
  * coordinates to roads, the last GPS positions in the trace usually do not
  * affect the first road matches anymore. This implementation exploits this fact
- * by letting the Java garbage collector take care of unreachable back pointers.
- * If back pointers converge to a single path after a constant number of time
- * steps, only O(t) back pointers and transition descriptors need to be stored
- * in memory.
+ * by reference counting back pointers: after each time step, back pointer
+ * chains that are no longer reachable from the last states are given back to
+ * the pool of the decoder. If back pointers converge to a single path after a
+ * constant number of time steps, only O(t) back pointers and transition
+ * descriptors need to be stored in memory.
  *
  * @param <S> the state type
  * @param <O> the observation type
@@ -71,27 +80,29 @@ class ExtendedState {
  public:
   friend bool operator==
       <>(const ExtendedState<S, O, D> &lhs, const ExtendedState<S, O, D> &rhs);
-  S state;
+  // Handle in the state table of the owning ViterbiAlgorithm.
+  StateHandle state;
   // Back pointer to previous state candidate in the most likely sequence.
-  // Back pointers are chained using plain Java references.
-  // This allows garbage std::vector of unreachable back pointers.
+  // Back pointers are chained using plain pointers into the ObjectPool of the
+  // owning ViterbiAlgorithm, which also owns the pointed-to state.
   ExtendedState<S, O, D> *backPointer = nullptr;
   O observation;
   D transitionDescriptor;
+  // Number of back pointers and last extended states referring to this state.
+  // The state is released when it drops to zero.
+  int referenceCount = 0;
+  // Time step of the state, starting with 0 for the initial states.
+  int timeStep = 0;
 
-  ExtendedState(S state, ExtendedState<S, O, D> *backPointer, O observation,
-                D transitionDescriptor)
+  ExtendedState(StateHandle state, ExtendedState<S, O, D> *backPointer,
+                O observation, D transitionDescriptor)
       : state(state),
         backPointer(backPointer),
         observation(observation),
-        transitionDescriptor(transitionDescriptor) {
+        transitionDescriptor(transitionDescriptor),
+        timeStep(backPointer != nullptr ? backPointer->timeStep + 1 : 0) {
     //    printf("backPointer=%p\n", backPointer);
   }
-  ~ExtendedState() {
-    if (backPointer != nullptr) {
-      delete backPointer;
-    }
-  }
 };
 
 template <typename S, typename O, typename D>
@@ -103,35 +114,119 @@ bool operator==(const ExtendedState<S, O, D> &lhs,
 template <typename S, typename O, typename D>
 class ForwardStepResult {
  public:
-  std::map<S, double> newMessage;
+  // Candidates of the time step, without duplicates.
+  std::vector<S> candidates;
+  // handles[i] is the handle of candidates[i].
+  std::vector<StateHandle> handles;
+  // newMessage[i] belongs to candidates[i].
+  std::vector<double> newMessage;
   // Includes back pointers to previous state candidates for retrieving the most
-  // likely sequence after the forward pass.
-  std::map<S, ExtendedState<S, O, D> *> newExtendedStates;
-  ForwardStepResult(int numberStates) {
-    //    printf("??????\n");
-  }
+  // likely sequence after the forward pass. nullptr for candidates with zero
+  // probability.
+  std::vector<ExtendedState<S, O, D> *> newExtendedStates;
+  ForwardStepResult() {}
+};
+
+// Part of the most likely sequence between two HMM breaks, see
+// ViterbiAlgorithm::SetBreakRecovery().
+template <typename S, typename O, typename D>
+class SequenceSegment {
+ public:
+  // Time step of the first state of the segment, i.e. the time step of the
+  // HMM break that started it, or 0 for the first segment.
+  int startTimeStep = 0;
+  std::vector<SequenceState<S, O, D>> sequence;
 };
 
 template <typename S, typename O, typename D>
 class ViterbiAlgorithm {
  private:
   // Allows to retrieve the most likely sequence using back pointers.
-  std::map<S, ExtendedState<S, O, D> *> lastExtendedStates;
-  std::vector<S> prevCandidates;
+  // lastExtendedStates[i] belongs to prevCandidates[i] and is nullptr if the
+  // candidate has zero probability.
+  std::vector<ExtendedState<S, O, D> *> lastExtendedStates;
+  // Handles in state_table.
+  std::vector<StateHandle> prevCandidates;
+  // Every state referred to by prevCandidates and the extended states, see
+  // CompactStateTable(). States are only copied and compared when they are
+  // interned once per time step, when the transition maps are matched
+  // against the candidates and when they are converted back for results.
+  StateInterner<S> state_table;
+  // Reused by CompactStateTable(): new handle of each old one.
+  std::vector<StateHandle> state_table_remap;
 
-  // For each state s_t of the current time step t, message.get(s_t) contains
-  // the log probability of the most likely sequence ending in state s_t with
-  // given observations o_1, ..., o_t.
+  // For each state s_t of the current time step t, message[i] contains
+  // the log probability of the most likely sequence ending in state
+  // s_t = prevCandidates[i] with given observations o_1, ..., o_t.
   //
   // Formally, this is max log p(s_1, ..., s_t, o_1, ..., o_t) w.r.t. s_1, ...,
   // s_{t-1}. Note that to compute the most likely state sequence, it is
   // sufficient and more efficient to compute in each time step the joint
   // probability of states and observations instead of computing the conditional
   // probability of states given the observations.
-  std::map<S, double> message;
+  std::vector<double> message;
+  // The time step being computed. Swapped with prevCandidates, message and
+  // lastExtendedStates after each time step, so that their memory is reused.
+  ForwardStepResult<S, O, D> next_step;
+  // Index of each handle in next_step.handles and in prevCandidates, -1 for
+  // all others. Only filled while in use, see InternCandidates() and
+  // ForEachStepTransition().
+  std::vector<int> handle_cur_index;
+  std::vector<int> handle_prev_index;
+  // Per step transition log probabilities and descriptors by candidate and
+  // previous candidate, see ForwardStep().
+  std::vector<double> transition_cache;
+  std::vector<const D *> descriptor_cache;
+  // Reused by ForEachStepTransition(): target handles of the last source.
+  std::vector<StateHandle> transition_hints;
   bool is_broken = false;
-  // ForwardBackwardAlgorithm<S, O> *forwardBackward;
-  std::vector<std::map<S, double>> message_history;  // For debugging only.
+  // Owns all ExtendedStates. Back pointers are shared between states, so they
+  // are reference counted and released iteratively instead of recursively.
+  ObjectPool<ExtendedState<S, O, D>> extended_state_pool;
+  // Online decoding, see SetOnlineDecoding().
+  std::function<void(const std::vector<SequenceState<S, O, D>> &)>
+      commit_callback;
+  int max_lag = -1;
+  // Time step of the last state passed to commit_callback, -1 if none.
+  int committed_time_step = -1;
+  std::vector<ExtendedState<S, O, D> *> convergence_frontier;
+  // Reused by Commit().
+  std::vector<SequenceState<S, O, D>> commit_reversed;
+  std::vector<SequenceState<S, O, D>> commit_prefix;
+  // Pruning, see SetPruning().
+  int max_states = 0;
+  double log_beam_width = std::numeric_limits<double>::infinity();
+  // Total since Reset(). Per time step counts go to the observer, so memory
+  // stays bounded with online decoding.
+  size_t pruned_state_count = 0;
+  std::vector<std::pair<double, size_t>> pruning_order;
+  std::vector<bool> pruning_keep;
+  // Previous candidates by descending message, see LazyForwardStep().
+  std::vector<std::pair<double, size_t>> lazy_order;
+  // Parallel forward steps, see SetThreadPool().
+  ThreadPool *thread_pool = nullptr;
+  size_t min_parallel_candidates = 0;
+  // Per step scratch of ForwardStep(): best previous candidate index and log
+  // probability of each candidate.
+  std::vector<int> max_prev_indices;
+  std::vector<double> max_log_probabilities;
+  // Instrumentation, see SetObserver(). step_metrics collects the metrics of
+  // the running time step.
+  ViterbiObserver *observer = nullptr;
+  ViterbiStepMetrics step_metrics;
+  // Time step of prevCandidates, starting with 0.
+  int time_step = 0;
+  // Reused by SaveSnapshot(): nodes in snapshot order and their indices.
+  std::vector<ExtendedState<S, O, D> *> snapshot_nodes;
+  std::unordered_map<const ExtendedState<S, O, D> *, int32_t> snapshot_indices;
+  std::vector<ExtendedState<S, O, D> *> snapshot_path;
+  // Break recovery, see SetBreakRecovery().
+  bool break_recovery = false;
+  std::vector<int> break_time_steps;
+  std::vector<SequenceSegment<S, O, D>> finished_segments;
+  // For debugging only, see SetKeepMessageHistory().
+  bool keep_message_history = false;
+  ColumnarMessageHistory<S> message_history;
 
   /// Need to construct a new instance for each sequence of observations.
  public:
@@ -142,28 +237,134 @@ class ViterbiAlgorithm {
   // Default: false
   // Must be called before processing is started.
   void SetKeepMessageHistory(bool keepMessageHistory);
+  // Enables online decoding for sequences without end. After each time step,
+  // once the back pointers of all last states converge to a common ancestor,
+  // the most likely sequence up to that ancestor cannot change anymore. This
+  // final prefix is passed to onCommit (in time order, each state exactly
+  // once) and dropped from memory.
+  //
+  // If maxLag >= 0, a commit is forced whenever more than maxLag time steps
+  // are pending: the prefix of the currently most likely sequence is
+  // committed and all last states that do not extend it are dropped. The
+  // result then may differ from offline decoding. A negative maxLag only
+  // commits on convergence, which never changes the result.
+  //
+  // ComputeMostLikelySequence() returns only states not committed yet.
+  // Must be called before processing is started.
+  void SetOnlineDecoding(
+      std::function<void(const std::vector<SequenceState<S, O, D>> &)>
+          onCommit,
+      int maxLag = -1);
+  // Enables pruning of unlikely states after each time step. Keeps at most
+  // maxStates states (no limit if maxStates <= 0) and drops all states whose
+  // log probability is more than logBeamWidth below the best state of the
+  // time step. States with zero probability are always dropped. Pruned states
+  // are not considered as previous candidates of the next time step, so the
+  // result may differ from the unpruned most likely sequence.
+  // Ties at the top-K boundary are broken by candidate order.
+  // Must be called before processing is started.
+  void SetPruning(
+      int maxStates,
+      double logBeamWidth = std::numeric_limits<double>::infinity());
+  // Returns the total number of states pruned since the last Reset(). See
+  // ViterbiStepMetrics::prunedStates for the count of each time step.
+  size_t PrunedStateCount();
+  // Searches the most likely previous candidate of each candidate on the
+  // given pool in time steps with at least minParallelCandidates candidates.
+  // The pool must outlive this instance and must not be a pool that runs this
+  // instance itself, e.g. the pool of a BatchViterbi. Back pointers are still
+  // created serially in candidate order, so the result is bit-identical to
+  // the serial forward step. Transition maps are only read concurrently
+  // through find(). nullptr turns parallel forward steps off. Forward steps
+  // with a lazy transition provider always stay serial.
+  void SetThreadPool(ThreadPool *threadPool,
+                     size_t minParallelCandidates = 256);
+  // Enables break recovery. Without it, an HMM break ends decoding and all
+  // later time steps are ignored. With it, the time step that breaks the HMM
+  // finishes the current segment of the most likely sequence and starts a new
+  // one from the emission probabilities of its candidates, as
+  // StartWithInitialObservation() would. If these are all zero as well, the
+  // next time step starts the new segment, and so on. So one pass over a
+  // trace with gaps gives the most likely sequence of each part between the
+  // gaps, see ComputeMostLikelySegments().
+  //
+  // With SetOnlineDecoding(), the rest of a finished segment is committed at
+  // the break. Otherwise finished segments are kept until Reset().
+  // Must be called before processing is started.
+  void SetBreakRecovery(bool breakRecovery);
+  // Reports metrics of each time step to stepObserver, which must outlive
+  // this instance or be detached before. nullptr detaches the observer. See
+  // ViterbiObserver.
+  void SetObserver(ViterbiObserver *stepObserver);
   bool processingStarted();
+  // Discards all time steps so that the instance can be used for a new
+  // sequence of observations. Keeps allocated memory for reuse.
+  void Reset();
   // Lets the HMM computation start with the given initial state probabilities.
   void StartWithInitialStateProbabilities(
-      std::vector<S> &initialStates,
-      std::map<S, double> &initialLogProbabilities);
+      const std::vector<S> &initialStates,
+      const std::map<S, double> &initialLogProbabilities);
   // Lets the HMM computation start at the given first observation and uses the
   // given emission probabilities as the initial state probability for each
   // starting state s.
   void StartWithInitialObservation(
-      O observation, std::vector<S> &candidates,
-      std::map<S, double> &emissionLogProbabilities);
-  // Processes the next time step. Must not be called if the HMM is broken.
-  void NextStep(O observation, std::vector<S> &candidates,
-                std::map<S, double> &emissionLogProbabilities,
-                std::map<Transition<S>, double> &transitionLogProbabilities,
-                std::map<Transition<S>, D> &transitionDescriptors);
-  // See nextStep(Object, std::vector, Map, Map, Map)
-  void NextStep(O observation, std::vector<S> &candidates,
-                std::map<S, double> &emissionLogProbabilities,
-                std::map<Transition<S>, double> &transitionLogProbabilities);
+      O observation, const std::vector<S> &candidates,
+      const std::map<S, double> &emissionLogProbabilities);
+  // Processes the next time step. Ignored if the HMM is broken, unless break
+  // recovery is enabled, see SetBreakRecovery().
+  //
+  // None of the inputs is modified. A missing emission probability counts as
+  // log probability 0, a missing transition as zero probability. Duplicate
+  // candidates are reported and ignored.
+  //
+  // Candidates are copied into storage that is reused from step to step, so
+  // once the sizes of a sequence have been seen, a time step does no heap
+  // allocations as long as copying S, O and D does not allocate and the
+  // message history is disabled.
+  void NextStep(O observation, const std::vector<S> &candidates,
+                const std::map<S, double> &emissionLogProbabilities,
+                const std::map<Transition<S>, double> &transitionLogProbabilities,
+                const std::map<Transition<S>, D> &transitionDescriptors);
+  // See NextStep(O, const std::vector, Map, Map, Map)
+  void NextStep(O observation, const std::vector<S> &candidates,
+                const std::map<S, double> &emissionLogProbabilities,
+                const std::map<Transition<S>, double> &transitionLogProbabilities);
+  // Same as NextStep(O, const std::vector, Map, Map, Map), but takes over the
+  // candidates instead of copying them. candidates is left with the storage
+  // of an earlier time step, so refilling it does not allocate either.
+  void NextStep(O observation, std::vector<S> &&candidates,
+                const std::map<S, double> &emissionLogProbabilities,
+                const std::map<Transition<S>, double> &transitionLogProbabilities,
+                const std::map<Transition<S>, D> &transitionDescriptors);
+  // Same as NextStep(O, const std::vector, Map, Map, Map) for numCandidates
+  // candidates starting at candidates.
+  void NextStep(const O &observation, const S *candidates,
+                size_t numCandidates,
+                const std::map<S, double> &emissionLogProbabilities,
+                const std::map<Transition<S>, double> &transitionLogProbabilities,
+                const std::map<Transition<S>, D> &transitionDescriptors);
+  // Processes the next time step with lazily computed transitions.
+  //
+  // transitionLogProbability(from, to) returns the log probability of a
+  // transition, -infinity if there is none, and must never return a value
+  // above 0. It is only called for transitions that can still become the
+  // most likely predecessor of a candidate: previous candidates are tried in
+  // descending order of their forward message, and once the message of the
+  // next one cannot beat the best value found so far, the remaining ones are
+  // skipped. Each transition is requested at most once per time step.
+  //
+  // transitionDescriptor(from, to) may be empty. It is only called for the
+  // chosen predecessor of each candidate with non-zero probability.
+  //
+  // Gives the same result as NextStep with a map containing all transitions.
+  void NextStep(
+      O observation, const std::vector<S> &candidates,
+      const std::map<S, double> &emissionLogProbabilities,
+      std::function<double(const S &, const S &)> transitionLogProbability,
+      std::function<D(const S &, const S &)> transitionDescriptor);
   // Returns the most likely sequence of states for all time steps. This
-  // includes the initial states / initial observation time step. If an HMM
+  // includes the initial states / initial observation time step, unless it has
+  // already been committed in online decoding. If an HMM
   // break occurred in the last time step t, then the most likely sequence up to
   // t-1 is returned. See also <seealso cref="#isBroken()"/>.
   //
@@ -172,37 +373,118 @@ class ViterbiAlgorithm {
   // candidate at time step t, o_t is the observation at time step t and T is
   // the number of time steps.
   std::vector<SequenceState<S, O, D>> ComputeMostLikelySequence();
+  // Returns the segments of the most likely sequence between HMM breaks in
+  // time order, see SetBreakRecovery(). The last segment is the one
+  // ComputeMostLikelySequence() returns, it is missing if the last time step
+  // broke the HMM without a restart. Without break recovery, this is the
+  // result of ComputeMostLikelySequence() as a single segment, if any.
+  std::vector<SequenceSegment<S, O, D>> ComputeMostLikelySegments();
+  // Time steps with an HMM break since the last Reset(), in ascending order.
+  // Only recorded with break recovery, see SetBreakRecovery().
+  const std::vector<int> &BreakTimeSteps();
   // Returns whether an HMM occurred in the last time step.
   // An HMM break means that the probability of all states equals zero.
   bool IsBroken();
+  // Returns the number of ExtendedStates currently kept alive by back pointers
+  // from the last time step.
+  size_t LiveExtendedStateCount();
   //  Returns the sequence of intermediate forward messages for each time step.
-  //  Returns null if message history is not kept.
-  std::vector<std::map<S, double>> MessageHistory();
+  //  Empty if message history is not kept. The view does not copy the
+  //  messages and stays valid until Reset().
+  MessageHistoryView<S> MessageHistory();
   std::string MessageHistoryString();
+  // Writes the complete decoding state to snapshot, replacing its content:
+  // candidates, forward message, the back pointer graph as a table of nodes
+  // that refer to each other by index, time steps, the pruned state count and
+  // the breaks and finished segments of break recovery.
+  // Configuration, i.e. everything set by the Set...() methods, and the
+  // message history are not included. States, observations and descriptors
+  // are written with SnapshotTraits, see snapshot.h.
+  void SaveSnapshot(std::string &snapshot);
+  // Replaces the decoding state by a snapshot written by SaveSnapshot().
+  // Configuration is kept. Returns false and leaves the instance reset if the
+  // snapshot is malformed or has another format version.
+  bool RestoreSnapshot(const std::string &snapshot);
   // Returns whether the specified message is either empty or only contains
   // state candidates with zero probability and thus causes the HMM to break.
  private:
-  bool HMMBreak(const std::map<S, double> &message);
+  bool HMMBreak(const std::vector<double> &message);
+  // Drops one reference and releases the state if it is no longer referenced.
+  void Unreference(ExtendedState<S, O, D> *extendedState);
+  // Releases the state and all back pointers that become unreferenced by
+  // doing so, if the state itself is unreferenced.
+  void ReleaseIfUnreferenced(ExtendedState<S, O, D> *extendedState);
   // Use only if HMM only starts with first observation.
   void InitializeStateProbabilities(
-      O observation, std::vector<S> &candidates,
-      std::map<S, double> &initialLogProbabilities);
+      const O &observation, const std::vector<S> &candidates,
+      const std::map<S, double> &initialLogProbabilities);
+  // Starts a new segment from the emissions of the candidates in next_step
+  // after the forward step broke the HMM, see SetBreakRecovery().
+  void RecoverFromBreak(const O &observation,
+                        const std::map<S, double> &emissionLogProbabilities);
+  // Fills next_step.handles from next_step.candidates and removes all but
+  // the first occurrence of each state from both.
+  void InternCandidates();
+  // Calls f(c, p, value) for each transition from prevCandidates[p] to the
+  // candidate c of next_step. Walks the whole map, but looks up states by
+  // handle hints instead of looking up each transition.
+  template <typename V, typename F>
+  void ForEachStepTransition(const std::map<Transition<S>, V> &transitions,
+                             F f);
+  // Rebuilds state_table with only the states still referred to once it has
+  // grown well beyond them, so that decoding sequences without end with
+  // ever new states keeps memory bounded.
+  void CompactStateTable();
   /// Computes the new forward message and the back pointers to the previous
-  /// states.
-  ForwardStepResult<S, O, D> ForwardStep(
-      O observation, std::vector<S> &prevCandidates,
-      std::vector<S> &curCandidates, std::map<S, double> &message,
-      std::map<S, double> &emissionLogProbabilities,
-      std::map<Transition<S>, double> &transitionLogProbabilities,
-      std::map<Transition<S>, D> &transitionDescriptors);
+  /// states for the candidates in next_step. transitionDescriptors may be
+  /// nullptr.
+  void ForwardStep(
+      const O &observation,
+      const std::map<S, double> &emissionLogProbabilities,
+      const std::map<Transition<S>, double> &transitionLogProbabilities,
+      const std::map<Transition<S>, D> *transitionDescriptors);
+  // Same as ForwardStep() for transitions computed on demand.
+  void LazyForwardStep(
+      const O &observation,
+      const std::map<S, double> &emissionLogProbabilities,
+      std::function<double(const S &, const S &)> &transitionLogProbability,
+      std::function<D(const S &, const S &)> &transitionDescriptor);
+  // Takes over next_step unless it breaks the HMM. observation and
+  // emissionLogProbabilities are those of the forward step, for break
+  // recovery.
+  void ApplyForwardStep(const O &observation,
+                        const std::map<S, double> &emissionLogProbabilities);
+  // Searches the most likely previous candidate of the candidates
+  // [begin, end) of next_step. Transitions are read from transition_cache if
+  // cached, else looked up in transitionLogProbabilities. Returns the number
+  // of missing transitions if kCountMissing, 0 otherwise.
+  template <bool kCountMissing>
+  size_t FindMaxPrevStates(
+      size_t begin, size_t end,
+      const std::map<Transition<S>, double> &transitionLogProbabilities,
+      bool cached);
+  // Completes step_metrics and passes them to observer.
+  void ReportStep();
+  // Reads the state of RestoreSnapshot() into a reset instance.
+  bool ReadSnapshot(SnapshotReader &reader);
 
   double TransitionLogProbability(
-      S prevState, S curState,
-      std::map<Transition<S>, double> &transitionLogProbabilities);
-  // Retrieves the first state of the current forward message with maximum
-  // probability.
-  S MostLikelyState();  // Retrieves most likely sequence from the internal back
-                        // pointer sequence.
+      const S &prevState, const S &curState,
+      const std::map<Transition<S>, double> &transitionLogProbabilities);
+  // Removes states from message, lastExtendedStates and prevCandidates
+  // according to max_states and log_beam_width.
+  void PruneStates();
+  // Online decoding: commits the converged prefix and enforces max_lag.
+  void CommitFinalPrefix();
+  // Returns the common ancestor of all last states or nullptr.
+  ExtendedState<S, O, D> *ConvergencePoint();
+  // Passes all uncommitted states up to head to commit_callback and cuts the
+  // back pointer of head.
+  void Commit(ExtendedState<S, O, D> *head);
+  // Retrieves the index of the state of the current forward message with
+  // maximum probability. Ties are broken by state order.
+  int MostLikelyStateIndex();
+  // Retrieves most likely sequence from the internal back pointer sequence.
   std::vector<SequenceState<S, O, D>> RetrieveMostLikelySequence();
 };
 
@@ -23,66 +23,205 @@
 #include "viterbi_algorithm.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <sstream>
 #include <utility>
 
 namespace hmm {
 
 template <typename S, typename O, typename D>
 void ViterbiAlgorithm<S, O, D>::SetKeepMessageHistory(bool keepMessageHistory) {
-  if (keepMessageHistory) {
-    message_history = std::vector<std::map<S, double>>();
-  } else {
-    message_history.clear();
+  keep_message_history = keepMessageHistory;
+  if (!keepMessageHistory) {
+    message_history.Clear();
+  }
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::SetOnlineDecoding(
+    std::function<void(const std::vector<SequenceState<S, O, D>>&)> onCommit,
+    int maxLag) {
+  commit_callback = onCommit;
+  max_lag = maxLag;
+  // At most maxLag + 1 time steps are pending when a commit happens.
+  if (maxLag >= 0) {
+    commit_reversed.reserve(maxLag + 1);
+    commit_prefix.reserve(maxLag + 1);
   }
 }
 template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::SetPruning(int maxStates,
+                                           double logBeamWidth) {
+  max_states = maxStates;
+  log_beam_width = logBeamWidth;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::SetThreadPool(ThreadPool* threadPool,
+                                              size_t minParallelCandidates) {
+  thread_pool = threadPool;
+  min_parallel_candidates = minParallelCandidates;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::SetObserver(ViterbiObserver* stepObserver) {
+  observer = stepObserver;
+}
+template <typename S, typename O, typename D>
+size_t ViterbiAlgorithm<S, O, D>::PrunedStateCount() {
+  return pruned_state_count;
+}
+template <typename S, typename O, typename D>
 bool ViterbiAlgorithm<S, O, D>::processingStarted() {
   return message.size() > 0;
 }
 template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::Reset() {
+  lastExtendedStates.clear();
+  prevCandidates.clear();
+  message.clear();
+  message_history.Clear();
+  is_broken = false;
+  time_step = 0;
+  committed_time_step = -1;
+  pruned_state_count = 0;
+  state_table.Clear();
+  break_time_steps.clear();
+  finished_segments.clear();
+  extended_state_pool.Clear();
+}
+template <typename S, typename O, typename D>
 void ViterbiAlgorithm<S, O, D>::StartWithInitialStateProbabilities(
-    std::vector<S>& initialStates,
-    std::map<S, double>& initialLogProbabilities) {
-  initializeStateProbabilities(nullptr, initialStates, initialLogProbabilities);
+    const std::vector<S>& initialStates,
+    const std::map<S, double>& initialLogProbabilities) {
+  InitializeStateProbabilities(O(), initialStates, initialLogProbabilities);
 }
 template <typename S, typename O, typename D>
 void ViterbiAlgorithm<S, O, D>::StartWithInitialObservation(
-    O observation, std::vector<S>& candidates,
-    std::map<S, double>& emissionLogProbabilities) {
+    O observation, const std::vector<S>& candidates,
+    const std::map<S, double>& emissionLogProbabilities) {
   InitializeStateProbabilities(observation, candidates,
                                emissionLogProbabilities);
 }
 template <typename S, typename O, typename D>
 void ViterbiAlgorithm<S, O, D>::NextStep(
-    O observation, std::vector<S>& candidates,
-    std::map<S, double>& emissionLogProbabilities,
-    std::map<Transition<S>, double>& transitionLogProbabilities,
-    std::map<Transition<S>, D>& transitionDescriptors) {
-  if (is_broken) {
+    O observation, const std::vector<S>& candidates,
+    const std::map<S, double>& emissionLogProbabilities,
+    const std::map<Transition<S>, double>& transitionLogProbabilities,
+    const std::map<Transition<S>, D>& transitionDescriptors) {
+  NextStep(observation, candidates.data(), candidates.size(),
+           emissionLogProbabilities, transitionLogProbabilities,
+           transitionDescriptors);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::NextStep(
+    O observation, std::vector<S>&& candidates,
+    const std::map<S, double>& emissionLogProbabilities,
+    const std::map<Transition<S>, double>& transitionLogProbabilities,
+    const std::map<Transition<S>, D>& transitionDescriptors) {
+  if (is_broken && !break_recovery) {
+    return;
+  }
+  next_step.candidates.swap(candidates);
+  InternCandidates();
+  // Forward step
+  ForwardStep(observation, emissionLogProbabilities,
+              transitionLogProbabilities, &transitionDescriptors);
+  ApplyForwardStep(observation, emissionLogProbabilities);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::NextStep(
+    const O& observation, const S* candidates, size_t numCandidates,
+    const std::map<S, double>& emissionLogProbabilities,
+    const std::map<Transition<S>, double>& transitionLogProbabilities,
+    const std::map<Transition<S>, D>& transitionDescriptors) {
+  if (is_broken && !break_recovery) {
+    return;
+  }
+  next_step.candidates.assign(candidates, candidates + numCandidates);
+  InternCandidates();
+  // Forward step
+  ForwardStep(observation, emissionLogProbabilities,
+              transitionLogProbabilities, &transitionDescriptors);
+  ApplyForwardStep(observation, emissionLogProbabilities);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::NextStep(
+    O observation, const std::vector<S>& candidates,
+    const std::map<S, double>& emissionLogProbabilities,
+    std::function<double(const S&, const S&)> transitionLogProbability,
+    std::function<D(const S&, const S&)> transitionDescriptor) {
+  if (is_broken && !break_recovery) {
     return;
   }
+  next_step.candidates.assign(candidates.begin(), candidates.end());
+  InternCandidates();
   // Forward step
-  ForwardStepResult<S, O, D> forwardStepResult =
-      ForwardStep(observation, prevCandidates, candidates, message,
-                  emissionLogProbabilities, transitionLogProbabilities,
-                  transitionDescriptors);
-  is_broken = HMMBreak(forwardStepResult.newMessage);
+  LazyForwardStep(observation, emissionLogProbabilities,
+                  transitionLogProbability, transitionDescriptor);
+  ApplyForwardStep(observation, emissionLogProbabilities);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::SetBreakRecovery(bool breakRecovery) {
+  break_recovery = breakRecovery;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::ApplyForwardStep(
+    const O& observation, const std::map<S, double>& emissionLogProbabilities) {
+  time_step++;
+  is_broken = HMMBreak(next_step.newMessage);
   if (is_broken) {
+    for (auto es : next_step.newExtendedStates) {
+      ReleaseIfUnreferenced(es);
+    }
+    if (break_recovery) {
+      RecoverFromBreak(observation, emissionLogProbabilities);
+      CompactStateTable();
+    }
+    if (observer != nullptr) {
+      ReportStep();
+    }
     return;
   }
-  message_history.push_back(forwardStepResult.newMessage);
-  message = forwardStepResult.newMessage;
-  lastExtendedStates = forwardStepResult.newExtendedStates;
-  prevCandidates = std::vector<S>(candidates);  // Defensive copy.
+  if (keep_message_history) {
+    message_history.Append(next_step.candidates, next_step.newMessage);
+  }
+  // Back pointer chains which are not continued by any new state are
+  // released here.
+  for (auto es : next_step.newExtendedStates) {
+    if (es != nullptr) {
+      es->referenceCount++;
+    }
+  }
+  for (auto es : lastExtendedStates) {
+    Unreference(es);
+  }
+  // The buffers of the previous time step are reused by the next one.
+  message.swap(next_step.newMessage);
+  lastExtendedStates.swap(next_step.newExtendedStates);
+  prevCandidates.swap(next_step.handles);
+  PruneStates();
+  if (commit_callback) {
+    CommitFinalPrefix();
+  }
+  CompactStateTable();
+  if (observer != nullptr) {
+    ReportStep();
+  }
 }
 template <typename S, typename O, typename D>
 void ViterbiAlgorithm<S, O, D>::NextStep(
-    O observation, std::vector<S>& candidates,
-    std::map<S, double>& emissionLogProbabilities,
-    std::map<Transition<S>, double>& transitionLogProbabilities) {
-  std::map<Transition<S>, D> tempVar;
-  NextStep(observation, candidates, emissionLogProbabilities,
-           transitionLogProbabilities, tempVar);
+    O observation, const std::vector<S>& candidates,
+    const std::map<S, double>& emissionLogProbabilities,
+    const std::map<Transition<S>, double>& transitionLogProbabilities) {
+  if (is_broken && !break_recovery) {
+    return;
+  }
+  next_step.candidates.assign(candidates.begin(), candidates.end());
+  InternCandidates();
+  // Forward step
+  ForwardStep(observation, emissionLogProbabilities,
+              transitionLogProbabilities, nullptr);
+  ApplyForwardStep(observation, emissionLogProbabilities);
 }
 template <typename S, typename O, typename D>
 std::vector<SequenceState<S, O, D>>
@@ -96,163 +235,960 @@ ViterbiAlgorithm<S, O, D>::ComputeMostLikelySequence() {
   }
 }
 template <typename S, typename O, typename D>
+std::vector<SequenceSegment<S, O, D>>
+ViterbiAlgorithm<S, O, D>::ComputeMostLikelySegments() {
+  std::vector<SequenceSegment<S, O, D>> segments = finished_segments;
+  if (!message.empty()) {
+    SequenceSegment<S, O, D> segment;
+    // A segment is only running after a break if its restart succeeded.
+    segment.startTimeStep =
+        break_time_steps.empty() ? 0 : break_time_steps.back();
+    segment.sequence = RetrieveMostLikelySequence();
+    segments.push_back(segment);
+  }
+  return segments;
+}
+template <typename S, typename O, typename D>
+const std::vector<int>& ViterbiAlgorithm<S, O, D>::BreakTimeSteps() {
+  return break_time_steps;
+}
+template <typename S, typename O, typename D>
 bool ViterbiAlgorithm<S, O, D>::IsBroken() {
   return is_broken;
 }
 template <typename S, typename O, typename D>
-std::vector<std::map<S, double>> ViterbiAlgorithm<S, O, D>::MessageHistory() {
-  return message_history;
+size_t ViterbiAlgorithm<S, O, D>::LiveExtendedStateCount() {
+  return extended_state_pool.Size();
+}
+template <typename S, typename O, typename D>
+MessageHistoryView<S> ViterbiAlgorithm<S, O, D>::MessageHistory() {
+  return message_history.View();
 }
 template <typename S, typename O, typename D>
 std::string ViterbiAlgorithm<S, O, D>::MessageHistoryString() {
-  if (message_history.empty()) {
+  MessageHistoryView<S> history = message_history.View();
+  if (history.empty()) {
     return "";
   }
-  std::string sb;
-  sb.append("Message history with log probabilies\n\n");
-  int i = 0;
-  for (auto message : message_history) {
-    sb.append("Time step " + std::to_string(i) + "\n");
-    i++;
-    for (auto state : message) {
-      sb.append(state.first + L": " + message.get(state.first) + L"\n");
+  std::ostringstream sb;
+  sb << "Message history with log probabilies\n\n";
+  for (size_t t = 0; t < history.size(); ++t) {
+    sb << "Time step " << t << "\n";
+    MessageView<S> message = history[t];
+    for (size_t i = 0; i < message.size(); ++i) {
+      sb << message.State(i) << ": " << message.LogProbability(i) << "\n";
+    }
+    sb << "\n";
+  }
+  return sb.str();
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::SaveSnapshot(std::string& snapshot) {
+  // Nodes are numbered so that back pointers always refer to a smaller
+  // index: chains are walked back from the last states up to a node that
+  // already has an index and then numbered from their oldest node on.
+  snapshot_nodes.clear();
+  snapshot_indices.clear();
+  for (auto es : lastExtendedStates) {
+    snapshot_path.clear();
+    for (; es != nullptr && snapshot_indices.count(es) == 0;
+         es = es->backPointer) {
+      snapshot_path.push_back(es);
+    }
+    for (auto node = snapshot_path.rbegin(); node != snapshot_path.rend();
+         ++node) {
+      snapshot_indices[*node] = (int32_t)snapshot_nodes.size();
+      snapshot_nodes.push_back(*node);
+    }
+  }
+
+  snapshot.clear();
+  SnapshotWriter writer(snapshot);
+  writer.WriteBytes(kSnapshotMagic, 4);
+  writer.WriteUint32(kSnapshotVersion);
+  writer.WriteUint32(is_broken ? 1 : 0);
+  writer.WriteInt32(time_step);
+  writer.WriteInt32(committed_time_step);
+  writer.WriteUint32((uint32_t)snapshot_nodes.size());
+  for (auto es : snapshot_nodes) {
+    writer.WriteInt32(es->backPointer == nullptr
+                          ? -1
+                          : snapshot_indices[es->backPointer]);
+    writer.WriteInt32(es->timeStep);
+    SnapshotTraits<S>::Write(state_table.State(es->state), writer);
+    SnapshotTraits<O>::Write(es->observation, writer);
+    SnapshotTraits<D>::Write(es->transitionDescriptor, writer);
+  }
+  writer.WriteUint32((uint32_t)prevCandidates.size());
+  for (size_t i = 0; i < prevCandidates.size(); ++i) {
+    SnapshotTraits<S>::Write(state_table.State(prevCandidates[i]), writer);
+    SnapshotTraits<double>::Write(message[i], writer);
+    writer.WriteInt32(lastExtendedStates[i] == nullptr
+                          ? -1
+                          : snapshot_indices[lastExtendedStates[i]]);
+  }
+  SnapshotTraits<uint64_t>::Write(pruned_state_count, writer);
+  writer.WriteUint32((uint32_t)break_time_steps.size());
+  for (auto breakTimeStep : break_time_steps) {
+    writer.WriteInt32(breakTimeStep);
+  }
+  writer.WriteUint32((uint32_t)finished_segments.size());
+  for (auto& segment : finished_segments) {
+    writer.WriteInt32(segment.startTimeStep);
+    writer.WriteUint32((uint32_t)segment.sequence.size());
+    for (auto& ss : segment.sequence) {
+      SnapshotTraits<S>::Write(ss.state, writer);
+      SnapshotTraits<O>::Write(ss.observation, writer);
+      SnapshotTraits<D>::Write(ss.transitionDescriptor, writer);
     }
-    sb.append("\n");
   }
-  return sb;
 }
 template <typename S, typename O, typename D>
-bool ViterbiAlgorithm<S, O, D>::HMMBreak(const std::map<S, double>& message) {
+bool ViterbiAlgorithm<S, O, D>::RestoreSnapshot(const std::string& snapshot) {
+  Reset();
+  SnapshotReader reader(snapshot.data(), snapshot.size());
+  if (!ReadSnapshot(reader)) {
+    Reset();
+    return false;
+  }
+  return true;
+}
+template <typename S, typename O, typename D>
+bool ViterbiAlgorithm<S, O, D>::ReadSnapshot(SnapshotReader& reader) {
+  char magic[4];
+  uint32_t version;
+  uint32_t broken;
+  if (!reader.ReadBytes(magic, 4) || memcmp(magic, kSnapshotMagic, 4) != 0 ||
+      !reader.ReadUint32(version) || version != kSnapshotVersion ||
+      !reader.ReadUint32(broken) || !reader.ReadInt32(time_step) ||
+      !reader.ReadInt32(committed_time_step) || time_step < 0 ||
+      committed_time_step < -1 || committed_time_step > time_step) {
+    return false;
+  }
+  is_broken = broken != 0;
+  uint32_t numNodes;
+  if (!reader.ReadUint32(numNodes)) {
+    return false;
+  }
+  snapshot_nodes.clear();
+  for (uint32_t i = 0; i < numNodes; ++i) {
+    int32_t backPointer;
+    int32_t timeStep;
+    S state;
+    O observation;
+    D transitionDescriptor;
+    if (!reader.ReadInt32(backPointer) || !reader.ReadInt32(timeStep) ||
+        backPointer < -1 || backPointer >= (int32_t)i ||
+        !SnapshotTraits<S>::Read(reader, state) ||
+        !SnapshotTraits<O>::Read(reader, observation) ||
+        !SnapshotTraits<D>::Read(reader, transitionDescriptor)) {
+      return false;
+    }
+    ExtendedState<S, O, D>* const back =
+        backPointer < 0 ? nullptr : snapshot_nodes[backPointer];
+    // Time steps grow by one along a chain and end at the current one.
+    if (timeStep > time_step ||
+        (back == nullptr ? timeStep < 0 : timeStep != back->timeStep + 1)) {
+      return false;
+    }
+    ExtendedState<S, O, D>* const es = extended_state_pool.Allocate(
+        state_table.Intern(state), back, observation, transitionDescriptor);
+    es->timeStep = timeStep;
+    if (back != nullptr) {
+      back->referenceCount++;
+    }
+    snapshot_nodes.push_back(es);
+  }
+  uint32_t numCandidates;
+  if (!reader.ReadUint32(numCandidates)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numCandidates; ++i) {
+    S candidate;
+    double logProbability;
+    int32_t node;
+    if (!SnapshotTraits<S>::Read(reader, candidate) ||
+        !SnapshotTraits<double>::Read(reader, logProbability) ||
+        !reader.ReadInt32(node) || node < -1 || node >= (int32_t)numNodes) {
+      return false;
+    }
+    ExtendedState<S, O, D>* const es =
+        node < 0 ? nullptr : snapshot_nodes[node];
+    if (es != nullptr) {
+      es->referenceCount++;
+    }
+    prevCandidates.push_back(state_table.Intern(candidate));
+    message.push_back(logProbability);
+    lastExtendedStates.push_back(es);
+  }
+  // Every node must lie on the chain of a candidate.
+  for (auto es : snapshot_nodes) {
+    if (es->referenceCount == 0) {
+      return false;
+    }
+  }
+  uint64_t prunedStateCount;
+  if (!SnapshotTraits<uint64_t>::Read(reader, prunedStateCount)) {
+    return false;
+  }
+  pruned_state_count = (size_t)prunedStateCount;
+  uint32_t numBreakTimeSteps;
+  if (!reader.ReadUint32(numBreakTimeSteps)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numBreakTimeSteps; ++i) {
+    int32_t breakTimeStep;
+    if (!reader.ReadInt32(breakTimeStep)) {
+      return false;
+    }
+    break_time_steps.push_back(breakTimeStep);
+  }
+  uint32_t numSegments;
+  if (!reader.ReadUint32(numSegments)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numSegments; ++i) {
+    SequenceSegment<S, O, D> segment;
+    uint32_t length;
+    if (!reader.ReadInt32(segment.startTimeStep) ||
+        !reader.ReadUint32(length)) {
+      return false;
+    }
+    for (uint32_t k = 0; k < length; ++k) {
+      S state;
+      O observation;
+      D transitionDescriptor;
+      if (!SnapshotTraits<S>::Read(reader, state) ||
+          !SnapshotTraits<O>::Read(reader, observation) ||
+          !SnapshotTraits<D>::Read(reader, transitionDescriptor)) {
+        return false;
+      }
+      segment.sequence.push_back(SequenceState<S, O, D>(
+          state, observation, transitionDescriptor));
+    }
+    finished_segments.push_back(segment);
+  }
+  return reader.Remaining() == 0;
+}
+template <typename S, typename O, typename D>
+bool ViterbiAlgorithm<S, O, D>::HMMBreak(const std::vector<double>& message) {
   for (auto logProbability : message) {
-    if (logProbability.second != -std::numeric_limits<double>::infinity()) {
+    if (logProbability != -std::numeric_limits<double>::infinity()) {
       return false;
     }
   }
   return true;
 }
 template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::Unreference(
+    ExtendedState<S, O, D>* extendedState) {
+  if (extendedState == nullptr) {
+    return;
+  }
+  extendedState->referenceCount--;
+  ReleaseIfUnreferenced(extendedState);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::ReleaseIfUnreferenced(
+    ExtendedState<S, O, D>* extendedState) {
+  while (extendedState != nullptr && extendedState->referenceCount == 0) {
+    ExtendedState<S, O, D>* const backPointer = extendedState->backPointer;
+    extended_state_pool.Release(extendedState);
+    if (backPointer != nullptr) {
+      backPointer->referenceCount--;
+    }
+    extendedState = backPointer;
+  }
+}
+template <typename S, typename O, typename D>
 void ViterbiAlgorithm<S, O, D>::InitializeStateProbabilities(
-    O observation, std::vector<S>& candidates,
-    std::map<S, double>& initialLogProbabilities) {
+    const O& observation, const std::vector<S>& candidates,
+    const std::map<S, double>& initialLogProbabilities) {
   if (!message.empty()) {
     return;
   }
 
   // Set initial log probability for each start state candidate based on first
-  // observation. Do not assign initialLogProbabilities directly to message to
-  // not rely on its iteration order.
-  std::map<S, double> initialMessage;
-  for (auto candidate : candidates) {
+  // observation.
+  next_step.candidates.assign(candidates.begin(), candidates.end());
+  InternCandidates();
+  next_step.newMessage.clear();
+  for (auto& candidate : next_step.candidates) {
     auto search = initialLogProbabilities.find(candidate);
     if (search == initialLogProbabilities.end()) {
       printf("ERR: No initial probability for a candidate\n");
       return;
     }
-    const double logProbability = initialLogProbabilities[candidate];
-    auto rst = initialMessage.emplace(candidate, logProbability);
-    if (!rst.second) {
-      printf("ERR: initialMessage emplace failed, key is already exists.\n");
-    }
+    next_step.newMessage.push_back(search->second);
+  }
+  if (observer != nullptr) {
+    step_metrics = ViterbiStepMetrics();
+    step_metrics.numCandidates = next_step.candidates.size();
   }
-  is_broken = HMMBreak(initialMessage);
+  time_step = 0;
+  is_broken = HMMBreak(next_step.newMessage);
   if (is_broken) {
     printf("ERR: HMM Break\n");
+    if (break_recovery) {
+      break_time_steps.push_back(time_step);
+    }
+    if (observer != nullptr) {
+      ReportStep();
+    }
+    return;
+  }
+  if (keep_message_history) {
+    message_history.Append(next_step.candidates, next_step.newMessage);
+  }
+  message.swap(next_step.newMessage);
+  prevCandidates.swap(next_step.handles);
+  lastExtendedStates.clear();
+  for (auto candidate : prevCandidates) {
+    auto es = extended_state_pool.Allocate(candidate, nullptr, observation, D());
+    es->referenceCount++;
+    lastExtendedStates.push_back(es);
+  }
+  PruneStates();
+  if (commit_callback) {
+    CommitFinalPrefix();
+  }
+  if (observer != nullptr) {
+    ReportStep();
+  }
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::RecoverFromBreak(
+    const O& observation, const std::map<S, double>& emissionLogProbabilities) {
+  break_time_steps.push_back(time_step);
+  // Finish the current segment, unless a previous restart failed.
+  if (!message.empty()) {
+    const int lastState = MostLikelyStateIndex();
+    if (commit_callback) {
+      Commit(lastExtendedStates[lastState]);
+    } else {
+      SequenceSegment<S, O, D> segment;
+      segment.startTimeStep =
+          break_time_steps.size() > 1
+              ? break_time_steps[break_time_steps.size() - 2]
+              : 0;
+      segment.sequence = RetrieveMostLikelySequence();
+      finished_segments.push_back(segment);
+    }
+  }
+  for (auto es : lastExtendedStates) {
+    Unreference(es);
+  }
+  lastExtendedStates.clear();
+  message.clear();
+  prevCandidates.clear();
+
+  // Restart with the emissions as initial log probabilities. A missing
+  // emission probability counts as log probability 0, as in ForwardStep().
+  for (size_t c = 0; c < next_step.candidates.size(); ++c) {
+    auto emission = emissionLogProbabilities.find(next_step.candidates[c]);
+    next_step.newMessage[c] =
+        emission == emissionLogProbabilities.end() ? 0.0 : emission->second;
+  }
+  if (HMMBreak(next_step.newMessage)) {
     return;
   }
-  message = initialMessage;
-  message_history.push_back(message);
-  // lastExtendedStates = new std::map<S, ExtendedState<S, O, D>*>();
-  for (auto candidate : candidates) {
-    auto tempVar =
-        new ExtendedState<S, O, D>(candidate, nullptr, observation, D());
-    auto rst = lastExtendedStates.emplace(candidate, tempVar);
-    if (!rst.second) {
-      printf("ERR: lastExtendedStates emplace failed, key is already exists.\n");
+  if (keep_message_history) {
+    message_history.Append(next_step.candidates, next_step.newMessage);
+  }
+  message.swap(next_step.newMessage);
+  prevCandidates.swap(next_step.handles);
+  for (size_t c = 0; c < prevCandidates.size(); ++c) {
+    ExtendedState<S, O, D>* es = nullptr;
+    if (message[c] != -std::numeric_limits<double>::infinity()) {
+      es = extended_state_pool.Allocate(prevCandidates[c], nullptr, observation,
+                                        D());
+      es->timeStep = time_step;
+      es->referenceCount++;
+    }
+    lastExtendedStates.push_back(es);
+  }
+  PruneStates();
+  if (commit_callback) {
+    // Everything before the restart has been committed or dropped. Without
+    // this, a failed restart or an initial break would leave
+    // committed_time_step behind and force a commit before the new roots.
+    committed_time_step = time_step - 1;
+    CommitFinalPrefix();
+  }
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::InternCandidates() {
+  std::vector<S>& candidates = next_step.candidates;
+  std::vector<StateHandle>& handles = next_step.handles;
+  handles.resize(candidates.size());
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    // Candidates mostly repeat from one time step to the next.
+    handles[c] = state_table.Intern(
+        candidates[c],
+        c < prevCandidates.size() ? prevCandidates[c] : kNoStateHandle);
+  }
+  // Duplicates are found by handle, so that states are not sorted.
+  if (handle_cur_index.size() < state_table.Size()) {
+    handle_cur_index.resize(state_table.Size(), -1);
+  }
+  size_t kept = 0;
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    if (handle_cur_index[handles[c]] >= 0) {
+      continue;
     }
+    handle_cur_index[handles[c]] = (int)kept;
+    if (kept != c) {
+      candidates[kept] = candidates[c];
+      handles[kept] = handles[c];
+    }
+    ++kept;
+  }
+  for (size_t c = 0; c < kept; ++c) {
+    handle_cur_index[handles[c]] = -1;
+  }
+  if (kept < candidates.size()) {
+    printf("ERR: duplicate candidates are ignored.\n");
+    candidates.erase(candidates.begin() + kept, candidates.end());
+    handles.resize(kept);
   }
-  prevCandidates = std::vector<S>(candidates);  // Defensive copy.
 }
 template <typename S, typename O, typename D>
-ForwardStepResult<S, O, D> ViterbiAlgorithm<S, O, D>::ForwardStep(
-    O observation, std::vector<S>& prevCandidates,
-    std::vector<S>& curCandidates, std::map<S, double>& message,
-    std::map<S, double>& emissionLogProbabilities,
-    std::map<Transition<S>, double>& transitionLogProbabilities,
-    std::map<Transition<S>, D>& transitionDescriptors) {
-  ForwardStepResult<S, O, D>* result =
-      new ForwardStepResult<S, O, D>((int)curCandidates.size());
+template <typename V, typename F>
+void ViterbiAlgorithm<S, O, D>::ForEachStepTransition(
+    const std::map<Transition<S>, V>& transitions, F f) {
+  if (handle_prev_index.size() < state_table.Size()) {
+    handle_prev_index.resize(state_table.Size(), -1);
+  }
+  if (handle_cur_index.size() < state_table.Size()) {
+    handle_cur_index.resize(state_table.Size(), -1);
+  }
+  for (size_t p = 0; p < prevCandidates.size(); ++p) {
+    handle_prev_index[prevCandidates[p]] = (int)p;
+  }
+  for (size_t c = 0; c < next_step.handles.size(); ++c) {
+    handle_cur_index[next_step.handles[c]] = (int)c;
+  }
+  // Transitions are sorted by source, and the sources mostly share their
+  // targets. So the last source and the target at the same position for the
+  // previous source are tried first.
+  transition_hints.clear();
+  StateHandle source = kNoStateHandle;
+  size_t position = 0;
+  for (auto& transition : transitions) {
+    const StateHandle from =
+        state_table.Find(transition.first.fromCandidate, source);
+    if (from != source) {
+      source = from;
+      position = 0;
+    }
+    if (from == kNoStateHandle || handle_prev_index[from] < 0) {
+      continue;
+    }
+    const StateHandle hint = position < transition_hints.size()
+                                 ? transition_hints[position]
+                                 : kNoStateHandle;
+    const StateHandle to = state_table.Find(transition.first.toCandidate, hint);
+    if (position < transition_hints.size()) {
+      transition_hints[position] = to;
+    } else {
+      transition_hints.push_back(to);
+    }
+    ++position;
+    if (to != kNoStateHandle && handle_cur_index[to] >= 0) {
+      f((size_t)handle_cur_index[to], (size_t)handle_prev_index[from],
+        transition.second);
+    }
+  }
+  for (auto handle : prevCandidates) {
+    handle_prev_index[handle] = -1;
+  }
+  for (auto handle : next_step.handles) {
+    handle_cur_index[handle] = -1;
+  }
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::CompactStateTable() {
+  // Amortized constant time per interned state.
+  const size_t liveHandles = extended_state_pool.Size() + prevCandidates.size();
+  if (state_table.Size() < 2 * liveHandles + 1024) {
+    return;
+  }
+  StateInterner<S> compacted;
+  state_table_remap.assign(state_table.Size(), kNoStateHandle);
+  auto remap = [&](StateHandle handle) {
+    if (state_table_remap[handle] == kNoStateHandle) {
+      state_table_remap[handle] = compacted.Intern(state_table.State(handle));
+    }
+    return state_table_remap[handle];
+  };
+  for (auto& candidate : prevCandidates) {
+    candidate = remap(candidate);
+  }
+  extended_state_pool.ForEach(
+      [&](ExtendedState<S, O, D>* es) { es->state = remap(es->state); });
+  state_table = std::move(compacted);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::ForwardStep(
+    const O& observation,
+    const std::map<S, double>& emissionLogProbabilities,
+    const std::map<Transition<S>, double>& transitionLogProbabilities,
+    const std::map<Transition<S>, D>* transitionDescriptors) {
+  const std::vector<S>& curCandidates = next_step.candidates;
+  const size_t numCurCandidates = curCandidates.size();
+  const size_t numPrevCandidates = prevCandidates.size();
+  max_prev_indices.resize(numCurCandidates);
+  max_log_probabilities.resize(numCurCandidates);
+  // Maps that are not much larger than the step are walked once into a
+  // cache by candidate, instead of looking up every pair of candidates with
+  // copies and comparisons of the states.
+  const size_t numPairs = numPrevCandidates * numCurCandidates;
+  const bool cached = transitionLogProbabilities.size() / 4 <= numPairs;
+  if (cached) {
+    transition_cache.assign(numPairs,
+                            -std::numeric_limits<double>::infinity());
+    ForEachStepTransition(transitionLogProbabilities,
+                          [this, numPrevCandidates](size_t c, size_t p,
+                                                    double logProbability) {
+                            transition_cache[c * numPrevCandidates + p] =
+                                logProbability;
+                          });
+  }
+  const bool cachedDescriptors = transitionDescriptors != nullptr &&
+                                 transitionDescriptors->size() / 4 <= numPairs;
+  if (cachedDescriptors) {
+    descriptor_cache.assign(numPairs, nullptr);
+    ForEachStepTransition(*transitionDescriptors,
+                          [this, numPrevCandidates](size_t c, size_t p,
+                                                    const D& descriptor) {
+                            descriptor_cache[c * numPrevCandidates + p] =
+                                &descriptor;
+                          });
+  }
+  const bool parallel =
+      thread_pool != nullptr && numCurCandidates >= min_parallel_candidates;
+  // Ranges of candidates only read shared state, so they may run
+  // concurrently. Missing transitions are only counted for an observer.
+  std::chrono::steady_clock::time_point start;
+  if (observer == nullptr) {
+    auto findMaxPrevStates = [&](size_t begin, size_t end) {
+      FindMaxPrevStates<false>(begin, end, transitionLogProbabilities,
+                               cached);
+    };
+    if (parallel) {
+      thread_pool->ParallelFor(numCurCandidates,
+                               thread_pool->GrainSize(numCurCandidates, 16),
+                               findMaxPrevStates);
+    } else {
+      findMaxPrevStates(0, numCurCandidates);
+    }
+  } else {
+    start = std::chrono::steady_clock::now();
+    std::atomic<size_t> missingTransitions(0);
+    auto findMaxPrevStates = [&](size_t begin, size_t end) {
+      missingTransitions += FindMaxPrevStates<true>(
+          begin, end, transitionLogProbabilities, cached);
+    };
+    if (parallel) {
+      thread_pool->ParallelFor(numCurCandidates,
+                               thread_pool->GrainSize(numCurCandidates, 16),
+                               findMaxPrevStates);
+    } else {
+      findMaxPrevStates(0, numCurCandidates);
+    }
+    step_metrics = ViterbiStepMetrics();
+    step_metrics.numPrevCandidates = prevCandidates.size();
+    step_metrics.numCandidates = numCurCandidates;
+    step_metrics.evaluatedTransitions =
+        prevCandidates.size() * numCurCandidates;
+    step_metrics.missingTransitions = missingTransitions;
+  }
 
-  for (auto curState : curCandidates) {
-    //double maxLogProbability = -1000;//-std::numeric_limits<double>::infinity();
+  next_step.newMessage.resize(numCurCandidates);
+  next_step.newExtendedStates.assign(numCurCandidates, nullptr);
+  for (size_t c = 0; c < numCurCandidates; ++c) {
+    const S& curState = curCandidates[c];
+    const int maxPrevIndex = max_prev_indices[c];
+    // A missing emission probability counts as log probability 0.
+    auto emission = emissionLogProbabilities.find(curState);
+    const double curLogProbability =
+        emission == emissionLogProbabilities.end()
+            ? max_log_probabilities[c]
+            : max_log_probabilities[c] + emission->second;
+    next_step.newMessage[c] = curLogProbability;
+    // Note that maxPrevIndex < 0 if there is no transition with non-zero
+    // probability. In this case curState has zero probability and will not be
+    // part of the most likely sequence, so we don't need an ExtendedState.
+    // The same holds if the emission probability of curState is zero.
+    if (maxPrevIndex >= 0 &&
+        curLogProbability != -std::numeric_limits<double>::infinity()) {
+      D transitionDescriptor = D();
+      if (cachedDescriptors) {
+        const D* const found =
+            descriptor_cache[c * numPrevCandidates + maxPrevIndex];
+        if (found != nullptr) {
+          transitionDescriptor = *found;
+        }
+      } else if (transitionDescriptors != nullptr) {
+        const S& prevState = state_table.State(prevCandidates[maxPrevIndex]);
+        auto found =
+            transitionDescriptors->find(Transition<S>(prevState, curState));
+        if (found != transitionDescriptors->end()) {
+          transitionDescriptor = found->second;
+        }
+      }
+      ExtendedState<S, O, D>* const backPointer =
+          lastExtendedStates[maxPrevIndex];
+      ExtendedState<S, O, D>* const extendedState =
+          extended_state_pool.Allocate(next_step.handles[c], backPointer,
+                                       observation, transitionDescriptor);
+      if (backPointer != nullptr) {
+        backPointer->referenceCount++;
+      }
+      next_step.newExtendedStates[c] = extendedState;
+    }
+  }
+  if (observer != nullptr) {
+    step_metrics.forwardStepSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start)
+            .count();
+  }
+}
+template <typename S, typename O, typename D>
+template <bool kCountMissing>
+size_t ViterbiAlgorithm<S, O, D>::FindMaxPrevStates(
+    size_t begin, size_t end,
+    const std::map<Transition<S>, double>& transitionLogProbabilities,
+    bool cached) {
+  const std::vector<S>& curCandidates = next_step.candidates;
+  const size_t numPrevCandidates = prevCandidates.size();
+  size_t missingTransitions = 0;
+  for (size_t c = begin; c < end; ++c) {
+    const double* const cachedRow =
+        cached ? transition_cache.data() + c * numPrevCandidates : nullptr;
     double maxLogProbability = -std::numeric_limits<double>::infinity();
-    S* maxPrevState = nullptr;
-    for (auto& prevState : prevCandidates) {
-      double logProbability =
-          message[prevState] +
-          TransitionLogProbability(prevState, curState,
-                                   transitionLogProbabilities);
+    int maxPrevIndex = -1;
+    for (size_t p = 0; p < numPrevCandidates; ++p) {
+      const double transitionLogProbability =
+          cached ? cachedRow[p]
+                 : TransitionLogProbability(
+                       state_table.State(prevCandidates[p]), curCandidates[c],
+                       transitionLogProbabilities);
+      if (kCountMissing && transitionLogProbability ==
+                               -std::numeric_limits<double>::infinity()) {
+        missingTransitions++;
+      }
+      double logProbability = message[p] + transitionLogProbability;
       if (logProbability > maxLogProbability) {
         maxLogProbability = logProbability;
-        maxPrevState = &prevState;
+        maxPrevIndex = (int)p;
       }
     }
-    // Throws NullPointerException if curState is not stored in the map.
-    //printf("gpsmsmt maxLogProbability: %f\n", maxLogProbability);
-    auto rst = result->newMessage.emplace(curState,
-        maxLogProbability + emissionLogProbabilities[curState]);
-    if (!rst.second) {
-      printf("ERR: ForwardStep newMessage emplace failed, key is already exists.\n");
+    max_log_probabilities[c] = maxLogProbability;
+    max_prev_indices[c] = maxPrevIndex;
+  }
+  return missingTransitions;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::LazyForwardStep(
+    const O& observation,
+    const std::map<S, double>& emissionLogProbabilities,
+    std::function<double(const S&, const S&)>& transitionLogProbability,
+    std::function<D(const S&, const S&)>& transitionDescriptor) {
+  const std::vector<S>& curCandidates = next_step.candidates;
+  std::chrono::steady_clock::time_point start;
+  if (observer != nullptr) {
+    start = std::chrono::steady_clock::now();
+  }
+  size_t evaluatedTransitions = 0;
+  size_t missingTransitions = 0;
+  // Best previous candidates first, ties by candidate order.
+  lazy_order.clear();
+  for (size_t p = 0; p < prevCandidates.size(); ++p) {
+    if (message[p] != -std::numeric_limits<double>::infinity()) {
+      lazy_order.push_back(std::make_pair(message[p], p));
+    }
+  }
+  std::sort(lazy_order.begin(), lazy_order.end(),
+            [](const std::pair<double, size_t>& lhs,
+               const std::pair<double, size_t>& rhs) {
+              return lhs.first > rhs.first ||
+                     (lhs.first == rhs.first && lhs.second < rhs.second);
+            });
+
+  next_step.newMessage.resize(curCandidates.size());
+  next_step.newExtendedStates.assign(curCandidates.size(), nullptr);
+  for (size_t c = 0; c < curCandidates.size(); ++c) {
+    const S& curState = curCandidates[c];
+    double maxLogProbability = -std::numeric_limits<double>::infinity();
+    size_t maxPrevIndex = prevCandidates.size();
+    for (auto& entry : lazy_order) {
+      // Transition log probabilities are <= 0, so this and all following
+      // previous candidates can at most tie with the best one, and ties go to
+      // the first previous candidate.
+      if (entry.first < maxLogProbability ||
+          (entry.first == maxLogProbability && entry.second > maxPrevIndex)) {
+        break;
+      }
+      const double transition = transitionLogProbability(
+          state_table.State(prevCandidates[entry.second]), curState);
+      evaluatedTransitions++;
+      if (transition == -std::numeric_limits<double>::infinity()) {
+        missingTransitions++;
+      }
+      const double logProbability = entry.first + transition;
+      if (logProbability > maxLogProbability ||
+          (logProbability == maxLogProbability &&
+           entry.second < maxPrevIndex)) {
+        maxLogProbability = logProbability;
+        maxPrevIndex = entry.second;
+      }
     }
-    // Note that maxPrevState == null if there is no transition with non-zero
-    // probability. In this case curState has zero probability and will not be
-    // part of the most likely sequence, so we don't need an ExtendedState.
-    if (maxPrevState != nullptr) {
-      Transition<S>* const transition =
-          new Transition<S>(*maxPrevState, curState);
-      ExtendedState<S, O, D>* const extendedState = new ExtendedState<S, O, D>(
-          curState, lastExtendedStates[*maxPrevState], observation,
-          transitionDescriptors[*transition]);
-      auto rst = result->newExtendedStates.emplace(curState, extendedState);
-      if (!rst.second) {
-        printf("ERR: ForwardStep newExtendedStates emplace failed, key is already exists.\n");
+    auto emission = emissionLogProbabilities.find(curState);
+    const double curLogProbability =
+        emission == emissionLogProbabilities.end()
+            ? maxLogProbability
+            : maxLogProbability + emission->second;
+    next_step.newMessage[c] = curLogProbability;
+    if (maxPrevIndex < prevCandidates.size() &&
+        curLogProbability != -std::numeric_limits<double>::infinity()) {
+      const S& prevState = state_table.State(prevCandidates[maxPrevIndex]);
+      ExtendedState<S, O, D>* const backPointer =
+          lastExtendedStates[maxPrevIndex];
+      ExtendedState<S, O, D>* const extendedState =
+          extended_state_pool.Allocate(
+              next_step.handles[c], backPointer, observation,
+              transitionDescriptor ? transitionDescriptor(prevState, curState)
+                                   : D());
+      if (backPointer != nullptr) {
+        backPointer->referenceCount++;
       }
+      next_step.newExtendedStates[c] = extendedState;
     }
   }
-  return *result;
+  if (observer != nullptr) {
+    step_metrics = ViterbiStepMetrics();
+    step_metrics.numPrevCandidates = prevCandidates.size();
+    step_metrics.numCandidates = curCandidates.size();
+    step_metrics.evaluatedTransitions = evaluatedTransitions;
+    step_metrics.missingTransitions = missingTransitions;
+    step_metrics.forwardStepSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start)
+            .count();
+  }
 }
 template <typename S, typename O, typename D>
 double ViterbiAlgorithm<S, O, D>::TransitionLogProbability(
-    S prevState, S curState,
-    std::map<Transition<S>, double>& transitionLogProbabilities) {
-  auto key = Transition<S>(prevState, curState);
-  auto found = transitionLogProbabilities.find(key);
+    const S& prevState, const S& curState,
+    const std::map<Transition<S>, double>& transitionLogProbabilities) {
+  auto found =
+      transitionLogProbabilities.find(Transition<S>(prevState, curState));
   if (found == transitionLogProbabilities.end()) {
     // Transition has zero probability.
     return -std::numeric_limits<double>::infinity();
   }
-  return transitionLogProbabilities[key];
+  return found->second;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::PruneStates() {
+  if (max_states <= 0 &&
+      log_beam_width == std::numeric_limits<double>::infinity()) {
+    return;
+  }
+  double maxLogProbability = -std::numeric_limits<double>::infinity();
+  for (auto logProbability : message) {
+    maxLogProbability = std::max(maxLogProbability, logProbability);
+  }
+  const double threshold = maxLogProbability - log_beam_width;
+  pruning_order.clear();
+  for (size_t i = 0; i < prevCandidates.size(); ++i) {
+    if (message[i] != -std::numeric_limits<double>::infinity() &&
+        message[i] >= threshold) {
+      pruning_order.push_back(std::make_pair(message[i], i));
+    }
+  }
+  if (max_states > 0 && pruning_order.size() > (size_t)max_states) {
+    // Best first, ties by candidate order.
+    std::nth_element(pruning_order.begin(),
+                     pruning_order.begin() + max_states, pruning_order.end(),
+                     [](const std::pair<double, size_t>& lhs,
+                        const std::pair<double, size_t>& rhs) {
+                       return lhs.first > rhs.first ||
+                              (lhs.first == rhs.first &&
+                               lhs.second < rhs.second);
+                     });
+    pruning_order.resize(max_states);
+  }
+  pruning_keep.assign(prevCandidates.size(), false);
+  for (auto& entry : pruning_order) {
+    pruning_keep[entry.second] = true;
+  }
+  int pruned = 0;
+  size_t kept = 0;
+  for (size_t i = 0; i < prevCandidates.size(); ++i) {
+    if (pruning_keep[i]) {
+      prevCandidates[kept] = prevCandidates[i];
+      message[kept] = message[i];
+      lastExtendedStates[kept] = lastExtendedStates[i];
+      kept++;
+      continue;
+    }
+    pruned++;
+    Unreference(lastExtendedStates[i]);
+  }
+  prevCandidates.erase(prevCandidates.begin() + kept, prevCandidates.end());
+  message.resize(kept);
+  lastExtendedStates.resize(kept);
+  pruned_state_count += pruned;
+  step_metrics.prunedStates = pruned;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::CommitFinalPrefix() {
+  ExtendedState<S, O, D>* const commonAncestor = ConvergencePoint();
+  if (commonAncestor != nullptr) {
+    Commit(commonAncestor);
+  }
+  if (max_lag < 0) {
+    return;
+  }
+  int lastTimeStep = -1;
+  for (auto es : lastExtendedStates) {
+    if (es != nullptr) {
+      lastTimeStep = es->timeStep;
+      break;
+    }
+  }
+  if (lastTimeStep < 0 || lastTimeStep - committed_time_step <= max_lag) {
+    return;
+  }
+  // Force a commit at the most likely sequence and drop all states which do
+  // not extend it.
+  const int commitTimeStep = lastTimeStep - max_lag;
+  // Chains end at the last commit or at the roots of a segment, see
+  // SetBreakRecovery().
+  ExtendedState<S, O, D>* head = lastExtendedStates[MostLikelyStateIndex()];
+  while (head->timeStep > commitTimeStep && head->backPointer != nullptr) {
+    head = head->backPointer;
+  }
+  for (size_t i = 0; i < lastExtendedStates.size(); ++i) {
+    ExtendedState<S, O, D>* es = lastExtendedStates[i];
+    if (es == nullptr) {
+      continue;
+    }
+    while (es->timeStep > commitTimeStep && es->backPointer != nullptr) {
+      es = es->backPointer;
+    }
+    if (es != head) {
+      message[i] = -std::numeric_limits<double>::infinity();
+      Unreference(lastExtendedStates[i]);
+      lastExtendedStates[i] = nullptr;
+    }
+  }
+  Commit(head);
+}
+template <typename S, typename O, typename D>
+ExtendedState<S, O, D>* ViterbiAlgorithm<S, O, D>::ConvergencePoint() {
+  convergence_frontier.clear();
+  for (auto es : lastExtendedStates) {
+    if (es != nullptr) {
+      convergence_frontier.push_back(es);
+    }
+  }
+  // Walks all chains back in lockstep until they meet.
+  while (!convergence_frontier.empty()) {
+    std::sort(convergence_frontier.begin(), convergence_frontier.end());
+    convergence_frontier.erase(
+        std::unique(convergence_frontier.begin(), convergence_frontier.end()),
+        convergence_frontier.end());
+    if (convergence_frontier.size() == 1) {
+      return convergence_frontier[0];
+    }
+    int maxTimeStep = -1;
+    for (auto es : convergence_frontier) {
+      maxTimeStep = std::max(maxTimeStep, es->timeStep);
+    }
+    // Chains can only meet at or before the last commit.
+    if (maxTimeStep <= committed_time_step + 1) {
+      return nullptr;
+    }
+    for (auto& es : convergence_frontier) {
+      if (es->timeStep == maxTimeStep) {
+        es = es->backPointer;
+        if (es == nullptr) {
+          // Chains start at different initial states.
+          return nullptr;
+        }
+      }
+    }
+  }
+  return nullptr;
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::Commit(ExtendedState<S, O, D>* head) {
+  if (head->timeStep <= committed_time_step) {
+    return;
+  }
+  commit_reversed.clear();
+  for (ExtendedState<S, O, D>* es = head;
+       es != nullptr && es->timeStep > committed_time_step;
+       es = es->backPointer) {
+    commit_reversed.push_back(
+        SequenceState<S, O, D>(state_table.State(es->state), es->observation,
+                               es->transitionDescriptor));
+  }
+  commit_prefix.clear();
+  for (auto i = commit_reversed.rbegin(); i < commit_reversed.rend(); ++i) {
+    commit_prefix.push_back(*i);
+  }
+  // Everything before head has been committed and is not needed anymore.
+  ExtendedState<S, O, D>* const backPointer = head->backPointer;
+  head->backPointer = nullptr;
+  Unreference(backPointer);
+  committed_time_step = head->timeStep;
+  commit_callback(commit_prefix);
+}
+template <typename S, typename O, typename D>
+void ViterbiAlgorithm<S, O, D>::ReportStep() {
+  step_metrics.timeStep = time_step;
+  step_metrics.isBroken = is_broken;
+  step_metrics.bestLogProbability = -std::numeric_limits<double>::infinity();
+  if (!is_broken) {
+    for (auto logProbability : message) {
+      step_metrics.bestLogProbability =
+          std::max(step_metrics.bestLogProbability, logProbability);
+    }
+  }
+  step_metrics.liveExtendedStates = extended_state_pool.Size();
+  step_metrics.allocatedBytes = extended_state_pool.CapacityBytes();
+  observer->OnStep(step_metrics);
 }
 template <typename S, typename O, typename D>
-S ViterbiAlgorithm<S, O, D>::MostLikelyState() {
+int ViterbiAlgorithm<S, O, D>::MostLikelyStateIndex() {
   // Otherwise an HMM break would have occurred and message would be null.
   if (message.empty()) {
-    printf("ERR: message is empty. MostLikelyState()\n");
-    return S();
+    printf("ERR: message is empty. MostLikelyStateIndex()\n");
+    return -1;
   }
 
-  S result;
+  int result = -1;
   const double kErrorDouble = -std::numeric_limits<double>::infinity();
   double maxLogProbability = kErrorDouble;
-  for (auto entry : message) {
-    if (entry.second > maxLogProbability) {
-      result = entry.first;
-      maxLogProbability = entry.second;
+  for (size_t i = 0; i < message.size(); ++i) {
+    // Ties are broken by state order, as when iterating a std::map.
+    if (message[i] > maxLogProbability ||
+        (result >= 0 && message[i] == maxLogProbability &&
+         state_table.State(prevCandidates[i]) <
+             state_table.State(prevCandidates[result]))) {
+      result = (int)i;
+      maxLogProbability = message[i];
     }
   }
   // Otherwise an HMM break would have occurred.
   if (maxLogProbability == kErrorDouble) {
-    printf("ERR: result is empty. MostLikelyState()\n");
-    return S();
+    printf("ERR: result is empty. MostLikelyStateIndex()\n");
+    return -1;
   }
   return result;
 }
@@ -264,12 +1200,13 @@ ViterbiAlgorithm<S, O, D>::RetrieveMostLikelySequence() {
     printf("ERR: message is empty. RetrieveMostLikelySequence()\n");
     return std::vector<SequenceState<S, O, D>>();
   }
-  S lastState = MostLikelyState();
+  const int lastState = MostLikelyStateIndex();
   // Retrieve most likely state sequence in reverse order
   std::vector<SequenceState<S, O, D>> result;
-  ExtendedState<S, O, D>* es = lastExtendedStates[lastState];
-  while (es != nullptr) {
-    SequenceState<S, O, D> ss(es->state, es->observation,
+  ExtendedState<S, O, D>* es =
+      lastState < 0 ? nullptr : lastExtendedStates[lastState];
+  while (es != nullptr && es->timeStep > committed_time_step) {
+    SequenceState<S, O, D> ss(state_table.State(es->state), es->observation,
                               es->transitionDescriptor);
     result.push_back(ss);
     if (es->backPointer == nullptr) {
@@ -0,0 +1,72 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Per time step instrumentation of ViterbiAlgorithm.
+ *
+ * <p>An observer attached with ViterbiAlgorithm::SetObserver() is called once
+ * after each time step, including the initial one and time steps with an HMM
+ * break. Metrics are only collected while an observer is attached; without
+ * one, a time step only pays for a null check.
+ */
+
+#ifndef VITERBI_OBSERVER_H_
+#define VITERBI_OBSERVER_H_
+
+#include <cstddef>
+
+namespace hmm {
+
+class ViterbiStepMetrics {
+ public:
+  // Starting with 0 for the initial time step.
+  int timeStep = 0;
+  // Candidates of the previous time step after pruning, 0 for the initial
+  // time step.
+  size_t numPrevCandidates = 0;
+  // Candidates of this time step without duplicates, before pruning.
+  size_t numCandidates = 0;
+  // Transitions whose probability was looked up or requested from a lazy
+  // transition provider.
+  size_t evaluatedTransitions = 0;
+  // Evaluated transitions with zero probability, i.e. missing ones or
+  // -infinity.
+  size_t missingTransitions = 0;
+  // Log probability of the most likely sequence ending in this time step,
+  // -infinity on an HMM break.
+  double bestLogProbability = 0.0;
+  // States dropped by pruning in this time step, see
+  // ViterbiAlgorithm::SetPruning().
+  size_t prunedStates = 0;
+  // Back pointer nodes alive after pruning and commits.
+  size_t liveExtendedStates = 0;
+  // Bytes held by the pool of back pointer nodes.
+  size_t allocatedBytes = 0;
+  // Wall time of the forward step, 0 for the initial time step.
+  double forwardStepSeconds = 0.0;
+  bool isBroken = false;
+};
+
+class ViterbiObserver {
+ public:
+  virtual ~ViterbiObserver() {}
+  // Called after each time step. metrics is only valid during the call.
+  virtual void OnStep(const ViterbiStepMetrics &metrics) = 0;
+};
+
+}  // namespace hmm
+
+#endif  // VITERBI_OBSERVER_H_
@@ -0,0 +1,41 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef VITERBI_STEP_H_
+#define VITERBI_STEP_H_
+
+#include <map>
+#include <vector>
+#include "transition.h"
+
+namespace hmm {
+
+// Inputs of one time step of ViterbiAlgorithm. For the first time step of a
+// sequence, emissionLogProbabilities are the initial state probabilities and
+// transitions are ignored.
+template <typename S, typename O, typename D>
+class ViterbiStep {
+ public:
+  O observation;
+  std::vector<S> candidates;
+  std::map<S, double> emissionLogProbabilities;
+  std::map<Transition<S>, double> transitionLogProbabilities;
+  std::map<Transition<S>, D> transitionDescriptors;
+};
+
+}  // namespace hmm
+
+#endif  // VITERBI_STEP_H_
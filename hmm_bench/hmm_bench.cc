@@ -0,0 +1,360 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Benchmarks of the Viterbi engines on synthetic HMMs, see SyntheticHmm.
+ *
+ * <p>Arguments are the number of states, the number of time steps and the
+ * transition density in percent. Each benchmark runs with int states and
+ * with string states, BM_DenseDecode also in single precision. Run the bench
+ * target or pass --benchmark_out=<file> --benchmark_out_format=json to get
+ * JSON results.
+ */
+
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "baum_welch.h"
+#include "dense_viterbi_algorithm.h"
+#include "fixed_viterbi.h"
+#include "mapped_model.h"
+#include "parallel_scan_viterbi.h"
+#include "synthetic_hmm.h"
+#include "viterbi_algorithm.h"
+
+namespace hmm {
+namespace {
+
+void SetModelCounters(benchmark::State& state, size_t numTransitions) {
+  state.counters["states"] = (double)state.range(0);
+  state.counters["density"] = state.range(2) / 100.0;
+  state.counters["transitions"] = (double)numTransitions;
+}
+
+// One forward step of ViterbiAlgorithm. The sequence is restarted after
+// range(1) time steps, outside of the timing.
+template <typename S>
+void BM_NextStep(benchmark::State& state) {
+  SyntheticHmm<S> model((int)state.range(0), (int)state.range(1),
+                        state.range(2) / 100.0);
+  ViterbiAlgorithm<S, int, int> viterbi;
+  viterbi.StartWithInitialObservation(
+      model.observations[0], model.states,
+      model.emissionLogProbabilities[model.observations[0]]);
+  size_t t = 1;
+  for (auto _ : state) {
+    if (t == model.observations.size()) {
+      state.PauseTiming();
+      viterbi.Reset();
+      viterbi.StartWithInitialObservation(
+          model.observations[0], model.states,
+          model.emissionLogProbabilities[model.observations[0]]);
+      t = 1;
+      state.ResumeTiming();
+    }
+    const int observation = model.observations[t];
+    viterbi.NextStep(observation, model.states,
+                     model.emissionLogProbabilities[observation],
+                     model.transitionLogProbabilities);
+    t++;
+  }
+  state.SetItemsProcessed(state.iterations());
+  SetModelCounters(state, model.transitionLogProbabilities.size());
+}
+
+// Back tracking of a decoded sequence of range(1) time steps.
+template <typename S>
+void BM_ComputeMostLikelySequence(benchmark::State& state) {
+  SyntheticHmm<S> model((int)state.range(0), (int)state.range(1),
+                        state.range(2) / 100.0);
+  ViterbiAlgorithm<S, int, int> viterbi;
+  viterbi.StartWithInitialObservation(
+      model.observations[0], model.states,
+      model.emissionLogProbabilities[model.observations[0]]);
+  for (size_t t = 1; t < model.observations.size(); t++) {
+    const int observation = model.observations[t];
+    viterbi.NextStep(observation, model.states,
+                     model.emissionLogProbabilities[observation],
+                     model.transitionLogProbabilities);
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(viterbi.ComputeMostLikelySequence());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(1));
+  SetModelCounters(state, model.transitionLogProbabilities.size());
+}
+
+// Decoding of a whole sequence with ViterbiAlgorithm, including setup and
+// back tracking.
+template <typename S>
+void BM_Decode(benchmark::State& state) {
+  SyntheticHmm<S> model((int)state.range(0), (int)state.range(1),
+                        state.range(2) / 100.0);
+  ViterbiAlgorithm<S, int, int> viterbi;
+  for (auto _ : state) {
+    viterbi.Reset();
+    viterbi.StartWithInitialObservation(
+        model.observations[0], model.states,
+        model.emissionLogProbabilities[model.observations[0]]);
+    for (size_t t = 1; t < model.observations.size(); t++) {
+      const int observation = model.observations[t];
+      viterbi.NextStep(observation, model.states,
+                       model.emissionLogProbabilities[observation],
+                       model.transitionLogProbabilities);
+    }
+    benchmark::DoNotOptimize(viterbi.ComputeMostLikelySequence());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(1));
+  SetModelCounters(state, model.transitionLogProbabilities.size());
+}
+
+// SaveSnapshot() and RestoreSnapshot() of a decoder after range(1) time
+// steps. Bytes processed are the snapshot size.
+template <typename S>
+void BM_SnapshotRoundTrip(benchmark::State& state) {
+  SyntheticHmm<S> model((int)state.range(0), (int)state.range(1),
+                        state.range(2) / 100.0);
+  ViterbiAlgorithm<S, int, int> viterbi;
+  viterbi.StartWithInitialObservation(
+      model.observations[0], model.states,
+      model.emissionLogProbabilities[model.observations[0]]);
+  for (size_t t = 1; t < model.observations.size(); t++) {
+    const int observation = model.observations[t];
+    viterbi.NextStep(observation, model.states,
+                     model.emissionLogProbabilities[observation],
+                     model.transitionLogProbabilities);
+  }
+  ViterbiAlgorithm<S, int, int> restored;
+  std::string snapshot;
+  for (auto _ : state) {
+    viterbi.SaveSnapshot(snapshot);
+    benchmark::DoNotOptimize(restored.RestoreSnapshot(snapshot));
+  }
+  state.SetBytesProcessed(state.iterations() * snapshot.size());
+  state.counters["nodes"] = (double)viterbi.LiveExtendedStateCount();
+  SetModelCounters(state, model.transitionLogProbabilities.size());
+}
+
+// Same as BM_Decode with DenseViterbiAlgorithm and probability type P. Sparse
+// models are passed as SparseTransitions, fully connected ones as dense
+// matrix.
+template <typename S, typename P>
+void BM_DenseDecode(benchmark::State& state) {
+  SyntheticHmm<S> model((int)state.range(0), (int)state.range(1),
+                        state.range(2) / 100.0);
+  const bool dense = state.range(2) >= 100;
+  std::vector<std::vector<P>> emissions;
+  for (auto& symbolEmissions : model.denseEmissionLogProbabilities) {
+    emissions.push_back(
+        std::vector<P>(symbolEmissions.begin(), symbolEmissions.end()));
+  }
+  std::vector<P> transitions(model.denseTransitionLogProbabilities.begin(),
+                             model.denseTransitionLogProbabilities.end());
+  SparseTransitions<int, P> sparseTransitions;
+  sparseTransitions.offsets = model.sparseTransitions.offsets;
+  sparseTransitions.prevIndices = model.sparseTransitions.prevIndices;
+  sparseTransitions.logProbabilities.assign(
+      model.sparseTransitions.logProbabilities.begin(),
+      model.sparseTransitions.logProbabilities.end());
+  for (auto _ : state) {
+    DenseViterbiAlgorithm<S, int, int, P> viterbi;
+    viterbi.StartWithInitialObservation(model.observations[0], model.states,
+                                        emissions[model.observations[0]]);
+    for (size_t t = 1; t < model.observations.size(); t++) {
+      const int observation = model.observations[t];
+      if (dense) {
+        viterbi.NextStep(observation, model.states, emissions[observation],
+                         transitions);
+      } else {
+        viterbi.NextStep(observation, model.states, emissions[observation],
+                         sparseTransitions);
+      }
+    }
+    benchmark::DoNotOptimize(viterbi.ComputeMostLikelySequence());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(1));
+  SetModelCounters(state, model.transitionLogProbabilities.size());
+}
+
+// ParallelScanViterbi on one sequence of range(1) time steps of a fully
+// connected model with range(0) states, with range(2) threads, 0 for one per
+// hardware thread. Compare to BM_DenseDecode for the sequential baseline.
+void BM_ParallelScanDecode(benchmark::State& state) {
+  SyntheticHmm<int> model((int)state.range(0), (int)state.range(1), 1.0);
+  std::vector<const double*> emissions;
+  for (int o : model.observations) {
+    emissions.push_back(model.denseEmissionLogProbabilities[o].data());
+  }
+  ParallelScanViterbi scan((int)state.range(2));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(scan.Decode(
+        model.states.size(), emissions,
+        model.denseTransitionLogProbabilities.data()));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(1));
+  state.counters["states"] = (double)state.range(0);
+}
+
+// One BaumWelch iteration over range(1) sequences of 64 time steps with
+// range(2) threads, 0 for one per hardware thread.
+void BM_BaumWelchIteration(benchmark::State& state) {
+  const int kLength = 64;
+  SyntheticHmm<int> model((int)state.range(0), (int)state.range(1) * kLength,
+                          1.0);
+  DiscreteHmm hmm;
+  hmm.numStates = (int)state.range(0);
+  hmm.numSymbols = (int)model.denseEmissionLogProbabilities.size();
+  hmm.initialLogProbabilities.assign(hmm.numStates, -log(hmm.numStates));
+  hmm.transitionLogProbabilities = model.denseTransitionLogProbabilities;
+  hmm.emissionLogProbabilities = model.denseEmissionLogProbabilities;
+  std::vector<std::vector<int>> sequences;
+  for (size_t t = 0; t < model.observations.size(); t += kLength) {
+    sequences.push_back(std::vector<int>(
+        model.observations.begin() + t,
+        model.observations.begin() + t + kLength));
+  }
+  BaumWelch trainer((int)state.range(2));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(trainer.Iterate(sequences, hmm));
+  }
+  state.SetItemsProcessed(state.iterations() * sequences.size());
+  state.counters["states"] = (double)hmm.numStates;
+}
+
+// MappedModel::Open() of a model with range(0) states written to a temporary
+// file, i.e. the startup cost of a worker process with a warm page cache.
+// Sparse models include the check of the index arrays.
+template <typename S>
+void BM_OpenMappedModel(benchmark::State& state) {
+  SyntheticHmm<S> model((int)state.range(0), 1, state.range(2) / 100.0);
+  const bool dense = state.range(2) >= 100;
+  std::vector<std::string> names;
+  for (int s = 0; s < (int)state.range(0); s++) {
+    names.push_back(MakeSyntheticState<std::string>(s));
+  }
+  const std::string path = "hmm_bench_mapped_model.bin";
+  const bool written =
+      dense ? MappedModel<double>::Write(
+                  path, names, model.denseEmissionLogProbabilities,
+                  model.denseTransitionLogProbabilities)
+            : MappedModel<double>::Write(path, names,
+                                         model.denseEmissionLogProbabilities,
+                                         model.sparseTransitions);
+  if (!written) {
+    state.SkipWithError("cannot write model");
+    return;
+  }
+  MappedModel<double> mapped;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(mapped.Open(path));
+  }
+  mapped.Close();
+  remove(path.c_str());
+  SetModelCounters(state, model.transitionLogProbabilities.size());
+}
+
+// One time step of FixedViterbi with N states. Restarting after 1024 time
+// steps is included in the timing, its cost is negligible.
+template <size_t N>
+void BM_FixedNextStep(benchmark::State& state) {
+  typedef FixedViterbi<N, 1024> Viterbi;
+  SyntheticHmm<int> model((int)N, 1024, 1.0);
+  std::vector<typename Viterbi::Vector> emissions(
+      model.denseEmissionLogProbabilities.size());
+  for (size_t o = 0; o < emissions.size(); o++) {
+    for (size_t s = 0; s < N; s++) {
+      emissions[o][s] = model.denseEmissionLogProbabilities[o][s];
+    }
+  }
+  typename Viterbi::Matrix transitions;
+  for (size_t from = 0; from < N; from++) {
+    for (size_t to = 0; to < N; to++) {
+      transitions[from][to] =
+          model.denseTransitionLogProbabilities[from * N + to];
+    }
+  }
+  Viterbi viterbi;
+  size_t t = 0;
+  for (auto _ : state) {
+    if (t == 0) {
+      viterbi.Reset();
+      viterbi.StartWithInitialObservation(emissions[model.observations[0]]);
+      t = 1;
+    }
+    viterbi.NextStep(emissions[model.observations[t]], transitions);
+    t = t + 1 == model.observations.size() ? 0 : t + 1;
+  }
+  benchmark::DoNotOptimize(viterbi.MostLikelyState());
+  state.SetItemsProcessed(state.iterations());
+}
+
+void StepArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"states", "steps", "density"});
+  benchmark->ArgsProduct({{16, 64, 256}, {128}, {5, 25, 100}});
+}
+
+void SequenceArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"states", "steps", "density"});
+  benchmark->ArgsProduct({{16, 64, 256}, {32, 256}, {5, 100}});
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_NextStep, int)->Apply(StepArguments);
+BENCHMARK_TEMPLATE(BM_NextStep, std::string)->Apply(StepArguments);
+BENCHMARK_TEMPLATE(BM_FixedNextStep, 2);
+BENCHMARK_TEMPLATE(BM_FixedNextStep, 4);
+BENCHMARK_TEMPLATE(BM_FixedNextStep, 8);
+BENCHMARK_TEMPLATE(BM_FixedNextStep, 16);
+BENCHMARK_TEMPLATE(BM_ComputeMostLikelySequence, int)
+    ->Apply(SequenceArguments);
+BENCHMARK_TEMPLATE(BM_ComputeMostLikelySequence, std::string)
+    ->Apply(SequenceArguments);
+BENCHMARK_TEMPLATE(BM_SnapshotRoundTrip, int)->Apply(SequenceArguments);
+BENCHMARK_TEMPLATE(BM_SnapshotRoundTrip, std::string)
+    ->Apply(SequenceArguments);
+BENCHMARK_TEMPLATE(BM_Decode, int)
+    ->Apply(SequenceArguments)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Decode, std::string)
+    ->Apply(SequenceArguments)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ParallelScanDecode)
+    ->ArgNames({"states", "steps", "threads"})
+    ->ArgsProduct({{4, 16}, {100000}, {1, 0}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BaumWelchIteration)
+    ->ArgNames({"states", "sequences", "threads"})
+    ->ArgsProduct({{8, 32}, {10000}, {1, 0}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_OpenMappedModel, int)
+    ->ArgNames({"states", "steps", "density"})
+    ->ArgsProduct({{256, 2048}, {1}, {5, 100}});
+BENCHMARK_TEMPLATE(BM_DenseDecode, int, double)
+    ->Apply(SequenceArguments)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_DenseDecode, std::string, double)
+    ->Apply(SequenceArguments)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_DenseDecode, int, float)
+    ->Apply(SequenceArguments)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace hmm
+
+BENCHMARK_MAIN();
@@ -0,0 +1,127 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Random time-homogeneous HMMs for the benchmarks.
+ *
+ * <p>All numStates states are candidates in every time step. Each transition
+ * exists with probability density, the self transition always exists so that
+ * no HMM break can occur. Emissions depend on one of numSymbols observation
+ * symbols, the symbol of time step t is observations[t].
+ *
+ * <p>The same model is provided for ViterbiAlgorithm (maps) and for
+ * DenseViterbiAlgorithm (dense matrix and sparse columns). Generation is
+ * deterministic for a given seed.
+ *
+ * @param <S> the state type, see MakeSyntheticState()
+ */
+
+#ifndef SYNTHETIC_HMM_H_
+#define SYNTHETIC_HMM_H_
+
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "sparse_transitions.h"
+#include "transition.h"
+
+namespace hmm {
+
+template <typename S>
+S MakeSyntheticState(int index);
+
+template <>
+inline int MakeSyntheticState<int>(int index) {
+  return index;
+}
+
+// Rain-like states backed by a string. The names are longer than the small
+// string buffer of common standard libraries, so that copying a state
+// allocates as with real-world state names.
+template <>
+inline std::string MakeSyntheticState<std::string>(int index) {
+  char name[32];
+  snprintf(name, sizeof(name), "synthetic-state-%05d", index);
+  return name;
+}
+
+template <typename S>
+class SyntheticHmm {
+ public:
+  std::vector<S> states;
+  std::vector<int> observations;
+  // Keyed by observation symbol.
+  std::vector<std::map<S, double>> emissionLogProbabilities;
+  std::map<Transition<S>, double> transitionLogProbabilities;
+  std::vector<std::vector<double>> denseEmissionLogProbabilities;
+  // Row-major, see DenseViterbiAlgorithm.
+  std::vector<double> denseTransitionLogProbabilities;
+  SparseTransitions<int> sparseTransitions;
+
+  SyntheticHmm(int numStates, int numTimeSteps, double density,
+               int numSymbols = 8, unsigned seed = 17) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> logProbability(-8.0, 0.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::uniform_int_distribution<int> symbol(0, numSymbols - 1);
+    for (int s = 0; s < numStates; s++) {
+      states.push_back(MakeSyntheticState<S>(s));
+    }
+    for (int t = 0; t < numTimeSteps; t++) {
+      observations.push_back(symbol(random));
+    }
+    emissionLogProbabilities.resize(numSymbols);
+    denseEmissionLogProbabilities.resize(numSymbols);
+    for (int o = 0; o < numSymbols; o++) {
+      for (int s = 0; s < numStates; s++) {
+        const double value = logProbability(random);
+        emissionLogProbabilities[o][states[s]] = value;
+        denseEmissionLogProbabilities[o].push_back(value);
+      }
+    }
+    denseTransitionLogProbabilities.assign(
+        (size_t)numStates * numStates,
+        -std::numeric_limits<double>::infinity());
+    for (int from = 0; from < numStates; from++) {
+      for (int to = 0; to < numStates; to++) {
+        if (from != to && uniform(random) >= density) {
+          continue;
+        }
+        const double value = logProbability(random);
+        transitionLogProbabilities[Transition<S>(states[from], states[to])] =
+            value;
+        denseTransitionLogProbabilities[(size_t)from * numStates + to] = value;
+      }
+    }
+    for (int to = 0; to < numStates; to++) {
+      for (int from = 0; from < numStates; from++) {
+        const double value =
+            denseTransitionLogProbabilities[(size_t)from * numStates + to];
+        if (value != -std::numeric_limits<double>::infinity()) {
+          sparseTransitions.AddTransition(from, value);
+        }
+      }
+      sparseTransitions.EndCandidate();
+    }
+  }
+};
+
+}  // namespace hmm
+
+#endif  // SYNTHETIC_HMM_H_
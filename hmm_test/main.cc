@@ -0,0 +1,58 @@
+/**
+* Copyright (C) 2017, Junho Han (junhohan.kr@gmail.com)
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "test_main.h"
+
+int main() {
+  hmm::TestMain test;
+  test.TestComputeMostLikelySequence();
+  test.TestDeterministicCandidateOrder();
+  test.TestEmptySequence();
+  test.TestBreakAtInitialMessage();
+  test.TestEmptyInitialMessage();
+  test.TestBreakAtFirstTransition();
+  test.TestBreakAtFirstTransitionWithNoCandidates();
+  test.TestBreakAtSecondTransition();
+  test.TestDenseComputeMostLikelySequence();
+  test.TestDenseMatchesMapBasedViterbi();
+  test.TestMaxPlusKernel();
+  test.TestLongSequenceAndReset();
+  test.TestBackPointerReclamation();
+  test.TestOnlineDecoding();
+  test.TestBatchViterbi();
+  test.TestPruning();
+  test.TestSparseTransitions();
+  test.TestLazyTransitionProvider();
+  test.TestParallelForwardStep();
+  test.TestKBestViterbi();
+  test.TestForwardBackward();
+  test.TestCheckpointedViterbi();
+  test.TestMessageHistory();
+  test.TestAllocationFreeNextStep();
+  test.TestStepObserver();
+  test.TestFloatProbabilities();
+  test.TestFixedViterbi();
+  test.TestSnapshot();
+  test.TestMappedModel();
+  test.TestBaumWelch();
+  test.TestParallelScanViterbi();
+  test.TestBreakRecovery();
+  test.TestStateInterner();
+  test.TestTransitionCache();
+  // Failed checks are printed as "ERR: ..." lines, ctest only sees the exit
+  // code.
+  return test.NumFailures() == 0 ? 0 : 1;
+}
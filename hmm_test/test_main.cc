@@ -17,18 +17,104 @@
 */
 
 #include "test_main.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <map>
+#include <new>
+#include <random>
+#include <string>
 #include <vector>
 
+#include "batch_viterbi.h"
+#include "baum_welch.h"
+#include "checkpointed_viterbi.h"
+#include "dense_viterbi_algorithm.h"
+#include "fixed_viterbi.h"
 #include "descriptor.h"
+#include "forward_backward_algorithm.h"
+#include "k_best_viterbi_algorithm.h"
+#include "mapped_model.h"
+#include "max_plus.h"
+#include "parallel_scan_viterbi.h"
 #include "rain.h"
+#include "state_interner.h"
+#include "thread_pool.h"
 #include "transition.h"
 #include "umbrella.h"
 #include "viterbi_algorithm.h"
+#include "viterbi_observer.h"
+
+namespace {
+// Number of calls of the global operator new, see
+// TestAllocationFreeNextStep().
+std::atomic<long> allocation_count(0);
+}  // namespace
+
+// The replacements are kept out of line: once inlined, GCC pairs the
+// std::malloc() and std::free() calls with new and delete expressions of
+// the callers and reports them as mismatched (-Wmismatched-new-delete).
+#if defined(__GNUC__)
+#define HMM_TEST_NOINLINE __attribute__((noinline))
+#else
+#define HMM_TEST_NOINLINE
+#endif
+
+HMM_TEST_NOINLINE void* operator new(std::size_t size) {
+  allocation_count++;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+HMM_TEST_NOINLINE void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+HMM_TEST_NOINLINE void* operator new(std::size_t size,
+                                     const std::nothrow_t&) noexcept {
+  allocation_count++;
+  return std::malloc(size == 0 ? 1 : size);
+}
+HMM_TEST_NOINLINE void* operator new[](std::size_t size,
+                                       const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+HMM_TEST_NOINLINE void operator delete(void* ptr) noexcept { std::free(ptr); }
+HMM_TEST_NOINLINE void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+HMM_TEST_NOINLINE void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+HMM_TEST_NOINLINE void operator delete[](void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+HMM_TEST_NOINLINE void operator delete(void* ptr,
+                                       const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+HMM_TEST_NOINLINE void operator delete[](void* ptr,
+                                         const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
 
 namespace hmm {
 
+int TestMain::NumFailures() const { return num_failures; }
+
+void TestMain::Fail(const char* format, ...) {
+  num_failures++;
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
 void TestMain::TestComputeMostLikelySequence() {
   printf("\n:: TestComputeMostLikelySequence ::\n");
 
@@ -85,6 +171,7 @@ void TestMain::TestComputeMostLikelySequence() {
       Descriptor(Descriptor::kS2S));
 
   ViterbiAlgorithm<hmm::Rain, hmm::Umbrella, hmm::Descriptor> viterbi;
+  viterbi.SetKeepMessageHistory(true);
   viterbi.StartWithInitialObservation(hmm::Umbrella(Umbrella::kYesUmbr),
                                       candidates,
                                       emissionLogProbabilitiesForUmbrella);
@@ -101,72 +188,72 @@ void TestMain::TestComputeMostLikelySequence() {
       viterbi.ComputeMostLikelySequence();
 
   if (result.size() != 4) {
-    printf("ERR: Result count must be 4, but %d.\n", (int)result.size());
+    Fail("ERR: Result count must be 4, but %d.\n", (int)result.size());
     return;
   }
 
   // assertEquals(Rain.T, result.get(0).state);
   if (result.at(0).state.weather_ != hmm::Rain::kRain) {
-    printf("ERR: Rain Index 0 must be RAIN, but %s.\n",
-           result.at(0).state.weather_.c_str());
+    Fail("ERR: Rain Index 0 must be RAIN, but %s.\n",
+         result.at(0).state.weather_.c_str());
   }
   if (result.at(1).state.weather_ != hmm::Rain::kRain) {
-    printf("ERR: Rain Index 1 must be RAIN, but %s.\n",
-           result.at(1).state.weather_.c_str());
+    Fail("ERR: Rain Index 1 must be RAIN, but %s.\n",
+         result.at(1).state.weather_.c_str());
   }
   if (result.at(2).state.weather_ != hmm::Rain::kSun) {
-    printf("ERR: Rain Index 2 must be RAIN, but %s.\n",
-           result.at(2).state.weather_.c_str());
+    Fail("ERR: Rain Index 2 must be RAIN, but %s.\n",
+         result.at(2).state.weather_.c_str());
   }
   if (result.at(3).state.weather_ != hmm::Rain::kRain) {
-    printf("ERR: Rain Index 3 must be RAIN, but %s.\n",
-           result.at(3).state.weather_.c_str());
+    Fail("ERR: Rain Index 3 must be RAIN, but %s.\n",
+         result.at(3).state.weather_.c_str());
   }
 
   if (result.at(0).observation.umbrella_ != hmm::Umbrella::kYesUmbr) {
-    printf("ERR: Umbrella Index 0 must be %s, but %s.\n",
-           hmm::Umbrella::kYesUmbr.c_str(),
-           result.at(0).state.weather_.c_str());
+    Fail("ERR: Umbrella Index 0 must be %s, but %s.\n",
+         hmm::Umbrella::kYesUmbr.c_str(),
+         result.at(0).state.weather_.c_str());
   }
   if (result.at(1).observation.umbrella_ != hmm::Umbrella::kYesUmbr) {
-    printf("ERR: Umbrella Index 1 must be %s, but %s.\n",
-           hmm::Umbrella::kYesUmbr.c_str(),
-           result.at(1).state.weather_.c_str());
+    Fail("ERR: Umbrella Index 1 must be %s, but %s.\n",
+         hmm::Umbrella::kYesUmbr.c_str(),
+         result.at(1).state.weather_.c_str());
   }
   if (result.at(2).observation.umbrella_ != hmm::Umbrella::kNoUmbr) {
-    printf("ERR: Umbrella Index 2 must be %s, but %s.\n",
-           hmm::Umbrella::kNoUmbr.c_str(), result.at(2).state.weather_.c_str());
+    Fail("ERR: Umbrella Index 2 must be %s, but %s.\n",
+         hmm::Umbrella::kNoUmbr.c_str(), result.at(2).state.weather_.c_str());
   }
   if (result.at(3).observation.umbrella_ != hmm::Umbrella::kYesUmbr) {
-    printf("ERR: Umbrella Index 3 must be %s, but %s.\n",
-           hmm::Umbrella::kYesUmbr.c_str(),
-           result.at(3).state.weather_.c_str());
+    Fail("ERR: Umbrella Index 3 must be %s, but %s.\n",
+         hmm::Umbrella::kYesUmbr.c_str(),
+         result.at(3).state.weather_.c_str());
   }
   if (!result.at(0).transitionDescriptor.desc_.empty()) {
-    printf("ERR: Descriptor Index 0 must be empty, but %s.\n",
-           result.at(0).transitionDescriptor.desc_.c_str());
+    Fail("ERR: Descriptor Index 0 must be empty, but %s.\n",
+         result.at(0).transitionDescriptor.desc_.c_str());
   }
   if (result.at(1).transitionDescriptor.desc_ != hmm::Descriptor::kR2R) {
-    printf("ERR: Descriptor Index 1 must be %s, but %s.\n",
-           hmm::Descriptor::kR2R.c_str(),
-           result.at(1).transitionDescriptor.desc_.c_str());
+    Fail("ERR: Descriptor Index 1 must be %s, but %s.\n",
+         hmm::Descriptor::kR2R.c_str(),
+         result.at(1).transitionDescriptor.desc_.c_str());
   }
   if (result.at(2).transitionDescriptor.desc_ != hmm::Descriptor::kR2S) {
-    printf("ERR: Descriptor Index 2 must be %s, but %s.\n",
-           hmm::Descriptor::kR2S.c_str(),
-           result.at(2).transitionDescriptor.desc_.c_str());
+    Fail("ERR: Descriptor Index 2 must be %s, but %s.\n",
+         hmm::Descriptor::kR2S.c_str(),
+         result.at(2).transitionDescriptor.desc_.c_str());
   }
   if (result.at(3).transitionDescriptor.desc_ != hmm::Descriptor::kS2R) {
-    printf("ERR: Descriptor Index 3 must be %s, but %s.\n",
-           hmm::Descriptor::kS2R.c_str(),
-           result.at(3).transitionDescriptor.desc_.c_str());
+    Fail("ERR: Descriptor Index 3 must be %s, but %s.\n",
+         hmm::Descriptor::kS2R.c_str(),
+         result.at(3).transitionDescriptor.desc_.c_str());
   }
   // assertEquals(null,  result.get(0).transitionDescriptor);
   // assertEquals(Descriptor.R2R, result.get(1).transitionDescriptor);
   //  assertEquals(Descriptor.R2S, result.get(2).transitionDescriptor);
   //  assertEquals(Descriptor.S2R, result.get(3).transitionDescriptor);
   if (viterbi.IsBroken()) {
-    printf("ERR: Viterbi was BROKEN!!!\n");
+    Fail("ERR: Viterbi was BROKEN!!!\n");
   }
   auto actualMessageHistory = viterbi.MessageHistory();
   // Check message history
@@ -194,7 +281,7 @@ void TestMain::TestComputeMostLikelySequence() {
 }
 void TestMain::CheckMessageHistory(
     std::vector<std::map<Rain, double>> expectedMessageHistory,
-    std::vector<std::map<Rain, double>> actualMessageHistory) {
+    MessageHistoryView<Rain> actualMessageHistory) {
   // assertEquals(expectedMessageHistory.size(), actualMessageHistory.size());
   if (expectedMessageHistory.size() == actualMessageHistory.size()) {
     printf("CheckMessageHistory() GOOD: result is the same count.\n");
@@ -205,7 +292,7 @@ void TestMain::CheckMessageHistory(
 }
 
 void TestMain::CheckMessage(std::map<Rain, double> expectedMessage,
-                            std::map<Rain, double> actualMessage) {
+                            MessageView<Rain> actualMessage) {
   // assertEquals(expectedMessage.size(), actualMessage.size());
   if (expectedMessage.size() == actualMessage.size()) {
     printf("CheckMessage() GOOD: result is the same count.\n");
@@ -216,7 +303,7 @@ void TestMain::CheckMessage(std::map<Rain, double> expectedMessage,
     // assertEquals(entry.second, std::exp(actualMessage[entry.first], DELTA);
     auto f = entry.second;
     printf("CheckMessage() entry.second value is %f\n", f);
-    auto b = std::exp(actualMessage[entry.first]);
+    auto b = std::exp(actualMessage.LogProbability(entry.first));
     auto value = std::abs(f - b);
     if (value < DELTA) {
       printf("CheckMessage() GOOD: value is good\n");
@@ -272,7 +359,7 @@ void TestMain::TestDeterministicCandidateOrder() {
 
   // Check most likely sequence
   if (result.size() != 4) {
-    printf(
+    Fail(
         "ERR: Result count must be 4, but %d. "
         "TestDeterministicCandidateOrder()\n",
         (int)result.size());
@@ -280,25 +367,25 @@ void TestMain::TestDeterministicCandidateOrder() {
   }
 
   if (result.at(0).state.weather_ != hmm::Rain::kRain) {
-    printf(
+    Fail(
         "ERR: Rain Index 0 must be RAIN, but %s. "
         "TestDeterministicCandidateOrder()\n",
         result.at(0).state.weather_.c_str());
   }
   if (result.at(1).state.weather_ != hmm::Rain::kRain) {
-    printf(
+    Fail(
         "ERR: Rain Index 1 must be RAIN, but %s. "
         "TestDeterministicCandidateOrder()\n",
         result.at(1).state.weather_.c_str());
   }
   if (result.at(2).state.weather_ != hmm::Rain::kRain) {
-    printf(
+    Fail(
         "ERR: Rain Index 2 must be RAIN, but %s. "
         "TestDeterministicCandidateOrder()\n",
         result.at(2).state.weather_.c_str());
   }
   if (result.at(3).state.weather_ != hmm::Rain::kRain) {
-    printf(
+    Fail(
         "ERR: Rain Index 3 must be RAIN, but %s. "
         "TestDeterministicCandidateOrder()\n",
         result.at(3).state.weather_.c_str());
@@ -493,4 +580,2184 @@ void TestMain::TestBreakAtSecondTransition() {
     printf("TestBreakAtSecondTransition() GOOD: result's state is RAIN!\n");
   }
 }
+void TestMain::TestDenseComputeMostLikelySequence() {
+  std::vector<Rain> candidates;
+  candidates.push_back(Rain(Rain::kRain));
+  candidates.push_back(Rain(Rain::kSun));
+
+  std::vector<double> emissionLogProbabilitiesForUmbrella;
+  emissionLogProbabilitiesForUmbrella.push_back(log(0.9));
+  emissionLogProbabilitiesForUmbrella.push_back(log(0.2));
+
+  std::vector<double> emissionLogProbabilitiesForNoUmbrella;
+  emissionLogProbabilitiesForNoUmbrella.push_back(log(0.1));
+  emissionLogProbabilitiesForNoUmbrella.push_back(log(0.8));
+
+  // Row-major, one row per previous candidate.
+  std::vector<double> transitionLogProbabilities;
+  transitionLogProbabilities.push_back(log(0.7));
+  transitionLogProbabilities.push_back(log(0.3));
+  transitionLogProbabilities.push_back(log(0.3));
+  transitionLogProbabilities.push_back(log(0.7));
+
+  std::vector<Descriptor> transitionDescriptors;
+  transitionDescriptors.push_back(Descriptor(Descriptor::kR2R));
+  transitionDescriptors.push_back(Descriptor(Descriptor::kR2S));
+  transitionDescriptors.push_back(Descriptor(Descriptor::kS2R));
+  transitionDescriptors.push_back(Descriptor(Descriptor::kS2S));
+
+  DenseViterbiAlgorithm<Rain, Umbrella, Descriptor> viterbi;
+  viterbi.StartWithInitialObservation(Umbrella(Umbrella::kYesUmbr), candidates,
+                                      emissionLogProbabilitiesForUmbrella);
+  viterbi.NextStep(Umbrella(Umbrella::kYesUmbr), candidates,
+                   emissionLogProbabilitiesForUmbrella,
+                   transitionLogProbabilities, transitionDescriptors);
+  viterbi.NextStep(Umbrella(Umbrella::kNoUmbr), candidates,
+                   emissionLogProbabilitiesForNoUmbrella,
+                   transitionLogProbabilities, transitionDescriptors);
+  viterbi.NextStep(Umbrella(Umbrella::kYesUmbr), candidates,
+                   emissionLogProbabilitiesForUmbrella,
+                   transitionLogProbabilities, transitionDescriptors);
+  auto result = viterbi.ComputeMostLikelySequence();
+
+  if (result.size() != 4) {
+    Fail(
+        "ERR: Result count must be 4, but %d. "
+        "TestDenseComputeMostLikelySequence()\n",
+        (int)result.size());
+    return;
+  }
+  const std::string expectedStates[] = {Rain::kRain, Rain::kRain, Rain::kSun,
+                                        Rain::kRain};
+  const std::string expectedDescriptors[] = {"", Descriptor::kR2R,
+                                             Descriptor::kR2S, Descriptor::kS2R};
+  for (int i = 0; i < 4; i++) {
+    if (result.at(i).state.weather_ != expectedStates[i]) {
+      Fail(
+          "ERR: Rain Index %d must be %s, but %s. "
+          "TestDenseComputeMostLikelySequence()\n",
+          i, expectedStates[i].c_str(), result.at(i).state.weather_.c_str());
+    }
+    if (result.at(i).transitionDescriptor.desc_ != expectedDescriptors[i]) {
+      Fail(
+          "ERR: Descriptor Index %d must be %s, but %s. "
+          "TestDenseComputeMostLikelySequence()\n",
+          i, expectedDescriptors[i].c_str(),
+          result.at(i).transitionDescriptor.desc_.c_str());
+    }
+  }
+  if (viterbi.IsBroken()) {
+    Fail("ERR: Viterbi was BROKEN!!! TestDenseComputeMostLikelySequence()\n");
+  }
+  printf("TestDenseComputeMostLikelySequence() GOOD: done.\n");
+}
+void TestMain::TestDenseMatchesMapBasedViterbi() {
+  // Log probabilities are drawn from a small set so that ties occur often.
+  const double kLogProbabilities[] = {
+      log(0.5), log(0.25), log(0.125), -std::numeric_limits<double>::infinity()};
+  std::mt19937 random(42);
+  int mismatches = 0;
+  for (int run = 0; run < 200; run++) {
+    ViterbiAlgorithm<int, int, int> viterbi;
+    DenseViterbiAlgorithm<int, int, int> dense;
+    std::vector<int> prevCandidates;
+    for (int t = 0; t < 12; t++) {
+      std::vector<int> candidates;
+      for (int s = 0; s < 6; s++) {
+        if (random() % 3 != 0) {
+          candidates.push_back(s);
+        }
+      }
+      std::shuffle(candidates.begin(), candidates.end(), random);
+      std::map<int, double> emissions;
+      std::vector<double> denseEmissions;
+      for (auto candidate : candidates) {
+        double logProbability = kLogProbabilities[random() % 3];
+        emissions.emplace(candidate, logProbability);
+        denseEmissions.push_back(logProbability);
+      }
+      if (t == 0) {
+        viterbi.StartWithInitialObservation(t, candidates, emissions);
+        dense.StartWithInitialObservation(t, candidates, denseEmissions);
+      } else {
+        std::map<Transition<int>, double> transitions;
+        std::map<Transition<int>, int> descriptors;
+        std::vector<double> denseTransitions;
+        std::vector<int> denseDescriptors;
+        for (auto prev : prevCandidates) {
+          for (auto cur : candidates) {
+            double logProbability = kLogProbabilities[random() % 4];
+            int descriptor = prev * 10 + cur;
+            if (logProbability != -std::numeric_limits<double>::infinity()) {
+              transitions.emplace(Transition<int>(prev, cur), logProbability);
+            }
+            descriptors.emplace(Transition<int>(prev, cur), descriptor);
+            denseTransitions.push_back(logProbability);
+            denseDescriptors.push_back(descriptor);
+          }
+        }
+        viterbi.NextStep(t, candidates, emissions, transitions, descriptors);
+        dense.NextStep(t, candidates, denseEmissions, denseTransitions,
+                       denseDescriptors);
+      }
+      prevCandidates = candidates;
+    }
+    auto expected = viterbi.ComputeMostLikelySequence();
+    auto actual = dense.ComputeMostLikelySequence();
+    bool same = expected.size() == actual.size() &&
+                viterbi.IsBroken() == dense.IsBroken();
+    for (size_t i = 0; same && i < expected.size(); i++) {
+      same = expected[i] == actual[i];
+    }
+    if (!same) {
+      mismatches++;
+    }
+  }
+  if (mismatches == 0) {
+    printf("TestDenseMatchesMapBasedViterbi() GOOD: results are identical.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestDenseMatchesMapBasedViterbi()\n",
+         mismatches);
+  }
+}
+void TestMain::TestMaxPlusKernel() {
+  const double kValues[] = {log(0.5), log(0.25), 0.0,
+                            -std::numeric_limits<double>::infinity()};
+  const SimdLevel detected = DetectSimdLevel();
+  std::mt19937 random(7);
+  for (int level = 0; level <= static_cast<int>(detected); level++) {
+    SetSimdLevel(static_cast<SimdLevel>(level));
+    int mismatches = 0;
+    for (size_t n = 0; n < 40; n++) {
+      std::vector<double> best(n, -std::numeric_limits<double>::infinity());
+      std::vector<int> argmax(n, -1);
+      std::vector<double> expectedBest(best);
+      std::vector<int> expectedArgmax(argmax);
+      for (int p = 0; p < 5; p++) {
+        double base = kValues[random() % 4];
+        std::vector<double> row;
+        for (size_t c = 0; c < n; c++) {
+          row.push_back(kValues[random() % 4]);
+        }
+        for (size_t c = 0; c < n; c++) {
+          if (base + row[c] > expectedBest[c]) {
+            expectedBest[c] = base + row[c];
+            expectedArgmax[c] = p;
+          }
+        }
+        MaxPlusRowUpdate(base, row.data(), n, p, best.data(), argmax.data());
+      }
+      if (best != expectedBest || argmax != expectedArgmax) {
+        mismatches++;
+      }
+    }
+    if (mismatches == 0) {
+      printf("TestMaxPlusKernel() GOOD: %s kernel matches scalar loop.\n",
+             SimdLevelName(ActiveSimdLevel()));
+    } else {
+      Fail("ERR: %s kernel has %d mismatches. TestMaxPlusKernel()\n",
+           SimdLevelName(ActiveSimdLevel()), mismatches);
+    }
+  }
+  SetSimdLevel(detected);
+}
+void TestMain::TestLongSequenceAndReset() {
+  std::vector<Rain> candidates;
+  candidates.push_back(Rain(Rain::kRain));
+  candidates.push_back(Rain(Rain::kSun));
+  std::map<Rain, double> emissionLogProbabilities;
+  emissionLogProbabilities.emplace(Rain(Rain::kRain), log(0.9));
+  emissionLogProbabilities.emplace(Rain(Rain::kSun), log(0.2));
+  std::map<Transition<Rain>, double> transitionLogProbabilities;
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kRain), Rain(Rain::kRain)), log(0.7));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kRain), Rain(Rain::kSun)), log(0.3));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kSun), Rain(Rain::kRain)), log(0.3));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kSun), Rain(Rain::kSun)), log(0.7));
+
+  // Long back pointer chains must neither be torn down recursively nor
+  // double-freed when the decoder is reset or destroyed.
+  const int kSteps = 50000;
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> viterbi;
+  for (int run = 0; run < 2; run++) {
+    viterbi.Reset();
+    viterbi.StartWithInitialObservation(Umbrella(Umbrella::kYesUmbr),
+                                        candidates, emissionLogProbabilities);
+    for (int t = 0; t < kSteps; t++) {
+      viterbi.NextStep(Umbrella(Umbrella::kYesUmbr), candidates,
+                       emissionLogProbabilities, transitionLogProbabilities);
+    }
+    auto result = viterbi.ComputeMostLikelySequence();
+    if (result.size() != kSteps + 1 || viterbi.IsBroken()) {
+      Fail("ERR: Result count must be %d, but %d. "
+           "TestLongSequenceAndReset()\n",
+           kSteps + 1, (int)result.size());
+      return;
+    }
+  }
+  printf("TestLongSequenceAndReset() GOOD: long sequence decoded twice.\n");
+}
+void TestMain::TestBackPointerReclamation() {
+  std::vector<Rain> candidates;
+  candidates.push_back(Rain(Rain::kRain));
+  candidates.push_back(Rain(Rain::kSun));
+  std::map<Rain, double> emissionLogProbabilitiesForUmbrella;
+  emissionLogProbabilitiesForUmbrella.emplace(Rain(Rain::kRain), log(0.9));
+  emissionLogProbabilitiesForUmbrella.emplace(Rain(Rain::kSun), log(0.2));
+  std::map<Rain, double> emissionLogProbabilitiesForNoUmbrella;
+  emissionLogProbabilitiesForNoUmbrella.emplace(Rain(Rain::kRain), log(0.1));
+  emissionLogProbabilitiesForNoUmbrella.emplace(Rain(Rain::kSun), log(0.8));
+  std::map<Transition<Rain>, double> transitionLogProbabilities;
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kRain), Rain(Rain::kRain)), log(0.7));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kRain), Rain(Rain::kSun)), log(0.3));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kSun), Rain(Rain::kRain)), log(0.3));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kSun), Rain(Rain::kSun)), log(0.7));
+
+  const int kSteps = 1000;
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> viterbi;
+  viterbi.StartWithInitialObservation(Umbrella(Umbrella::kYesUmbr), candidates,
+                                      emissionLogProbabilitiesForUmbrella);
+  size_t maxLiveStates = 0;
+  for (int t = 0; t < kSteps; t++) {
+    if (t % 7 < 4) {
+      viterbi.NextStep(Umbrella(Umbrella::kYesUmbr), candidates,
+                       emissionLogProbabilitiesForUmbrella,
+                       transitionLogProbabilities);
+    } else {
+      viterbi.NextStep(Umbrella(Umbrella::kNoUmbr), candidates,
+                       emissionLogProbabilitiesForNoUmbrella,
+                       transitionLogProbabilities);
+    }
+    maxLiveStates = std::max(maxLiveStates, viterbi.LiveExtendedStateCount());
+  }
+  // Back pointers converge after a few steps, so only the surviving path plus
+  // a few diverging branches are alive instead of all 2 * kSteps states.
+  if (maxLiveStates <= kSteps + 10) {
+    printf("TestBackPointerReclamation() GOOD: at most %d live states.\n",
+           (int)maxLiveStates);
+  } else {
+    Fail("ERR: %d live states. TestBackPointerReclamation()\n",
+         (int)maxLiveStates);
+  }
+  if (viterbi.ComputeMostLikelySequence().size() != kSteps + 1) {
+    Fail("ERR: Result count must be %d. TestBackPointerReclamation()\n",
+         kSteps + 1);
+  }
+  viterbi.Reset();
+  if (viterbi.LiveExtendedStateCount() == 0) {
+    printf("TestBackPointerReclamation() GOOD: no live states after Reset.\n");
+  }
+}
+void TestMain::TestOnlineDecoding() {
+  std::vector<Rain> candidates;
+  candidates.push_back(Rain(Rain::kRain));
+  candidates.push_back(Rain(Rain::kSun));
+  std::map<Rain, double> emissionLogProbabilitiesForUmbrella;
+  emissionLogProbabilitiesForUmbrella.emplace(Rain(Rain::kRain), log(0.9));
+  emissionLogProbabilitiesForUmbrella.emplace(Rain(Rain::kSun), log(0.2));
+  std::map<Rain, double> emissionLogProbabilitiesForNoUmbrella;
+  emissionLogProbabilitiesForNoUmbrella.emplace(Rain(Rain::kRain), log(0.1));
+  emissionLogProbabilitiesForNoUmbrella.emplace(Rain(Rain::kSun), log(0.8));
+  std::map<Transition<Rain>, double> transitionLogProbabilities;
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kRain), Rain(Rain::kRain)), log(0.7));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kRain), Rain(Rain::kSun)), log(0.3));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kSun), Rain(Rain::kRain)), log(0.3));
+  transitionLogProbabilities.emplace(
+      Transition<Rain>(Rain(Rain::kSun), Rain(Rain::kSun)), log(0.7));
+
+  typedef SequenceState<Rain, Umbrella, Descriptor> State;
+  const int kSteps = 300;
+  const int kMaxLag = 3;
+  std::vector<State> committed;
+  std::vector<State> lagCommitted;
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> offline;
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> online;
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> fixedLag;
+  online.SetOnlineDecoding([&committed](const std::vector<State>& prefix) {
+    committed.insert(committed.end(), prefix.begin(), prefix.end());
+  });
+  fixedLag.SetOnlineDecoding(
+      [&lagCommitted](const std::vector<State>& prefix) {
+        lagCommitted.insert(lagCommitted.end(), prefix.begin(), prefix.end());
+      },
+      kMaxLag);
+  offline.StartWithInitialObservation(Umbrella(Umbrella::kYesUmbr), candidates,
+                                      emissionLogProbabilitiesForUmbrella);
+  online.StartWithInitialObservation(Umbrella(Umbrella::kYesUmbr), candidates,
+                                     emissionLogProbabilitiesForUmbrella);
+  fixedLag.StartWithInitialObservation(Umbrella(Umbrella::kYesUmbr),
+                                       candidates,
+                                       emissionLogProbabilitiesForUmbrella);
+  std::mt19937 random(3);
+  size_t maxLiveStates = 0;
+  int maxPending = 0;
+  for (int t = 0; t < kSteps; t++) {
+    const bool umbrella = random() % 2 == 0;
+    Umbrella observation(umbrella ? Umbrella::kYesUmbr : Umbrella::kNoUmbr);
+    std::map<Rain, double>& emissionLogProbabilities =
+        umbrella ? emissionLogProbabilitiesForUmbrella
+                 : emissionLogProbabilitiesForNoUmbrella;
+    offline.NextStep(observation, candidates, emissionLogProbabilities,
+                     transitionLogProbabilities);
+    online.NextStep(observation, candidates, emissionLogProbabilities,
+                    transitionLogProbabilities);
+    fixedLag.NextStep(observation, candidates, emissionLogProbabilities,
+                      transitionLogProbabilities);
+    maxLiveStates = std::max(maxLiveStates, online.LiveExtendedStateCount());
+    maxPending = std::max(
+        maxPending, (int)fixedLag.ComputeMostLikelySequence().size());
+  }
+  auto expected = offline.ComputeMostLikelySequence();
+  auto rest = online.ComputeMostLikelySequence();
+  committed.insert(committed.end(), rest.begin(), rest.end());
+  bool same = expected.size() == committed.size();
+  for (size_t i = 0; same && i < expected.size(); i++) {
+    same = expected[i] == committed[i];
+  }
+  if (same) {
+    printf("TestOnlineDecoding() GOOD: committed prefixes match offline.\n");
+  } else {
+    Fail("ERR: committed prefixes differ from offline result. "
+         "TestOnlineDecoding()\n");
+  }
+  if (maxLiveStates < 20) {
+    printf("TestOnlineDecoding() GOOD: at most %d live states.\n",
+           (int)maxLiveStates);
+  } else {
+    Fail("ERR: %d live states. TestOnlineDecoding()\n", (int)maxLiveStates);
+  }
+  rest = fixedLag.ComputeMostLikelySequence();
+  lagCommitted.insert(lagCommitted.end(), rest.begin(), rest.end());
+  if (maxPending <= kMaxLag && lagCommitted.size() == kSteps + 1) {
+    printf("TestOnlineDecoding() GOOD: max lag is respected.\n");
+  } else {
+    Fail("ERR: %d pending, %d total states. TestOnlineDecoding()\n",
+         maxPending, (int)lagCommitted.size());
+  }
+}
+void TestMain::TestBatchViterbi() {
+  const double kLogProbabilities[] = {
+      log(0.5), log(0.25), log(0.125), -std::numeric_limits<double>::infinity()};
+  std::mt19937 random(11);
+  std::vector<std::vector<ViterbiStep<int, int, int>>> sequences(40);
+  for (auto& sequence : sequences) {
+    // Very different lengths, including empty sequences.
+    const int length = random() % 3 == 0 ? random() % 200 : random() % 10;
+    std::vector<int> prevCandidates;
+    for (int t = 0; t < length; t++) {
+      ViterbiStep<int, int, int> step;
+      step.observation = t;
+      for (int s = 0; s < 4; s++) {
+        if (random() % 4 != 0) {
+          step.candidates.push_back(s);
+          step.emissionLogProbabilities.emplace(
+              s, kLogProbabilities[random() % 3]);
+        }
+      }
+      for (auto prev : prevCandidates) {
+        for (auto cur : step.candidates) {
+          double logProbability = kLogProbabilities[random() % 4];
+          if (logProbability != -std::numeric_limits<double>::infinity()) {
+            step.transitionLogProbabilities.emplace(Transition<int>(prev, cur),
+                                                    logProbability);
+          }
+          step.transitionDescriptors.emplace(Transition<int>(prev, cur),
+                                             prev * 10 + cur);
+        }
+      }
+      prevCandidates = step.candidates;
+      sequence.push_back(step);
+    }
+  }
+
+  ThreadPool pool(4);
+  BatchViterbi<int, int, int> batch(&pool);
+  auto results = batch.Decode(sequences);
+  int mismatches = 0;
+  for (size_t i = 0; i < sequences.size(); i++) {
+    ViterbiAlgorithm<int, int, int> viterbi;
+    for (size_t t = 0; t < sequences[i].size(); t++) {
+      ViterbiStep<int, int, int>& step = sequences[i][t];
+      if (t == 0) {
+        viterbi.StartWithInitialObservation(step.observation, step.candidates,
+                                            step.emissionLogProbabilities);
+      } else {
+        viterbi.NextStep(step.observation, step.candidates,
+                         step.emissionLogProbabilities,
+                         step.transitionLogProbabilities,
+                         step.transitionDescriptors);
+      }
+    }
+    auto expected = viterbi.ComputeMostLikelySequence();
+    bool same = expected.size() == results[i].sequence.size() &&
+                viterbi.IsBroken() == results[i].isBroken;
+    for (size_t j = 0; same && j < expected.size(); j++) {
+      same = expected[j] == results[i].sequence[j];
+    }
+    if (!same) {
+      mismatches++;
+    }
+  }
+  if (results.size() == sequences.size() && mismatches == 0) {
+    printf("TestBatchViterbi() GOOD: results match sequential decoding.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestBatchViterbi()\n", mismatches);
+  }
+}
+void TestMain::TestPruning() {
+  const int kStates = 8;
+  const int kSteps = 50;
+  const int kMaxStates = 3;
+  std::mt19937 random(5);
+  std::vector<int> candidates;
+  for (int s = 0; s < kStates; s++) {
+    candidates.push_back(s);
+  }
+  std::vector<std::map<int, double>> emissions(kSteps);
+  std::map<Transition<int>, double> transitionLogProbabilities;
+  for (auto& emission : emissions) {
+    for (auto candidate : candidates) {
+      emission.emplace(candidate, -(double)(random() % 50) / 10.0);
+    }
+  }
+  for (auto prev : candidates) {
+    for (auto cur : candidates) {
+      transitionLogProbabilities.emplace(Transition<int>(prev, cur),
+                                         -(double)(random() % 50) / 10.0);
+    }
+  }
+
+  // Pruned states of each time step.
+  class PruningObserver : public ViterbiObserver {
+   public:
+    std::vector<size_t> counts;
+    void OnStep(const ViterbiStepMetrics& metrics) override {
+      counts.push_back(metrics.prunedStates);
+    }
+  };
+  PruningObserver observer;
+  ViterbiAlgorithm<int, int, int> unpruned;
+  ViterbiAlgorithm<int, int, int> wideBeam;
+  ViterbiAlgorithm<int, int, int> topK;
+  wideBeam.SetPruning(kStates, 1e9);
+  topK.SetPruning(kMaxStates, 2.0);
+  topK.SetObserver(&observer);
+  unpruned.StartWithInitialObservation(0, candidates, emissions[0]);
+  wideBeam.StartWithInitialObservation(0, candidates, emissions[0]);
+  topK.StartWithInitialObservation(0, candidates, emissions[0]);
+  for (int t = 1; t < kSteps; t++) {
+    unpruned.NextStep(t, candidates, emissions[t], transitionLogProbabilities);
+    wideBeam.NextStep(t, candidates, emissions[t], transitionLogProbabilities);
+    topK.NextStep(t, candidates, emissions[t], transitionLogProbabilities);
+  }
+
+  // A beam that never prunes must not change the result.
+  auto expected = unpruned.ComputeMostLikelySequence();
+  auto actual = wideBeam.ComputeMostLikelySequence();
+  bool same = expected.size() == actual.size();
+  for (size_t i = 0; same && i < expected.size(); i++) {
+    same = expected[i] == actual[i];
+  }
+  if (same && wideBeam.PrunedStateCount() == 0) {
+    printf("TestPruning() GOOD: wide beam keeps the result.\n");
+  } else {
+    Fail("ERR: wide beam changed the result. TestPruning()\n");
+  }
+
+  const std::vector<size_t>& counts = observer.counts;
+  bool countsOk = counts.size() == kSteps;
+  size_t total = 0;
+  for (size_t t = 0; countsOk && t < counts.size(); t++) {
+    countsOk = counts[t] >= kStates - kMaxStates;
+    total += counts[t];
+  }
+  countsOk = countsOk && topK.PrunedStateCount() == total;
+  if (countsOk && topK.ComputeMostLikelySequence().size() == kSteps &&
+      !topK.IsBroken()) {
+    printf("TestPruning() GOOD: top-K prunes every step.\n");
+  } else {
+    Fail("ERR: unexpected pruned state counts. TestPruning()\n");
+  }
+}
+void TestMain::TestSparseTransitions() {
+  const double kLogProbabilities[] = {log(0.5), log(0.25), log(0.125)};
+  std::mt19937 random(13);
+  int mismatches = 0;
+  for (int run = 0; run < 100; run++) {
+    DenseViterbiAlgorithm<int, int, int> dense;
+    DenseViterbiAlgorithm<int, int, int> sparse;
+    std::vector<int> prevCandidates;
+    for (int t = 0; t < 15; t++) {
+      std::vector<int> candidates;
+      std::vector<double> emissions;
+      for (int s = 0; s < 8; s++) {
+        if (random() % 4 != 0) {
+          candidates.push_back(s);
+          emissions.push_back(kLogProbabilities[random() % 3]);
+        }
+      }
+      if (t == 0) {
+        dense.StartWithInitialObservation(t, candidates, emissions);
+        sparse.StartWithInitialObservation(t, candidates, emissions);
+      } else {
+        const size_t numCur = candidates.size();
+        std::vector<double> denseTransitions(
+            prevCandidates.size() * numCur,
+            -std::numeric_limits<double>::infinity());
+        std::vector<int> denseDescriptors(denseTransitions.size());
+        SparseTransitions<int> transitions;
+        for (size_t c = 0; c < numCur; c++) {
+          // Only a few predecessors per candidate, in reverse order.
+          for (size_t p = prevCandidates.size(); p-- > 0;) {
+            if (random() % 3 != 0) {
+              continue;
+            }
+            double logProbability = kLogProbabilities[random() % 3];
+            int descriptor = prevCandidates[p] * 10 + candidates[c];
+            denseTransitions[p * numCur + c] = logProbability;
+            denseDescriptors[p * numCur + c] = descriptor;
+            transitions.AddTransition((int)p, logProbability, descriptor);
+          }
+          transitions.EndCandidate();
+        }
+        dense.NextStep(t, candidates, emissions, denseTransitions,
+                       denseDescriptors);
+        sparse.NextStep(t, candidates, emissions, transitions);
+      }
+      prevCandidates = candidates;
+    }
+    auto expected = dense.ComputeMostLikelySequence();
+    auto actual = sparse.ComputeMostLikelySequence();
+    bool same = expected.size() == actual.size() &&
+                dense.IsBroken() == sparse.IsBroken();
+    for (size_t i = 0; same && i < expected.size(); i++) {
+      same = expected[i] == actual[i];
+    }
+    if (!same) {
+      mismatches++;
+    }
+  }
+  if (mismatches == 0) {
+    printf("TestSparseTransitions() GOOD: sparse matches dense.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestSparseTransitions()\n", mismatches);
+  }
+}
+void TestMain::TestLazyTransitionProvider() {
+  const double kLogProbabilities[] = {log(0.5), log(0.25), log(0.125)};
+  std::mt19937 random(17);
+  int mismatches = 0;
+  long long providerCalls = 0;
+  long long pairs = 0;
+  for (int run = 0; run < 100; run++) {
+    ViterbiAlgorithm<int, int, int> eager;
+    ViterbiAlgorithm<int, int, int> lazy;
+    std::map<Transition<int>, double> transitionLogProbabilities;
+    std::vector<int> prevCandidates;
+    for (int t = 0; t < 15; t++) {
+      std::vector<int> candidates;
+      std::map<int, double> emissions;
+      for (int s = 0; s < 8; s++) {
+        if (random() % 4 != 0) {
+          candidates.push_back(s);
+          emissions[s] = kLogProbabilities[random() % 3];
+        }
+      }
+      if (t == 0) {
+        eager.StartWithInitialObservation(t, candidates, emissions);
+        lazy.StartWithInitialObservation(t, candidates, emissions);
+      } else {
+        transitionLogProbabilities.clear();
+        std::map<Transition<int>, int> transitionDescriptors;
+        for (auto& prevState : prevCandidates) {
+          for (auto& curState : candidates) {
+            if (random() % 3 == 0) {
+              continue;
+            }
+            const Transition<int> transition(prevState, curState);
+            transitionLogProbabilities[transition] =
+                kLogProbabilities[random() % 3];
+            transitionDescriptors[transition] = prevState * 10 + curState;
+          }
+        }
+        pairs += prevCandidates.size() * candidates.size();
+        eager.NextStep(t, candidates, emissions, transitionLogProbabilities,
+                       transitionDescriptors);
+        lazy.NextStep(
+            t, candidates, emissions,
+            [&](const int& from, const int& to) {
+              providerCalls++;
+              auto found =
+                  transitionLogProbabilities.find(Transition<int>(from, to));
+              return found == transitionLogProbabilities.end()
+                         ? -std::numeric_limits<double>::infinity()
+                         : found->second;
+            },
+            [](const int& from, const int& to) { return from * 10 + to; });
+      }
+      prevCandidates = candidates;
+    }
+    auto expected = eager.ComputeMostLikelySequence();
+    auto actual = lazy.ComputeMostLikelySequence();
+    bool same = expected.size() == actual.size() &&
+                eager.IsBroken() == lazy.IsBroken();
+    for (size_t i = 0; same && i < expected.size(); i++) {
+      same = expected[i] == actual[i];
+    }
+    if (!same) {
+      mismatches++;
+    }
+  }
+  if (mismatches != 0) {
+    Fail("ERR: %d mismatches. TestLazyTransitionProvider()\n", mismatches);
+  } else if (providerCalls >= pairs) {
+    Fail("ERR: %lld of %lld transitions requested. "
+         "TestLazyTransitionProvider()\n",
+         providerCalls, pairs);
+  } else {
+    printf("TestLazyTransitionProvider() GOOD: lazy matches eager, "
+           "%lld of %lld transitions requested.\n",
+           providerCalls, pairs);
+  }
+}
+void TestMain::TestParallelForwardStep() {
+  ThreadPool pool(3);
+  std::mt19937 random(19);
+  std::uniform_real_distribution<double> logProbability(-20.0, 0.0);
+  int mismatches = 0;
+  for (int run = 0; run < 5; run++) {
+    // Threshold 100 lets some steps run serially and some in parallel.
+    DenseViterbiAlgorithm<int, int, int> dense;
+    DenseViterbiAlgorithm<int, int, int> denseParallel;
+    denseParallel.SetThreadPool(&pool, 100);
+    DenseViterbiAlgorithm<int, int, int> sparse;
+    DenseViterbiAlgorithm<int, int, int> sparseParallel;
+    sparseParallel.SetThreadPool(&pool, 100);
+    ViterbiAlgorithm<int, int, int> viterbi;
+    ViterbiAlgorithm<int, int, int> viterbiParallel;
+    viterbiParallel.SetThreadPool(&pool, 100);
+    size_t numPrev = 0;
+    for (int t = 0; t < 10; t++) {
+      const size_t numCur = 50 + random() % 200;
+      std::vector<int> candidates;
+      std::vector<double> emissions;
+      std::map<int, double> emissionMap;
+      for (size_t c = 0; c < numCur; c++) {
+        candidates.push_back((int)c);
+        emissions.push_back(logProbability(random));
+        emissionMap[(int)c] = emissions.back();
+      }
+      if (t == 0) {
+        dense.StartWithInitialObservation(t, candidates, emissions);
+        denseParallel.StartWithInitialObservation(t, candidates, emissions);
+        sparse.StartWithInitialObservation(t, candidates, emissions);
+        sparseParallel.StartWithInitialObservation(t, candidates, emissions);
+        viterbi.StartWithInitialObservation(t, candidates, emissionMap);
+        viterbiParallel.StartWithInitialObservation(t, candidates,
+                                                    emissionMap);
+      } else {
+        std::vector<double> transitions(
+            numPrev * numCur, -std::numeric_limits<double>::infinity());
+        std::vector<int> descriptors(transitions.size());
+        std::map<Transition<int>, double> transitionMap;
+        std::map<Transition<int>, int> descriptorMap;
+        SparseTransitions<int> sparseTransitions;
+        for (size_t c = 0; c < numCur; c++) {
+          for (size_t p = 0; p < numPrev; p++) {
+            if (random() % 4 != 0) {
+              continue;
+            }
+            const double value = logProbability(random);
+            const int descriptor = (int)(p * 1000 + c);
+            transitions[p * numCur + c] = value;
+            descriptors[p * numCur + c] = descriptor;
+            const Transition<int> transition((int)p, (int)c);
+            transitionMap[transition] = value;
+            descriptorMap[transition] = descriptor;
+            sparseTransitions.AddTransition((int)p, value, descriptor);
+          }
+          sparseTransitions.EndCandidate();
+        }
+        dense.NextStep(t, candidates, emissions, transitions, descriptors);
+        denseParallel.NextStep(t, candidates, emissions, transitions,
+                               descriptors);
+        sparse.NextStep(t, candidates, emissions, sparseTransitions);
+        sparseParallel.NextStep(t, candidates, emissions, sparseTransitions);
+        viterbi.NextStep(t, candidates, emissionMap, transitionMap,
+                         descriptorMap);
+        viterbiParallel.NextStep(t, candidates, emissionMap, transitionMap,
+                                 descriptorMap);
+      }
+      numPrev = numCur;
+    }
+    auto expected = dense.ComputeMostLikelySequence();
+    std::vector<std::vector<SequenceState<int, int, int>>> actual;
+    actual.push_back(denseParallel.ComputeMostLikelySequence());
+    actual.push_back(sparse.ComputeMostLikelySequence());
+    actual.push_back(sparseParallel.ComputeMostLikelySequence());
+    actual.push_back(viterbi.ComputeMostLikelySequence());
+    actual.push_back(viterbiParallel.ComputeMostLikelySequence());
+    for (auto& sequence : actual) {
+      bool same = expected.size() == sequence.size();
+      for (size_t i = 0; same && i < expected.size(); i++) {
+        same = expected[i] == sequence[i];
+      }
+      if (!same) {
+        mismatches++;
+      }
+    }
+  }
+  if (mismatches == 0) {
+    printf("TestParallelForwardStep() GOOD: parallel matches serial.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestParallelForwardStep()\n", mismatches);
+  }
+}
+void TestMain::TestKBestViterbi() {
+  const double kLogProbabilities[] = {log(0.5), log(0.25), log(0.125),
+                                      log(0.1)};
+  const int kSteps = 5;
+  const int kBest = 6;
+  std::mt19937 random(23);
+  int mismatches = 0;
+  for (int run = 0; run < 100; run++) {
+    KBestViterbiAlgorithm<int, int, int> kBestViterbi(kBest);
+    KBestViterbiAlgorithm<int, int, int> oneBestViterbi(1);
+    ViterbiAlgorithm<int, int, int> viterbi;
+    // All sequences with non-zero probability and their log probabilities,
+    // summed in the same order as the forward step.
+    std::vector<std::pair<double, std::vector<int>>> paths;
+    for (int t = 0; t < kSteps; t++) {
+      std::vector<int> candidates;
+      std::map<int, double> emissions;
+      for (int s = 0; s < 4; s++) {
+        if (random() % 4 != 0) {
+          candidates.push_back(s);
+          emissions[s] = kLogProbabilities[random() % 4];
+        }
+      }
+      if (t == 0) {
+        kBestViterbi.StartWithInitialObservation(t, candidates, emissions);
+        oneBestViterbi.StartWithInitialObservation(t, candidates, emissions);
+        viterbi.StartWithInitialObservation(t, candidates, emissions);
+        for (auto& s : candidates) {
+          paths.push_back(std::make_pair(emissions[s], std::vector<int>(1, s)));
+        }
+        continue;
+      }
+      std::map<Transition<int>, double> transitions;
+      std::map<Transition<int>, int> descriptors;
+      for (int from = 0; from < 4; from++) {
+        for (auto& to : candidates) {
+          if (random() % 3 != 0) {
+            transitions[Transition<int>(from, to)] =
+                kLogProbabilities[random() % 4];
+            descriptors[Transition<int>(from, to)] = from * 10 + to;
+          }
+        }
+      }
+      kBestViterbi.NextStep(t, candidates, emissions, transitions,
+                            descriptors);
+      oneBestViterbi.NextStep(t, candidates, emissions, transitions,
+                              descriptors);
+      viterbi.NextStep(t, candidates, emissions, transitions, descriptors);
+      std::vector<std::pair<double, std::vector<int>>> extended;
+      for (auto& path : paths) {
+        for (auto& to : candidates) {
+          auto found = transitions.find(Transition<int>(path.second.back(), to));
+          if (found == transitions.end()) {
+            continue;
+          }
+          extended.push_back(path);
+          extended.back().first =
+              path.first + found->second + emissions[to];
+          extended.back().second.push_back(to);
+        }
+      }
+      if (extended.empty()) {
+        // HMM break, the sequences end at the previous time step.
+        break;
+      }
+      paths.swap(extended);
+    }
+    std::vector<double> expected;
+    for (auto& path : paths) {
+      expected.push_back(path.first);
+    }
+    std::sort(expected.rbegin(), expected.rend());
+    if (expected.size() > (size_t)kBest) {
+      expected.resize(kBest);
+    }
+    auto actual = kBestViterbi.ComputeMostLikelySequences();
+    bool same = actual.size() == expected.size();
+    for (size_t i = 0; same && i < actual.size(); i++) {
+      // Each sequence is distinct and has the reported log probability.
+      bool found = false;
+      for (auto& path : paths) {
+        bool samePath = path.second.size() == actual[i].sequence.size();
+        for (size_t j = 0; samePath && j < path.second.size(); j++) {
+          samePath = path.second[j] == actual[i].sequence[j].state;
+        }
+        found = found || (samePath && path.first == actual[i].logProbability);
+      }
+      for (size_t j = 0; j < i; j++) {
+        found = found && !(actual[j].sequence == actual[i].sequence);
+      }
+      same = found && actual[i].logProbability == expected[i];
+    }
+    // The best of one is the Viterbi sequence.
+    auto best = oneBestViterbi.ComputeMostLikelySequences();
+    auto viterbiSequence = viterbi.ComputeMostLikelySequence();
+    same = same && !actual.empty() && best.size() == 1 &&
+           best[0].sequence == viterbiSequence &&
+           actual[0].logProbability == best[0].logProbability;
+    if (!same) {
+      mismatches++;
+    }
+  }
+  if (mismatches == 0) {
+    printf("TestKBestViterbi() GOOD: k best sequences found.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestKBestViterbi()\n", mismatches);
+  }
+}
+void TestMain::TestForwardBackward() {
+  const double kLogProbabilities[] = {log(0.5), log(0.25), log(0.125),
+                                      log(0.1)};
+  std::mt19937 random(29);
+  int mismatches = 0;
+  for (int run = 0; run < 100; run++) {
+    ForwardBackwardAlgorithm<int, int> forwardBackward;
+    // All sequences with non-zero probability and their probabilities.
+    std::vector<std::pair<double, std::vector<int>>> paths;
+    for (int t = 0; t < 5; t++) {
+      std::vector<int> candidates;
+      std::map<int, double> emissions;
+      for (int s = 0; s < 4; s++) {
+        if (random() % 4 != 0) {
+          candidates.push_back(s);
+          // A missing emission counts as log probability 0, see
+          // emissions[to] below.
+          if (t == 0 || random() % 5 != 0) {
+            emissions[s] = kLogProbabilities[random() % 4];
+          }
+        }
+      }
+      if (t == 0) {
+        forwardBackward.StartWithInitialObservation(t, candidates, emissions);
+        for (auto& s : candidates) {
+          paths.push_back(
+              std::make_pair(exp(emissions[s]), std::vector<int>(1, s)));
+        }
+        continue;
+      }
+      std::map<Transition<int>, double> transitions;
+      for (int from = 0; from < 4; from++) {
+        for (auto& to : candidates) {
+          if (random() % 3 != 0) {
+            transitions[Transition<int>(from, to)] =
+                kLogProbabilities[random() % 4];
+          }
+        }
+      }
+      forwardBackward.NextStep(t, candidates, emissions, transitions);
+      std::vector<std::pair<double, std::vector<int>>> extended;
+      for (auto& path : paths) {
+        for (auto& to : candidates) {
+          auto found = transitions.find(Transition<int>(path.second.back(), to));
+          if (found == transitions.end()) {
+            continue;
+          }
+          extended.push_back(path);
+          extended.back().first *= exp(found->second + emissions[to]);
+          extended.back().second.push_back(to);
+        }
+      }
+      if (extended.empty()) {
+        // HMM break, the posteriors end at the previous time step.
+        break;
+      }
+      paths.swap(extended);
+    }
+    double likelihood = 0.0;
+    for (auto& path : paths) {
+      likelihood += path.first;
+    }
+    std::vector<std::map<int, double>> expected(
+        paths.empty() ? 0 : paths[0].second.size());
+    for (auto& path : paths) {
+      for (size_t t = 0; t < path.second.size(); t++) {
+        expected[t][path.second[t]] += path.first / likelihood;
+      }
+    }
+    auto actual = forwardBackward.ComputePosteriorProbabilities();
+    bool same = actual.size() == expected.size() &&
+                (paths.empty() ||
+                 fabs(forwardBackward.LogLikelihood() - log(likelihood)) <
+                     1e-9);
+    for (size_t t = 0; same && t < actual.size(); t++) {
+      double sum = 0.0;
+      for (auto& entry : actual[t]) {
+        sum += entry.second;
+        same = same && fabs(entry.second - expected[t][entry.first]) < 1e-9;
+      }
+      same = same && fabs(sum - 1.0) < 1e-9;
+    }
+    if (!same) {
+      mismatches++;
+    }
+  }
+  if (mismatches == 0) {
+    printf("TestForwardBackward() GOOD: posteriors match enumeration.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestForwardBackward()\n", mismatches);
+  }
+}
+void TestMain::TestCheckpointedViterbi() {
+  const double kLogProbabilities[] = {log(0.5), log(0.25), log(0.125)};
+  const size_t kIntervals[] = {0, 1, 7, 1000};
+  std::mt19937 random(31);
+  int mismatches = 0;
+  size_t maxProviderCalls = 0;
+  for (int run = 0; run < 20; run++) {
+    std::vector<ViterbiStep<int, int, int>> steps(200 + random() % 100);
+    for (size_t t = 0; t < steps.size(); t++) {
+      ViterbiStep<int, int, int>& step = steps[t];
+      step.observation = (int)t;
+      for (int s = 0; s < 6; s++) {
+        if (random() % 3 != 0) {
+          step.candidates.push_back(s);
+          step.emissionLogProbabilities[s] = kLogProbabilities[random() % 3];
+        }
+      }
+      if (t == 0) {
+        continue;
+      }
+      for (auto& from : steps[t - 1].candidates) {
+        for (auto& to : step.candidates) {
+          // Rare HMM breaks in some runs.
+          if (random() % (run % 2 == 0 ? 2 : 40) == 0) {
+            const Transition<int> transition(from, to);
+            step.transitionLogProbabilities[transition] =
+                kLogProbabilities[random() % 3];
+            step.transitionDescriptors[transition] = from * 10 + to;
+          }
+        }
+      }
+    }
+    ViterbiAlgorithm<int, int, int> viterbi;
+    viterbi.StartWithInitialObservation(steps[0].observation,
+                                        steps[0].candidates,
+                                        steps[0].emissionLogProbabilities);
+    for (size_t t = 1; t < steps.size(); t++) {
+      viterbi.NextStep(steps[t].observation, steps[t].candidates,
+                       steps[t].emissionLogProbabilities,
+                       steps[t].transitionLogProbabilities,
+                       steps[t].transitionDescriptors);
+    }
+    auto expected = viterbi.ComputeMostLikelySequence();
+    for (auto interval : kIntervals) {
+      size_t providerCalls = 0;
+      CheckpointedViterbi<int, int, int> checkpointed(interval);
+      auto actual = checkpointed.ComputeMostLikelySequence(
+          steps.size(), [&](size_t t, ViterbiStep<int, int, int>* step) {
+            providerCalls++;
+            *step = steps[t];
+          });
+      bool same = expected.size() == actual.size() &&
+                  viterbi.IsBroken() == checkpointed.IsBroken();
+      for (size_t i = 0; same && i < expected.size(); i++) {
+        same = expected[i] == actual[i];
+      }
+      if (!same) {
+        mismatches++;
+      }
+      maxProviderCalls =
+          std::max(maxProviderCalls, providerCalls * 100 / steps.size());
+    }
+  }
+  if (mismatches != 0) {
+    Fail("ERR: %d mismatches. TestCheckpointedViterbi()\n", mismatches);
+  } else if (maxProviderCalls > 200) {
+    Fail("ERR: %d%% of time steps requested. TestCheckpointedViterbi()\n",
+         (int)maxProviderCalls);
+  } else {
+    printf("TestCheckpointedViterbi() GOOD: same sequence, at most %d%% of "
+           "time steps requested.\n",
+           (int)maxProviderCalls);
+  }
+}
+void TestMain::TestMessageHistory() {
+  std::vector<int> candidates;
+  std::map<int, double> emissions;
+  std::map<Transition<int>, double> transitions;
+  for (int s = 0; s < 3; s++) {
+    candidates.push_back(s);
+    emissions[s] = log(0.5);
+    for (int to = 0; to < 3; to++) {
+      transitions[Transition<int>(s, to)] = log(s == to ? 0.5 : 0.25);
+    }
+  }
+  ViterbiAlgorithm<int, int, int> withoutHistory;
+  ViterbiAlgorithm<int, int, int> withHistory;
+  withHistory.SetKeepMessageHistory(true);
+  withoutHistory.StartWithInitialObservation(0, candidates, emissions);
+  withHistory.StartWithInitialObservation(0, candidates, emissions);
+  for (int t = 1; t < 100; t++) {
+    withoutHistory.NextStep(t, candidates, emissions, transitions);
+    withHistory.NextStep(t, candidates, emissions, transitions);
+  }
+  MessageHistoryView<int> history = withHistory.MessageHistory();
+  bool good = withoutHistory.MessageHistory().empty() && history.size() == 100;
+  for (size_t t = 0; good && t < history.size(); t++) {
+    good = history[t].size() == 3 && history[t].State(2) == 2 &&
+           history[t].LogProbability(1) == history[t].LogProbability(1) &&
+           history[t].LogProbability(3) ==
+               -std::numeric_limits<double>::infinity();
+  }
+  withHistory.Reset();
+  good = good && history.empty();
+  if (good) {
+    printf("TestMessageHistory() GOOD: history only kept if enabled.\n");
+  } else {
+    Fail("ERR: wrong message history. TestMessageHistory()\n");
+  }
+}
+void TestMain::TestAllocationFreeNextStep() {
+  const int kNumCandidates = 50;
+  std::mt19937 random(37);
+  std::uniform_real_distribution<double> logProbability(-10.0, 0.0);
+  std::vector<int> candidates;
+  std::map<int, double> emissions;
+  std::map<Transition<int>, double> transitions;
+  std::map<Transition<int>, int> descriptors;
+  for (int s = 0; s < kNumCandidates; s++) {
+    candidates.push_back(s);
+    emissions[s] = logProbability(random);
+    for (int to = 0; to < kNumCandidates; to++) {
+      transitions[Transition<int>(s, to)] = logProbability(random);
+      descriptors[Transition<int>(s, to)] = s * 100 + to;
+    }
+  }
+  const size_t numEmissions = emissions.size();
+  const size_t numDescriptors = descriptors.size();
+  ViterbiAlgorithm<int, int, int> viterbi;
+  ViterbiAlgorithm<int, int, int> moving;
+  std::vector<int> movedCandidates;
+  // Pruning only keeps a running count.
+  viterbi.SetPruning(kNumCandidates - 10);
+  moving.SetPruning(kNumCandidates - 10);
+  // A bounded lag bounds the number of live states, otherwise the object pool
+  // of the back pointers grows with the uncommitted sequence. Committed states
+  // are summed up since collecting them would allocate.
+  unsigned long committed[2] = {0, 0};
+  viterbi.SetOnlineDecoding(
+      [&committed](const std::vector<SequenceState<int, int, int>>& prefix) {
+        for (auto& ss : prefix) {
+          committed[0] = committed[0] * 31 + ss.state + ss.transitionDescriptor;
+        }
+      },
+      20);
+  moving.SetOnlineDecoding(
+      [&committed](const std::vector<SequenceState<int, int, int>>& prefix) {
+        for (auto& ss : prefix) {
+          committed[1] = committed[1] * 31 + ss.state + ss.transitionDescriptor;
+        }
+      },
+      20);
+  viterbi.StartWithInitialObservation(0, candidates, emissions);
+  moving.StartWithInitialObservation(0, candidates, emissions);
+  long allocations = 0;
+  for (int t = 1; t < 300; t++) {
+    // Warm-up for the first 100 time steps.
+    const long before = allocation_count.load();
+    viterbi.NextStep(t, candidates, emissions, transitions, descriptors);
+    movedCandidates.assign(candidates.begin(), candidates.end());
+    moving.NextStep(t, std::move(movedCandidates), emissions, transitions,
+                    descriptors);
+    if (t >= 100) {
+      allocations += allocation_count.load() - before;
+    }
+  }
+  auto expected = viterbi.ComputeMostLikelySequence();
+  auto actual = moving.ComputeMostLikelySequence();
+  if (allocations != 0) {
+    Fail("ERR: %ld allocations after warm-up. TestAllocationFreeNextStep()\n",
+         allocations);
+  } else if (emissions.size() != numEmissions ||
+             descriptors.size() != numDescriptors ||
+             committed[0] != committed[1] || !(expected == actual)) {
+    Fail("ERR: inputs were modified. TestAllocationFreeNextStep()\n");
+  } else {
+    printf("TestAllocationFreeNextStep() GOOD: no allocations after "
+           "warm-up.\n");
+  }
+}
+void TestMain::TestStepObserver() {
+  class RecordingObserver : public ViterbiObserver {
+   public:
+    std::vector<ViterbiStepMetrics> steps;
+    void OnStep(const ViterbiStepMetrics& metrics) override {
+      steps.push_back(metrics);
+    }
+  };
+  // No transitions out of state 2 and none from 0 to 1, i.e. 4 of 9
+  // transitions are missing in each time step.
+  std::vector<int> candidates;
+  std::map<int, double> emissions;
+  std::map<Transition<int>, double> transitions;
+  for (int s = 0; s < 3; s++) {
+    candidates.push_back(s);
+    emissions[s] = log(0.5);
+    for (int to = 0; to < 3; to++) {
+      if (s != 2 && !(s == 0 && to == 1)) {
+        transitions[Transition<int>(s, to)] = log(s == to ? 0.6 : 0.4);
+      }
+    }
+  }
+  RecordingObserver observer;
+  ViterbiAlgorithm<int, int, int> viterbi;
+  viterbi.SetKeepMessageHistory(true);
+  viterbi.SetObserver(&observer);
+  viterbi.StartWithInitialObservation(0, candidates, emissions);
+  for (int t = 1; t < 5; t++) {
+    viterbi.NextStep(t, candidates, emissions, transitions);
+  }
+  const size_t liveStates = viterbi.LiveExtendedStateCount();
+  viterbi.NextStep(
+      5, candidates, emissions,
+      [&transitions](const int& from, const int& to) {
+        auto found = transitions.find(Transition<int>(from, to));
+        return found == transitions.end()
+                   ? -std::numeric_limits<double>::infinity()
+                   : found->second;
+      },
+      nullptr);
+  MessageHistoryView<int> history = viterbi.MessageHistory();
+  bool good = observer.steps.size() == 6;
+  for (size_t t = 0; good && t < 5; t++) {
+    const ViterbiStepMetrics& metrics = observer.steps[t];
+    double best = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < history[t].size(); i++) {
+      best = std::max(best, history[t].LogProbability(i));
+    }
+    good = metrics.timeStep == (int)t && metrics.numCandidates == 3 &&
+           metrics.numPrevCandidates == (t == 0 ? 0u : 3u) &&
+           metrics.evaluatedTransitions == (t == 0 ? 0u : 9u) &&
+           metrics.missingTransitions == (t == 0 ? 0u : 4u) &&
+           metrics.bestLogProbability == best && !metrics.isBroken &&
+           metrics.allocatedBytes > 0 && metrics.forwardStepSeconds >= 0.0;
+  }
+  good = good && observer.steps[4].liveExtendedStates == liveStates;
+  // The lazy step only counts transitions actually requested.
+  good = good && observer.steps[5].timeStep == 5 &&
+         observer.steps[5].evaluatedTransitions > 0 &&
+         observer.steps[5].evaluatedTransitions <= 9 &&
+         observer.steps[5].missingTransitions <=
+             observer.steps[5].evaluatedTransitions;
+  // Detached observers are not called anymore.
+  viterbi.SetObserver(nullptr);
+  viterbi.NextStep(6, candidates, emissions, transitions);
+  good = good && observer.steps.size() == 6;
+  // HMM breaks are reported.
+  viterbi.SetObserver(&observer);
+  viterbi.NextStep(7, candidates, emissions,
+                   std::map<Transition<int>, double>());
+  good = good && observer.steps.size() == 7 && observer.steps[6].isBroken &&
+         observer.steps[6].timeStep == 7 &&
+         observer.steps[6].missingTransitions == 9 &&
+         observer.steps[6].bestLogProbability ==
+             -std::numeric_limits<double>::infinity();
+  if (good) {
+    printf("TestStepObserver() GOOD: metrics reported for each time step.\n");
+  } else {
+    Fail("ERR: wrong step metrics. TestStepObserver()\n");
+  }
+}
+void TestMain::TestFloatProbabilities() {
+  const float kValues[] = {logf(0.5f), logf(0.25f), 0.0f,
+                           -std::numeric_limits<float>::infinity()};
+  const SimdLevel detected = DetectSimdLevel();
+  std::mt19937 random(11);
+  int kernelMismatches = 0;
+  for (int level = 0; level <= static_cast<int>(detected); level++) {
+    SetSimdLevel(static_cast<SimdLevel>(level));
+    for (size_t n = 0; n < 40; n++) {
+      std::vector<float> best(n, -std::numeric_limits<float>::infinity());
+      std::vector<int> argmax(n, -1);
+      std::vector<float> expectedBest(best);
+      std::vector<int> expectedArgmax(argmax);
+      for (int p = 0; p < 5; p++) {
+        float base = kValues[random() % 4];
+        std::vector<float> row;
+        for (size_t c = 0; c < n; c++) {
+          row.push_back(kValues[random() % 4]);
+        }
+        for (size_t c = 0; c < n; c++) {
+          if (base + row[c] > expectedBest[c]) {
+            expectedBest[c] = base + row[c];
+            expectedArgmax[c] = p;
+          }
+        }
+        MaxPlusRowUpdate(base, row.data(), n, p, best.data(), argmax.data());
+      }
+      if (best != expectedBest || argmax != expectedArgmax) {
+        kernelMismatches++;
+      }
+    }
+  }
+  SetSimdLevel(detected);
+
+  // Random log probabilities are far enough apart for float, so all
+  // variants find the same sequence over many time steps.
+  const int kNumStates = 24;
+  std::uniform_real_distribution<double> logProbability(-8.0, 0.0);
+  std::vector<int> candidates;
+  for (int s = 0; s < kNumStates; s++) {
+    candidates.push_back(s);
+  }
+  DenseViterbiAlgorithm<int, int, int> doubleViterbi;
+  DenseViterbiAlgorithm<int, int, int, float> floatViterbi;
+  DenseViterbiAlgorithm<int, int, int, float> sparseFloatViterbi;
+  for (int t = 0; t < 500; t++) {
+    std::vector<double> emissions;
+    for (int s = 0; s < kNumStates; s++) {
+      emissions.push_back(logProbability(random));
+    }
+    std::vector<float> floatEmissions(emissions.begin(), emissions.end());
+    if (t == 0) {
+      doubleViterbi.StartWithInitialObservation(t, candidates, emissions);
+      floatViterbi.StartWithInitialObservation(t, candidates, floatEmissions);
+      sparseFloatViterbi.StartWithInitialObservation(t, candidates,
+                                                     floatEmissions);
+      continue;
+    }
+    std::vector<double> transitions;
+    for (int i = 0; i < kNumStates * kNumStates; i++) {
+      transitions.push_back(random() % 4 == 0
+                                ? -std::numeric_limits<double>::infinity()
+                                : logProbability(random));
+    }
+    std::vector<float> floatTransitions(transitions.begin(),
+                                        transitions.end());
+    SparseTransitions<int, float> sparseTransitions;
+    for (int c = 0; c < kNumStates; c++) {
+      for (int p = 0; p < kNumStates; p++) {
+        const float value = floatTransitions[p * kNumStates + c];
+        if (value != -std::numeric_limits<float>::infinity()) {
+          sparseTransitions.AddTransition(p, value);
+        }
+      }
+      sparseTransitions.EndCandidate();
+    }
+    doubleViterbi.NextStep(t, candidates, emissions, transitions);
+    floatViterbi.NextStep(t, candidates, floatEmissions, floatTransitions);
+    sparseFloatViterbi.NextStep(t, candidates, floatEmissions,
+                                sparseTransitions);
+  }
+  auto expected = doubleViterbi.ComputeMostLikelySequence();
+  if (kernelMismatches != 0) {
+    Fail("ERR: %d float kernel mismatches. TestFloatProbabilities()\n",
+         kernelMismatches);
+  } else if (expected.size() != 500 ||
+             !(floatViterbi.ComputeMostLikelySequence() == expected) ||
+             !(sparseFloatViterbi.ComputeMostLikelySequence() == expected)) {
+    Fail("ERR: float result differs. TestFloatProbabilities()\n");
+  } else {
+    printf("TestFloatProbabilities() GOOD: float matches double.\n");
+  }
+}
+void TestMain::TestFixedViterbi() {
+  // Rain is state 0, sun is state 1.
+  typedef FixedViterbi<2, 4> RainViterbi;
+  const RainViterbi::Vector umbrella = {{log(0.9), log(0.2)}};
+  const RainViterbi::Vector noUmbrella = {{log(0.1), log(0.8)}};
+  RainViterbi::Matrix transitions;
+  transitions[0] = {{log(0.7), log(0.3)}};
+  transitions[1] = {{log(0.3), log(0.7)}};
+  const long allocationsBefore = allocation_count.load();
+  RainViterbi rainViterbi;
+  rainViterbi.StartWithInitialObservation(umbrella);
+  rainViterbi.NextStep(umbrella, transitions);
+  rainViterbi.NextStep(noUmbrella, transitions);
+  rainViterbi.NextStep(umbrella, transitions);
+  RainViterbi::Sequence rainSequence;
+  const size_t rainLength = rainViterbi.ComputeMostLikelySequence(rainSequence);
+  const bool noAllocations = allocation_count.load() == allocationsBefore;
+  bool good = noAllocations && rainLength == 4 && rainSequence[0] == 0 &&
+              rainSequence[1] == 0 && rainSequence[2] == 1 &&
+              rainSequence[3] == 0;
+  // Further time steps are rejected.
+  good = good && !rainViterbi.NextStep(umbrella, transitions) &&
+         rainViterbi.NumTimeSteps() == 4;
+
+  // Same sequence as DenseViterbiAlgorithm, including ties.
+  const int kNumStates = 5;
+  const int kNumSteps = 60;
+  const double kLogProbabilities[] = {log(0.5), log(0.25), log(0.125),
+                                      -std::numeric_limits<double>::infinity()};
+  std::mt19937 random(23);
+  int mismatches = 0;
+  for (int run = 0; run < 50; run++) {
+    FixedViterbi<kNumStates, kNumSteps> fixed;
+    DenseViterbiAlgorithm<int, int, int> dense;
+    std::vector<int> candidates;
+    for (int s = 0; s < kNumStates; s++) {
+      candidates.push_back(s);
+    }
+    for (int t = 0; t < kNumSteps; t++) {
+      FixedViterbi<kNumStates, kNumSteps>::Vector emissions;
+      FixedViterbi<kNumStates, kNumSteps>::Matrix matrix;
+      std::vector<double> denseEmissions;
+      std::vector<double> denseTransitions;
+      for (int s = 0; s < kNumStates; s++) {
+        emissions[s] = kLogProbabilities[random() % 3];
+        denseEmissions.push_back(emissions[s]);
+      }
+      for (int from = 0; from < kNumStates; from++) {
+        for (int to = 0; to < kNumStates; to++) {
+          matrix[from][to] = kLogProbabilities[random() % 4];
+          denseTransitions.push_back(matrix[from][to]);
+        }
+      }
+      if (t == 0) {
+        fixed.StartWithInitialObservation(emissions);
+        dense.StartWithInitialObservation(t, candidates, denseEmissions);
+      } else {
+        fixed.NextStep(emissions, matrix);
+        dense.NextStep(t, candidates, denseEmissions, denseTransitions);
+      }
+    }
+    FixedViterbi<kNumStates, kNumSteps>::Sequence sequence;
+    const size_t length = fixed.ComputeMostLikelySequence(sequence);
+    auto expected = dense.ComputeMostLikelySequence();
+    bool same = length == expected.size() && fixed.IsBroken() == dense.IsBroken();
+    for (size_t t = 0; same && t < length; t++) {
+      same = sequence[t] == expected[t].state;
+    }
+    if (!same) {
+      mismatches++;
+    }
+  }
+  good = good && mismatches == 0;
+  if (good) {
+    printf("TestFixedViterbi() GOOD: same sequences without allocations.\n");
+  } else {
+    Fail("ERR: %d mismatches, %s allocations. TestFixedViterbi()\n",
+         mismatches, noAllocations ? "no" : "unexpected");
+  }
+}
+// Snapshot support of the test types, see snapshot.h.
+template <>
+class SnapshotTraits<Rain> {
+ public:
+  static void Write(const Rain& value, SnapshotWriter& writer) {
+    SnapshotTraits<std::string>::Write(value.weather_, writer);
+  }
+  static bool Read(SnapshotReader& reader, Rain& value) {
+    return SnapshotTraits<std::string>::Read(reader, value.weather_);
+  }
+};
+template <>
+class SnapshotTraits<Umbrella> {
+ public:
+  static void Write(const Umbrella& value, SnapshotWriter& writer) {
+    SnapshotTraits<std::string>::Write(value.umbrella_, writer);
+  }
+  static bool Read(SnapshotReader& reader, Umbrella& value) {
+    return SnapshotTraits<std::string>::Read(reader, value.umbrella_);
+  }
+};
+template <>
+class SnapshotTraits<Descriptor> {
+ public:
+  static void Write(const Descriptor& value, SnapshotWriter& writer) {
+    SnapshotTraits<std::string>::Write(value.desc_, writer);
+  }
+  static bool Read(SnapshotReader& reader, Descriptor& value) {
+    return SnapshotTraits<std::string>::Read(reader, value.desc_);
+  }
+};
+
+void TestMain::TestSnapshot() {
+  const int kNumStates = 6;
+  const int kNumTimeSteps = 60;
+  const int kSnapshotTimeStep = 25;
+  std::mt19937 random(41);
+  std::uniform_real_distribution<double> logProbability(-6.0, 0.0);
+  std::vector<Rain> candidates;
+  for (int s = 0; s < kNumStates; s++) {
+    candidates.push_back(Rain("state-" + std::to_string(s)));
+  }
+  std::vector<std::map<Rain, double>> emissions(kNumTimeSteps);
+  for (auto& stepEmissions : emissions) {
+    for (auto& candidate : candidates) {
+      stepEmissions[candidate] = logProbability(random);
+    }
+  }
+  // Sparse, so that back pointer chains merge and die out.
+  std::map<Transition<Rain>, double> transitions;
+  std::map<Transition<Rain>, Descriptor> descriptors;
+  for (auto& from : candidates) {
+    for (auto& to : candidates) {
+      if (from == to || logProbability(random) > -3.0) {
+        transitions[Transition<Rain>(from, to)] = logProbability(random);
+        descriptors[Transition<Rain>(from, to)] =
+            Descriptor(from.weather_ + ">" + to.weather_);
+      }
+    }
+  }
+  std::vector<std::string> committed[2];
+  auto onCommit = [](std::vector<std::string>& target) {
+    return [&target](
+        const std::vector<SequenceState<Rain, Umbrella, Descriptor>>& prefix) {
+      for (auto& ss : prefix) {
+        target.push_back(ss.state.weather_ + ss.observation.umbrella_ +
+                         ss.transitionDescriptor.desc_);
+      }
+    };
+  };
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> original;
+  ViterbiAlgorithm<Rain, Umbrella, Descriptor> restored;
+  original.SetOnlineDecoding(onCommit(committed[0]), 10);
+  restored.SetOnlineDecoding(onCommit(committed[1]), 10);
+  original.StartWithInitialObservation(Umbrella("u0"), candidates,
+                                       emissions[0]);
+  std::string snapshot;
+  std::string restoredSnapshot;
+  bool good = true;
+  for (int t = 1; t < kNumTimeSteps; t++) {
+    if (t == kSnapshotTimeStep) {
+      original.SaveSnapshot(snapshot);
+      good = restored.RestoreSnapshot(snapshot);
+      restored.SaveSnapshot(restoredSnapshot);
+      good = good && restoredSnapshot == snapshot &&
+             restored.LiveExtendedStateCount() ==
+                 original.LiveExtendedStateCount();
+      committed[1] = committed[0];
+    }
+    const Umbrella observation("u" + std::to_string(t));
+    original.NextStep(observation, candidates, emissions[t], transitions,
+                      descriptors);
+    if (t >= kSnapshotTimeStep) {
+      restored.NextStep(observation, candidates, emissions[t], transitions,
+                        descriptors);
+    }
+  }
+  auto expected = original.ComputeMostLikelySequence();
+  auto actual = restored.ComputeMostLikelySequence();
+  good = good && committed[0] == committed[1] &&
+         expected.size() == actual.size() && !expected.empty();
+  for (size_t i = 0; good && i < expected.size(); i++) {
+    good = expected[i].state == actual[i].state &&
+           expected[i].observation.umbrella_ ==
+               actual[i].observation.umbrella_ &&
+           expected[i].transitionDescriptor == actual[i].transitionDescriptor;
+  }
+  // Damaged snapshots are rejected and leave the instance reset.
+  std::string truncated = snapshot.substr(0, snapshot.size() - 1);
+  std::string otherVersion = snapshot;
+  otherVersion[4]++;
+  good = good && !restored.RestoreSnapshot(truncated) &&
+         !restored.RestoreSnapshot(otherVersion) &&
+         !restored.RestoreSnapshot(std::string()) &&
+         restored.LiveExtendedStateCount() == 0 &&
+         restored.ComputeMostLikelySequence().empty();
+  // Snapshots with inconsistent time steps or unreachable nodes are
+  // rejected. Nodes are (back pointer, time step) pairs.
+  auto makeSnapshot = [](int32_t timeStep, int32_t committedTimeStep,
+                         const std::vector<std::pair<int32_t, int32_t>>& nodes,
+                         const std::vector<int32_t>& candidateNodes) {
+    std::string bytes;
+    SnapshotWriter writer(bytes);
+    writer.WriteBytes(kSnapshotMagic, 4);
+    writer.WriteUint32(kSnapshotVersion);
+    writer.WriteUint32(0);
+    writer.WriteInt32(timeStep);
+    writer.WriteInt32(committedTimeStep);
+    writer.WriteUint32((uint32_t)nodes.size());
+    for (auto& node : nodes) {
+      writer.WriteInt32(node.first);
+      writer.WriteInt32(node.second);
+      for (int i = 0; i < 3; i++) {
+        SnapshotTraits<int>::Write(i, writer);
+      }
+    }
+    writer.WriteUint32((uint32_t)candidateNodes.size());
+    for (auto node : candidateNodes) {
+      SnapshotTraits<int>::Write(0, writer);
+      SnapshotTraits<double>::Write(0.0, writer);
+      writer.WriteInt32(node);
+    }
+    SnapshotTraits<uint64_t>::Write(0, writer);
+    writer.WriteUint32(0);
+    writer.WriteUint32(0);
+    return bytes;
+  };
+  ViterbiAlgorithm<int, int, int> handmade;
+  good = good && handmade.RestoreSnapshot(
+                     makeSnapshot(1, -1, {{-1, 0}, {0, 1}}, {1})) &&
+         handmade.LiveExtendedStateCount() == 2;
+  good = good && !handmade.RestoreSnapshot(makeSnapshot(
+                     1, std::numeric_limits<int32_t>::max(),
+                     {{-1, 0}, {0, 1}}, {1})) &&
+         !handmade.RestoreSnapshot(
+             makeSnapshot(1, -2, {{-1, 0}, {0, 1}}, {1})) &&
+         !handmade.RestoreSnapshot(
+             makeSnapshot(2, -1, {{-1, 0}, {0, 2}}, {1})) &&
+         !handmade.RestoreSnapshot(
+             makeSnapshot(0, -1, {{-1, 0}, {0, 1}}, {1})) &&
+         !handmade.RestoreSnapshot(
+             makeSnapshot(1, -1, {{-1, 0}, {0, 1}, {-1, 1}}, {1})) &&
+         handmade.LiveExtendedStateCount() == 0;
+  if (good) {
+    printf("TestSnapshot() GOOD: restored decoder continues identically.\n");
+  } else {
+    Fail("ERR: restored decoder differs. TestSnapshot()\n");
+  }
+}
+void TestMain::TestMappedModel() {
+  const int kNumStates = 40;
+  const int kNumSymbols = 5;
+  const int kNumTimeSteps = 50;
+  const char* kDensePath = "test_mapped_model_dense.bin";
+  const char* kSparsePath = "test_mapped_model_sparse.bin";
+  std::mt19937 random(43);
+  std::uniform_real_distribution<double> logProbability(-8.0, 0.0);
+  std::uniform_int_distribution<int> symbol(0, kNumSymbols - 1);
+  std::vector<std::string> names;
+  std::vector<int> states;
+  for (int s = 0; s < kNumStates; s++) {
+    names.push_back("state-" + std::to_string(s));
+    states.push_back(s);
+  }
+  std::vector<std::vector<double>> emissions(kNumSymbols);
+  for (auto& symbolEmissions : emissions) {
+    for (int s = 0; s < kNumStates; s++) {
+      symbolEmissions.push_back(logProbability(random));
+    }
+  }
+  std::vector<double> dense((size_t)kNumStates * kNumStates,
+                            -std::numeric_limits<double>::infinity());
+  SparseTransitions<int> sparse;
+  for (int to = 0; to < kNumStates; to++) {
+    for (int from = 0; from < kNumStates; from++) {
+      if (from == to || logProbability(random) > -2.0) {
+        dense[from * kNumStates + to] = logProbability(random);
+        sparse.AddTransition(from, dense[from * kNumStates + to]);
+      }
+    }
+    sparse.EndCandidate();
+  }
+  std::vector<int> observations;
+  for (int t = 0; t < kNumTimeSteps; t++) {
+    observations.push_back(symbol(random));
+  }
+
+  bool good = MappedModel<double>::Write(kDensePath, names, emissions, dense) &&
+              MappedModel<double>::Write(kSparsePath, names, emissions, sparse);
+  MappedModel<double> denseModel;
+  MappedModel<double> sparseModel;
+  good = good && denseModel.Open(kDensePath) && sparseModel.Open(kSparsePath) &&
+         !denseModel.IsSparse() && sparseModel.IsSparse() &&
+         denseModel.NumStates() == kNumStates &&
+         denseModel.NumSymbols() == kNumSymbols &&
+         sparseModel.NumTransitions() == sparse.prevIndices.size() &&
+         std::string(sparseModel.StateName(7)) == names[7] &&
+         denseModel.StateIndices() == states;
+  // Decoding in place gives the same sequence as decoding from vectors.
+  int mismatches = 0;
+  for (int useSparse = 0; good && useSparse < 2; useSparse++) {
+    const MappedModel<double>& model = useSparse ? sparseModel : denseModel;
+    std::vector<int> candidates = model.StateIndices();
+    DenseViterbiAlgorithm<int, int, int> mapped;
+    DenseViterbiAlgorithm<int, int, int> expected;
+    mapped.StartWithInitialObservation(
+        observations[0], candidates,
+        model.EmissionLogProbabilities(observations[0]));
+    expected.StartWithInitialObservation(observations[0], states,
+                                         emissions[observations[0]]);
+    for (int t = 1; t < kNumTimeSteps; t++) {
+      const int o = observations[t];
+      if (useSparse) {
+        mapped.NextStep(o, candidates, model.EmissionLogProbabilities(o),
+                        model.TransitionOffsets(), model.PrevIndices(),
+                        model.TransitionLogProbabilities());
+        expected.NextStep(o, states, emissions[o], sparse);
+      } else {
+        mapped.NextStep(o, candidates, model.EmissionLogProbabilities(o),
+                        model.TransitionLogProbabilities());
+        expected.NextStep(o, states, emissions[o], dense);
+      }
+    }
+    auto actualSequence = mapped.ComputeMostLikelySequence();
+    auto expectedSequence = expected.ComputeMostLikelySequence();
+    if (actualSequence.size() != (size_t)kNumTimeSteps ||
+        actualSequence.size() != expectedSequence.size()) {
+      mismatches++;
+      continue;
+    }
+    for (size_t t = 0; t < actualSequence.size(); t++) {
+      if (actualSequence[t].state != expectedSequence[t].state) {
+        mismatches++;
+      }
+    }
+  }
+  good = good && mismatches == 0;
+  // Other probability types and damaged files are rejected.
+  MappedModel<float> floatModel;
+  good = good && !floatModel.Open(kDensePath) &&
+         !floatModel.Open("test_mapped_model_missing.bin");
+  std::string bytes;
+  FILE* in = fopen(kSparsePath, "rb");
+  for (int c; in != nullptr && (c = fgetc(in)) != EOF;) {
+    bytes.push_back((char)c);
+  }
+  if (in != nullptr) {
+    fclose(in);
+  }
+  std::string truncated = bytes.substr(0, bytes.size() - 1);
+  std::string badIndex = bytes;
+  const MappedModelHeader* header =
+      reinterpret_cast<const MappedModelHeader*>(bytes.data());
+  const int outOfRange = kNumStates;
+  memcpy(&badIndex[header->prevIndices], &outOfRange, sizeof(int));
+  // A name offset beyond the name section, followed by smaller ones.
+  std::string badNameOffset = bytes;
+  const uint32_t farOffset = 0x40000000;
+  memcpy(&badNameOffset[header->stateNameOffsets + sizeof(uint32_t)],
+         &farOffset, sizeof(uint32_t));
+  for (auto& damaged : {truncated, badIndex, badNameOffset}) {
+    FILE* out = fopen(kSparsePath, "wb");
+    good = good && out != nullptr &&
+           fwrite(damaged.data(), 1, damaged.size(), out) == damaged.size();
+    if (out != nullptr) {
+      fclose(out);
+    }
+    good = good && !sparseModel.Open(kSparsePath) && !sparseModel.IsOpen();
+  }
+  denseModel.Close();
+  remove(kDensePath);
+  remove(kSparsePath);
+  if (good) {
+    printf("TestMappedModel() GOOD: decoding in place gives the same result.\n");
+  } else {
+    Fail("ERR: %d mismatches. TestMappedModel()\n", mismatches);
+  }
+}
+void TestMain::TestBaumWelch() {
+  const int kNumStates = 3;
+  const int kNumSymbols = 4;
+  const double kInfinity = std::numeric_limits<double>::infinity();
+  // Left-to-right-ish model, 0 -> 2 is missing.
+  const double truthTransitions[kNumStates][kNumStates] = {
+      {0.8, 0.2, 0.0}, {0.1, 0.6, 0.3}, {0.3, 0.1, 0.6}};
+  const double truthEmissions[kNumStates][kNumSymbols] = {
+      {0.7, 0.1, 0.1, 0.1}, {0.1, 0.6, 0.2, 0.1}, {0.05, 0.05, 0.3, 0.6}};
+  std::mt19937 random(47);
+  std::vector<std::vector<int>> sequences(300);
+  for (auto& sequence : sequences) {
+    int state = std::uniform_int_distribution<int>(0, kNumStates - 1)(random);
+    const int length = std::uniform_int_distribution<int>(1, 60)(random);
+    for (int t = 0; t < length; t++) {
+      if (t > 0) {
+        state = std::discrete_distribution<int>(
+            truthTransitions[state], truthTransitions[state] + kNumStates)(
+            random);
+      }
+      sequence.push_back(std::discrete_distribution<int>(
+          truthEmissions[state], truthEmissions[state] + kNumSymbols)(random));
+    }
+  }
+  // Start with uniform rows of the same structure and skewed emissions.
+  DiscreteHmm start;
+  start.numStates = kNumStates;
+  start.numSymbols = kNumSymbols;
+  start.initialLogProbabilities.assign(kNumStates, log(1.0 / kNumStates));
+  start.emissionLogProbabilities.assign(kNumSymbols,
+                                        std::vector<double>(kNumStates));
+  for (int from = 0; from < kNumStates; from++) {
+    int numTransitions = 0;
+    for (int to = 0; to < kNumStates; to++) {
+      numTransitions += truthTransitions[from][to] > 0.0;
+    }
+    for (int to = 0; to < kNumStates; to++) {
+      start.transitionLogProbabilities.push_back(
+          truthTransitions[from][to] > 0.0 ? log(1.0 / numTransitions)
+                                           : -kInfinity);
+    }
+    for (int o = 0; o < kNumSymbols; o++) {
+      start.emissionLogProbabilities[o][from] =
+          log(o == from ? 0.4 : 0.6 / (kNumSymbols - 1));
+    }
+  }
+
+  // The expected initial states of a single sequence are the posteriors of
+  // the first time step.
+  BaumWelch serial(1);
+  DiscreteHmm single = start;
+  std::vector<std::vector<int>> singleSequence(1, sequences[0]);
+  bool good = serial.Iterate(singleSequence, single).numSequences == 1;
+  std::vector<int> candidates;
+  std::map<Transition<int>, double> transitions;
+  for (int from = 0; from < kNumStates; from++) {
+    candidates.push_back(from);
+    for (int to = 0; to < kNumStates; to++) {
+      if (truthTransitions[from][to] > 0.0) {
+        transitions[Transition<int>(from, to)] =
+            start.transitionLogProbabilities[from * kNumStates + to];
+      }
+    }
+  }
+  ForwardBackwardAlgorithm<int, int> forwardBackward;
+  for (size_t t = 0; t < sequences[0].size(); t++) {
+    std::map<int, double> emissions;
+    for (int s = 0; s < kNumStates; s++) {
+      emissions[s] = start.emissionLogProbabilities[sequences[0][t]][s] +
+                     (t == 0 ? start.initialLogProbabilities[s] : 0.0);
+    }
+    if (t == 0) {
+      forwardBackward.StartWithInitialObservation(sequences[0][t], candidates,
+                                                  emissions);
+    } else {
+      forwardBackward.NextStep(sequences[0][t], candidates, emissions,
+                               transitions);
+    }
+  }
+  auto posteriors = forwardBackward.ComputePosteriorProbabilities();
+  for (int s = 0; good && s < kNumStates; s++) {
+    good = std::abs(exp(single.initialLogProbabilities[s]) - posteriors[0][s]) <
+           1e-9;
+  }
+
+  // EM never decreases the likelihood, and threads only change the order of
+  // the sums.
+  BaumWelch parallel(4);
+  DiscreteHmm serialModel = start;
+  DiscreteHmm parallelModel = start;
+  double lastLogLikelihood = -kInfinity;
+  for (int iteration = 0; good && iteration < 30; iteration++) {
+    BaumWelchResult serialResult = serial.Iterate(sequences, serialModel);
+    BaumWelchResult parallelResult = parallel.Iterate(sequences, parallelModel);
+    good = serialResult.numSequences == sequences.size() &&
+           parallelResult.numSequences == sequences.size() &&
+           serialResult.logLikelihood >= lastLogLikelihood - 1e-9 &&
+           std::abs(serialResult.logLikelihood - parallelResult.logLikelihood) <
+               1e-6;
+    lastLogLikelihood = serialResult.logLikelihood;
+  }
+  for (int k = 0; good && k < kNumStates * kNumStates; k++) {
+    good = std::abs(serialModel.transitionLogProbabilities[k] -
+                    parallelModel.transitionLogProbabilities[k]) < 1e-6 ||
+           serialModel.transitionLogProbabilities[k] ==
+               parallelModel.transitionLogProbabilities[k];
+  }
+  good = good && serialModel.transitionLogProbabilities[2] == -kInfinity;
+  // Train() stops once the likelihood converged.
+  DiscreteHmm trained = start;
+  BaumWelchResult result = parallel.Train(sequences, trained, 500, 1e-6);
+  good = good && result.logLikelihood >= lastLogLikelihood - 1e-9;
+  // Invalid symbols leave the model unchanged.
+  std::vector<std::vector<int>> invalid(1, std::vector<int>(1, kNumSymbols));
+  DiscreteHmm unchanged = start;
+  good = good && parallel.Iterate(invalid, unchanged).numSequences == 0 &&
+         unchanged.emissionLogProbabilities == start.emissionLogProbabilities;
+  if (good) {
+    printf("TestBaumWelch() GOOD: likelihood increases, %.3f after training.\n",
+           result.logLikelihood);
+  } else {
+    Fail("ERR: wrong expected counts or estimates. TestBaumWelch()\n");
+  }
+}
+void TestMain::TestParallelScanViterbi() {
+  const int kNumStates = 5;
+  const int kNumTimeSteps = 3000;
+  const int kBreakTimeStep = 2000;
+  // Multiples of 1/4 keep all sums exact, so the reassociated scan must give
+  // exactly the sequential result. They also produce many ties.
+  std::mt19937 random(53);
+  std::uniform_int_distribution<int> quarters(-32, 0);
+  std::uniform_int_distribution<int> missing(0, 3);
+  std::vector<std::vector<double>> emissions(
+      kNumTimeSteps, std::vector<double>(kNumStates));
+  for (auto& stepEmissions : emissions) {
+    for (auto& value : stepEmissions) {
+      value = quarters(random) / 4.0;
+    }
+  }
+  std::vector<std::vector<double>> matrices(
+      3, std::vector<double>(kNumStates * kNumStates));
+  for (auto& matrix : matrices) {
+    for (int k = 0; k < kNumStates * kNumStates; k++) {
+      matrix[k] = k % (kNumStates + 1) != 0 && missing(random) == 0
+                      ? -std::numeric_limits<double>::infinity()
+                      : quarters(random) / 4.0;
+    }
+  }
+  // Sticky model: switching is too expensive, so the path stays in the state
+  // with the largest sum of emissions. All states get the same emissions in
+  // different order, state 3 a quarter more, so any error in the messages
+  // at chunk boundaries picks another state.
+  std::vector<double> sticky(kNumStates * kNumStates, -1e4);
+  for (int s = 0; s < kNumStates; s++) {
+    sticky[s * (kNumStates + 1)] = 0.0;
+  }
+  std::vector<std::vector<double>> stickyEmissions = emissions;
+  for (int s = 1; s < kNumStates; s++) {
+    std::vector<double> shuffled;
+    for (auto& stepEmissions : emissions) {
+      shuffled.push_back(stepEmissions[0]);
+    }
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    for (int t = 0; t < kNumTimeSteps; t++) {
+      stickyEmissions[t][s] = shuffled[t];
+    }
+  }
+  stickyEmissions[kNumTimeSteps / 2][3] += 0.25;
+  std::vector<int> candidates;
+  for (int s = 0; s < kNumStates; s++) {
+    candidates.push_back(s);
+  }
+  ThreadPool pool(4);
+  ParallelScanViterbi scan(&pool);
+  scan.SetMinChunkLength(16);
+  bool good = true;
+  // Homogeneous, time-varying, time-varying with an HMM break and sticky.
+  for (int variant = 0; good && variant < 4; variant++) {
+    std::vector<std::vector<double>> stepEmissions =
+        variant == 3 ? stickyEmissions : emissions;
+    if (variant == 2) {
+      stepEmissions[kBreakTimeStep].assign(
+          kNumStates, -std::numeric_limits<double>::infinity());
+    }
+    std::vector<const double*> emissionPointers;
+    std::vector<const double*> transitionPointers;
+    DenseViterbiAlgorithm<int, int, int> sequential;
+    sequential.StartWithInitialObservation(0, candidates,
+                                           stepEmissions[0].data());
+    emissionPointers.push_back(stepEmissions[0].data());
+    for (int t = 1; t < kNumTimeSteps; t++) {
+      const double* matrix = variant == 3   ? sticky.data()
+                             : variant == 0 ? matrices[0].data()
+                                            : matrices[t % 3].data();
+      sequential.NextStep(t, candidates, stepEmissions[t].data(), matrix);
+      emissionPointers.push_back(stepEmissions[t].data());
+      transitionPointers.push_back(matrix);
+    }
+    auto expected = sequential.ComputeMostLikelySequence();
+    std::vector<int> actual =
+        variant == 0
+            ? scan.Decode(kNumStates, emissionPointers, matrices[0].data())
+            : scan.Decode(kNumStates, emissionPointers, transitionPointers);
+    good = actual.size() == expected.size() &&
+           scan.IsBroken() == sequential.IsBroken() &&
+           actual.size() ==
+               (size_t)(variant == 2 ? kBreakTimeStep : kNumTimeSteps) &&
+           (variant != 3 || actual.back() == 3);
+    for (size_t t = 0; good && t < actual.size(); t++) {
+      good = actual[t] == expected[t].state;
+    }
+  }
+  if (good) {
+    printf("TestParallelScanViterbi() GOOD: same path as sequential.\n");
+  } else {
+    Fail("ERR: path differs from sequential. TestParallelScanViterbi()\n");
+  }
+}
+void TestMain::TestBreakRecovery() {
+  const int kNumTimeSteps = 30;
+  std::mt19937 random(59);
+  std::uniform_real_distribution<double> logProbability(-5.0, 0.0);
+  std::vector<int> candidates = {0, 1, 2};
+  std::vector<std::map<int, double>> emissions(kNumTimeSteps);
+  std::vector<std::map<Transition<int>, double>> transitions(kNumTimeSteps);
+  for (int t = 0; t < kNumTimeSteps; t++) {
+    for (int s : candidates) {
+      emissions[t][s] = logProbability(random);
+      for (int to : candidates) {
+        transitions[t][Transition<int>(s, to)] = logProbability(random);
+      }
+    }
+  }
+  // Gaps: no transitions into time steps 10 and 20, and no emissions at 20,
+  // so that the restart succeeds at 10 but only at 21.
+  transitions[10].clear();
+  transitions[20].clear();
+  for (auto& emission : emissions[20]) {
+    emission.second = -std::numeric_limits<double>::infinity();
+  }
+  const std::vector<int> expectedBreaks = {10, 20, 21};
+  const std::vector<std::pair<int, int>> segmentRanges = {
+      {0, 10}, {10, 20}, {21, kNumTimeSteps}};
+  // Each segment decoded on its own.
+  std::vector<std::vector<SequenceState<int, int, int>>> expected;
+  for (auto& range : segmentRanges) {
+    ViterbiAlgorithm<int, int, int> viterbi;
+    viterbi.StartWithInitialObservation(range.first, candidates,
+                                        emissions[range.first]);
+    for (int t = range.first + 1; t < range.second; t++) {
+      viterbi.NextStep(t, candidates, emissions[t], transitions[t]);
+    }
+    expected.push_back(viterbi.ComputeMostLikelySequence());
+  }
+
+  ViterbiAlgorithm<int, int, int> offline;
+  ViterbiAlgorithm<int, int, int> online;
+  std::vector<SequenceState<int, int, int>> committed;
+  offline.SetBreakRecovery(true);
+  online.SetBreakRecovery(true);
+  online.SetOnlineDecoding(
+      [&committed](const std::vector<SequenceState<int, int, int>>& prefix) {
+        committed.insert(committed.end(), prefix.begin(), prefix.end());
+      });
+  offline.StartWithInitialObservation(0, candidates, emissions[0]);
+  online.StartWithInitialObservation(0, candidates, emissions[0]);
+  bool good = true;
+  for (int t = 1; t < kNumTimeSteps; t++) {
+    if (t == 15) {
+      // Breaks and finished segments survive a snapshot.
+      std::string snapshot;
+      offline.SaveSnapshot(snapshot);
+      offline.Reset();
+      good = offline.RestoreSnapshot(snapshot);
+    }
+    offline.NextStep(t, candidates, emissions[t], transitions[t]);
+    online.NextStep(t, candidates, emissions[t], transitions[t]);
+    good = good && offline.IsBroken() ==
+                       (std::find(expectedBreaks.begin(), expectedBreaks.end(),
+                                  t) != expectedBreaks.end());
+  }
+  auto segments = offline.ComputeMostLikelySegments();
+  good = good && offline.BreakTimeSteps() == expectedBreaks &&
+         online.BreakTimeSteps() == expectedBreaks &&
+         segments.size() == expected.size();
+  std::vector<SequenceState<int, int, int>> concatenated;
+  for (size_t i = 0; good && i < segments.size(); i++) {
+    good = segments[i].startTimeStep == segmentRanges[i].first &&
+           segments[i].sequence == expected[i];
+    concatenated.insert(concatenated.end(), expected[i].begin(),
+                        expected[i].end());
+  }
+  // Online decoding commits the rest of a segment at its break.
+  auto pending = online.ComputeMostLikelySequence();
+  committed.insert(committed.end(), pending.begin(), pending.end());
+  good = good && committed == concatenated;
+  // Without break recovery, decoding stops at the first break.
+  ViterbiAlgorithm<int, int, int> halting;
+  halting.StartWithInitialObservation(0, candidates, emissions[0]);
+  for (int t = 1; t < kNumTimeSteps; t++) {
+    halting.NextStep(t, candidates, emissions[t], transitions[t]);
+  }
+  segments = halting.ComputeMostLikelySegments();
+  good = good && halting.IsBroken() && halting.BreakTimeSteps().empty() &&
+         segments.size() == 1 && segments[0].sequence == expected[0];
+  // Forced commits, also right after an initial break and after a failed
+  // restart. Every time step but the breaks without restart is committed
+  // exactly once, in time order.
+  for (int maxLag = 0; maxLag <= 1; maxLag++) {
+    for (int initialBreak = 0; initialBreak <= 1; initialBreak++) {
+      std::map<int, double> initialEmissions = emissions[0];
+      std::vector<int> laggedBreaks = expectedBreaks;
+      if (initialBreak) {
+        for (auto& emission : initialEmissions) {
+          emission.second = -std::numeric_limits<double>::infinity();
+        }
+        laggedBreaks.insert(laggedBreaks.begin(), {0, 1});
+      }
+      ViterbiAlgorithm<int, int, int> lagged;
+      std::vector<int> committedTimeSteps;
+      lagged.SetBreakRecovery(true);
+      lagged.SetOnlineDecoding(
+          [&committedTimeSteps](
+              const std::vector<SequenceState<int, int, int>>& prefix) {
+            for (auto& ss : prefix) {
+              committedTimeSteps.push_back(ss.observation);
+            }
+          },
+          maxLag);
+      lagged.StartWithInitialObservation(0, candidates, initialEmissions);
+      for (int t = 1; t < kNumTimeSteps; t++) {
+        lagged.NextStep(t, candidates, emissions[t], transitions[t]);
+      }
+      for (auto& ss : lagged.ComputeMostLikelySequence()) {
+        committedTimeSteps.push_back(ss.observation);
+      }
+      std::vector<int> expectedTimeSteps;
+      for (int t = initialBreak; t < kNumTimeSteps; t++) {
+        if (t != 20) {
+          expectedTimeSteps.push_back(t);
+        }
+      }
+      good = good && committedTimeSteps == expectedTimeSteps &&
+             lagged.BreakTimeSteps() == laggedBreaks;
+    }
+  }
+  if (good) {
+    printf("TestBreakRecovery() GOOD: one segment per gap in one pass.\n");
+  } else {
+    Fail("ERR: wrong segments. TestBreakRecovery()\n");
+  }
+}
+void TestMain::TestStateInterner() {
+  StateInterner<std::string> interner;
+  const StateHandle sunny = interner.Intern("sunny");
+  const StateHandle rainy = interner.Intern("rainy");
+  bool good = sunny == 0 && rainy == 1 && interner.Intern("sunny") == 0 &&
+              interner.Intern("sunny", rainy) == sunny &&
+              interner.Intern("rainy", rainy) == rainy &&
+              interner.Intern("foggy", kNoStateHandle) == 2 &&
+              interner.Size() == 3 && interner.State(rainy) == "rainy" &&
+              interner.Find("rainy", sunny) == rainy &&
+              interner.Find("cloudy") == kNoStateHandle && interner.Size() == 3;
+
+  // Every time step has new states, so online decoding has to compact the
+  // state table to keep it bounded. The result must be the same as with int
+  // states 2t and 2t + 1.
+  const int kNumTimeSteps = 3000;
+  std::mt19937 random(61);
+  std::uniform_real_distribution<double> logProbability(-5.0, 0.0);
+  auto name = [](int state) {
+    return "candidate-state-" + std::to_string(state);
+  };
+  ViterbiAlgorithm<int, int, int> reference;
+  ViterbiAlgorithm<std::string, int, int> viterbi;
+  std::vector<SequenceState<int, int, int>> expected;
+  std::vector<SequenceState<std::string, int, int>> committed;
+  reference.SetOnlineDecoding(
+      [&expected](const std::vector<SequenceState<int, int, int>>& prefix) {
+        expected.insert(expected.end(), prefix.begin(), prefix.end());
+      });
+  viterbi.SetOnlineDecoding(
+      [&committed](
+          const std::vector<SequenceState<std::string, int, int>>& prefix) {
+        committed.insert(committed.end(), prefix.begin(), prefix.end());
+      });
+  for (int t = 0; t < kNumTimeSteps; t++) {
+    std::vector<int> candidates = {2 * t, 2 * t + 1};
+    std::vector<std::string> names = {name(2 * t), name(2 * t + 1)};
+    std::map<int, double> emissions;
+    std::map<std::string, double> namedEmissions;
+    std::map<Transition<int>, double> transitions;
+    std::map<Transition<std::string>, double> namedTransitions;
+    for (int i = 0; i < 2; i++) {
+      const double emission = logProbability(random);
+      emissions[candidates[i]] = emission;
+      namedEmissions[names[i]] = emission;
+      for (int from = 2 * t - 2; t > 0 && from < 2 * t; from++) {
+        const double transition = logProbability(random);
+        transitions[Transition<int>(from, candidates[i])] = transition;
+        namedTransitions[Transition<std::string>(name(from), names[i])] =
+            transition;
+      }
+    }
+    if (t == 0) {
+      reference.StartWithInitialObservation(t, candidates, emissions);
+      viterbi.StartWithInitialObservation(t, names, namedEmissions);
+    } else {
+      reference.NextStep(t, candidates, emissions, transitions);
+      viterbi.NextStep(t, names, namedEmissions, namedTransitions);
+    }
+  }
+  auto pending = reference.ComputeMostLikelySequence();
+  expected.insert(expected.end(), pending.begin(), pending.end());
+  auto namedPending = viterbi.ComputeMostLikelySequence();
+  committed.insert(committed.end(), namedPending.begin(), namedPending.end());
+  good = good && committed.size() == (size_t)kNumTimeSteps &&
+         expected.size() == committed.size();
+  for (size_t t = 0; good && t < committed.size(); t++) {
+    good = committed[t].state == name(expected[t].state) &&
+           committed[t].observation == expected[t].observation;
+  }
+  if (good) {
+    printf("TestStateInterner() GOOD: handles map back to the same states.\n");
+  } else {
+    Fail("ERR: wrong states. TestStateInterner()\n");
+  }
+}
+void TestMain::TestTransitionCache() {
+  // Per step maps are walked into a cache by candidate, a map of the whole
+  // model is looked up pair by pair. Both must decode the same.
+  const int kNumStates = 30;
+  const int kNumCandidates = 6;
+  const int kNumTimeSteps = 40;
+  std::mt19937 random(67);
+  std::uniform_real_distribution<double> logProbability(-5.0, 0.0);
+  std::vector<std::string> states;
+  for (int s = 0; s < kNumStates; s++) {
+    states.push_back("state-" + std::to_string(s));
+  }
+  std::map<Transition<std::string>, double> transitions;
+  std::map<Transition<std::string>, std::string> descriptors;
+  for (auto& from : states) {
+    for (auto& to : states) {
+      if (logProbability(random) > -2.5) {
+        transitions[Transition<std::string>(from, to)] =
+            logProbability(random);
+        descriptors[Transition<std::string>(from, to)] = from + ">" + to;
+      }
+    }
+  }
+  ViterbiAlgorithm<std::string, int, std::string> stepMaps;
+  ViterbiAlgorithm<std::string, int, std::string> modelMaps;
+  std::vector<std::string> prevCandidates;
+  for (int t = 0; t < kNumTimeSteps; t++) {
+    // Candidates in a new order each time step, so that handle hints miss.
+    std::shuffle(states.begin(), states.end(), random);
+    std::vector<std::string> candidates(states.begin(),
+                                        states.begin() + kNumCandidates);
+    std::map<std::string, double> emissions;
+    for (auto& candidate : candidates) {
+      emissions[candidate] = logProbability(random);
+    }
+    if (t == 0) {
+      stepMaps.StartWithInitialObservation(t, candidates, emissions);
+      modelMaps.StartWithInitialObservation(t, candidates, emissions);
+    } else {
+      std::map<Transition<std::string>, double> stepTransitions;
+      std::map<Transition<std::string>, std::string> stepDescriptors;
+      for (auto& from : prevCandidates) {
+        for (auto& to : candidates) {
+          auto found = transitions.find(Transition<std::string>(from, to));
+          if (found != transitions.end()) {
+            stepTransitions.insert(*found);
+            stepDescriptors[found->first] = descriptors[found->first];
+          }
+        }
+      }
+      // Duplicates are ignored, the first occurrence is kept.
+      std::vector<std::string> withDuplicates = candidates;
+      if (t == kNumTimeSteps / 2) {
+        withDuplicates.insert(withDuplicates.begin() + 2, candidates[1]);
+        withDuplicates.push_back(candidates[0]);
+      }
+      stepMaps.NextStep(t, withDuplicates, emissions, stepTransitions,
+                        stepDescriptors);
+      modelMaps.NextStep(t, candidates, emissions, transitions, descriptors);
+    }
+    prevCandidates = candidates;
+  }
+  auto expected = modelMaps.ComputeMostLikelySequence();
+  auto actual = stepMaps.ComputeMostLikelySequence();
+  bool good = expected.size() == (size_t)kNumTimeSteps &&
+              actual.size() == expected.size();
+  for (size_t t = 0; good && t < actual.size(); t++) {
+    good = actual[t].state == expected[t].state &&
+           actual[t].transitionDescriptor == expected[t].transitionDescriptor;
+  }
+  if (good) {
+    printf("TestTransitionCache() GOOD: cached transitions decode the same.\n");
+  } else {
+    Fail("ERR: cached transitions differ. TestTransitionCache()\n");
+  }
+}
 }  // namespace hmm
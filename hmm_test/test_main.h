@@ -22,6 +22,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include "message_history.h"
 #include "rain.h"
 
 namespace hmm {
@@ -36,11 +37,45 @@ class TestMain {
   void TestBreakAtFirstTransition();
   void TestBreakAtFirstTransitionWithNoCandidates();
   void TestBreakAtSecondTransition();
+  void TestDenseComputeMostLikelySequence();
+  void TestDenseMatchesMapBasedViterbi();
+  void TestMaxPlusKernel();
+  void TestLongSequenceAndReset();
+  void TestBackPointerReclamation();
+  void TestOnlineDecoding();
+  void TestBatchViterbi();
+  void TestPruning();
+  void TestSparseTransitions();
+  void TestLazyTransitionProvider();
+  void TestParallelForwardStep();
+  void TestKBestViterbi();
+  void TestForwardBackward();
+  void TestCheckpointedViterbi();
+  void TestMessageHistory();
+  void TestAllocationFreeNextStep();
+  void TestStepObserver();
+  void TestFloatProbabilities();
+  void TestFixedViterbi();
+  void TestSnapshot();
+  void TestMappedModel();
+  void TestBaumWelch();
+  void TestParallelScanViterbi();
+  void TestBreakRecovery();
+  void TestStateInterner();
+  void TestTransitionCache();
   void CheckMessageHistory(
       std::vector<std::map<Rain, double>> expectedMessageHistory,
-      std::vector<std::map<Rain, double>> actualMessageHistory);
+      MessageHistoryView<Rain> actualMessageHistory);
   void CheckMessage(std::map<Rain, double> expectedMessage,
-                    std::map<Rain, double> actualMessage);
+                    MessageView<Rain> actualMessage);
+  // Number of failed checks so far.
+  int NumFailures() const;
+
+ private:
+  // Prints a failed check like printf() and counts it.
+  void Fail(const char *format, ...);
+
+  int num_failures = 0;
 };
 
 }  // namespace hmm